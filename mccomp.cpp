@@ -1,7 +1,15 @@
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/DepthFirstIterator.h"
 #include "llvm/ADT/Optional.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
@@ -12,31 +20,212 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#if LLVM_VERSION_MAJOR >= 14
+#include "llvm/MC/TargetRegistry.h"
+#else
 #include "llvm/Support/TargetRegistry.h"
+#endif
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Scalar/TailRecursionElimination.h"
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <chrono>
 #include <cstdio>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
+#include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MCCOMP_X86_SIMD 1
+#endif
 using namespace llvm;
 using namespace llvm::sys;
 
-FILE *pFile;
+//===----------------------------------------------------------------------===//
+// Source buffer
+//===----------------------------------------------------------------------===//
+
+// The whole input is held in one buffer for the lifetime of the compilation.
+// MemoryBuffer maps regular files and reads pipes/stdin ("-") in one go, so the
+// lexer walks a plain character range and lexemes are views into it. The
+// lexer's position is per thread: --parallel-parse lexes several ranges at once.
+static std::unique_ptr<MemoryBuffer> SourceBuf;
+static thread_local const char *CurPtr; // next character to be read by the lexer
+static thread_local const char *BufEnd; // one past the last character to lex
+
+static bool openSource(StringRef Filename)
+{
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr = MemoryBuffer::getFileOrSTDIN(Filename);
+  if (std::error_code EC = BufOrErr.getError())
+  {
+    errs() << "Error opening file: " << EC.message() << "\n";
+    return false;
+  }
+  SourceBuf = std::move(*BufOrErr);
+  CurPtr = SourceBuf->getBufferStart();
+  BufEnd = SourceBuf->getBufferEnd();
+  return true;
+}
+
+// releaseSource - Hand the pages of the source before P back to the OS
+// (--stream, which also has the interner keep its own copies of lexemes).
+// Only a mapped file can be dropped like this; anything that does read a
+// dropped page again just gets it back from the file.
+static void releaseSource(const char *P)
+{
+#ifdef MADV_DONTNEED
+  static const char *Released = nullptr;
+  if (SourceBuf->getBufferKind() != MemoryBuffer::MemoryBuffer_MMap)
+    return;
+  uintptr_t PageSize = sys::Process::getPageSizeEstimate();
+  uintptr_t Begin = alignTo((uintptr_t)(Released ? Released : SourceBuf->getBufferStart()), PageSize);
+  uintptr_t End = alignDown((uintptr_t)P, PageSize);
+  if (End <= Begin)
+    return;
+  madvise((void *)Begin, End - Begin, MADV_DONTNEED);
+  Released = (const char *)End;
+#endif
+}
+
+//===----------------------------------------------------------------------===//
+// String interner
+//===----------------------------------------------------------------------===//
+
+// Every lexeme is interned once and tokens/AST nodes carry its 32-bit id, so
+// copying or comparing a name never touches the characters. The strings are
+// views into the source buffer, which outlives the whole compilation, unless
+// copyStrings() asks for copies so that the source can be released early.
+//
+// Only lexers intern: the one lexer directly, or the --parallel-parse workers
+// through a SymbolCache each. The id -> string table grows in fixed-size
+// chunks that never move, so other threads can look up the ids they have been
+// handed while interning goes on (on the --pipeline lexer thread, say).
+typedef uint32_t SymbolId;
+
+// Symbol 0 is always the empty string.
+static const SymbolId EmptySymbol = 0;
+
+class StringInterner
+{
+  static const unsigned ChunkBits = 12;
+  static const unsigned MaxChunks = 1 << 12; // up to 16M distinct lexemes
+
+  DenseMap<StringRef, SymbolId> Ids;
+  std::unique_ptr<StringRef[]> Chunks[MaxChunks];
+  SymbolId NumStrings = 0;
+  bool CopyStrings = false;
+  BumpPtrAllocator Copies;
+
+public:
+  StringInterner() { intern(""); }
+
+  // copyStrings - Keep a copy of every string interned from now on
+  void copyStrings() { CopyStrings = true; }
+
+  SymbolId intern(StringRef S)
+  {
+    auto Inserted = Ids.try_emplace(S, NumStrings);
+    if (Inserted.second)
+    {
+      if (CopyStrings)
+        Inserted.first->getFirst() = S = S.copy(Copies);
+      unsigned Chunk = NumStrings >> ChunkBits;
+      if (Chunk == MaxChunks)
+        report_fatal_error("too many distinct identifiers and literals");
+      if (!Chunks[Chunk])
+        Chunks[Chunk].reset(new StringRef[1 << ChunkBits]);
+      Chunks[Chunk][NumStrings & ((1 << ChunkBits) - 1)] = S;
+      NumStrings++;
+    }
+    return Inserted.first->second;
+  }
+
+  StringRef str(SymbolId Id) const { return Chunks[Id >> ChunkBits][Id & ((1 << ChunkBits) - 1)]; }
+};
+
+static StringInterner Symbols;
+
+// Taken by the --parallel-parse workers to intern into Symbols
+static std::mutex SymbolsLock;
+
+// SymbolCache - A --parallel-parse worker's own map of the lexemes it has
+// interned, so that it only takes SymbolsLock for lexemes new to it.
+class SymbolCache
+{
+  DenseMap<StringRef, SymbolId> Ids;
+
+public:
+  SymbolId intern(StringRef S)
+  {
+    auto Cached = Ids.find(S);
+    if (Cached != Ids.end())
+      return Cached->second;
+    SymbolId Id;
+    {
+      std::lock_guard<std::mutex> Guard(SymbolsLock);
+      Id = Symbols.intern(S);
+    }
+    Ids.try_emplace(S, Id);
+    return Id;
+  }
+};
+
+// Set on --parallel-parse workers
+static thread_local SymbolCache *LocalSymbols = nullptr;
+
+static inline SymbolId internLexeme(StringRef S)
+{
+  return LocalSymbols ? LocalSymbols->intern(S) : Symbols.intern(S);
+}
+
+// readChar - Return the next source character (or EOF), like getc().
+static inline int readChar()
+{
+  if (CurPtr == BufEnd)
+    return EOF;
+  return (unsigned char)*CurPtr++;
+}
 
 //===----------------------------------------------------------------------===//
 // Lexer
@@ -104,105 +293,505 @@ enum TOKEN_TYPE
   INVALID = -100 // signal invalid token
 };
 
-// TOKEN struct is used to keep track of information about a token
+// TOKEN struct is used to keep track of information about a token. It is a
+// small trivially-copyable record: the spelling lives in the interner and the
+// source buffer, so tokens can be copied and compared without allocating.
 struct TOKEN
 {
   int type = -100;
-  std::string lexeme;
-  int lineNo;
-  int columnNo;
+  SymbolId sym = 0;    // interned lexeme
+  uint32_t offset = 0; // byte offset of the lexeme in the source buffer
+  int lineNo = 0;
+  int columnNo = 0;
+};
+
+static thread_local int lineNo, columnNo;
+static thread_local const char *TokStart; // first character of the token being lexed
+static thread_local int LastChar;         // lookahead character, read from CurPtr[-1]
+
+// LexerState - A snapshot of the (thread_local) lexer, to carry on lexing on
+// another thread
+struct LexerState
+{
+  const char *CurPtr, *BufEnd;
+  int lineNo, columnNo, LastChar;
+};
+
+static LexerState saveLexer() { return {CurPtr, BufEnd, lineNo, columnNo, LastChar}; }
+
+static void restoreLexer(const LexerState &S)
+{
+  CurPtr = S.CurPtr;
+  BufEnd = S.BufEnd;
+  lineNo = S.lineNo;
+  columnNo = S.columnNo;
+  LastChar = S.LastChar;
+}
+
+// Character classes, indexed by the raw byte. EOF maps to byte 255, which has
+// no class, so the lookups below need no special case for it.
+enum CharClass : unsigned char
+{
+  CC_SPACE = 1,   // ' ', '\t', '\n', '\v', '\f', '\r'
+  CC_NEWLINE = 2, // '\n', '\r'
+  CC_ALPHA = 4,   // [a-zA-Z_]
+  CC_DIGIT = 8,   // [0-9]
+};
+
+struct CharClassTable
+{
+  unsigned char Class[256];
+};
+
+static constexpr CharClassTable makeCharClassTable()
+{
+  CharClassTable T{};
+  for (const char *C = " \t\n\v\f\r"; *C; ++C)
+    T.Class[(unsigned char)*C] |= CC_SPACE;
+  T.Class['\n'] |= CC_NEWLINE;
+  T.Class['\r'] |= CC_NEWLINE;
+  for (int C = 'a'; C <= 'z'; ++C)
+    T.Class[C] |= CC_ALPHA;
+  for (int C = 'A'; C <= 'Z'; ++C)
+    T.Class[C] |= CC_ALPHA;
+  T.Class['_'] |= CC_ALPHA;
+  for (int C = '0'; C <= '9'; ++C)
+    T.Class[C] |= CC_DIGIT;
+  return T;
+}
+
+static constexpr CharClassTable CharClasses = makeCharClassTable();
+
+static inline bool isSpaceChar(int C) { return CharClasses.Class[(unsigned char)C] & CC_SPACE; }
+static inline bool isNewlineChar(int C) { return CharClasses.Class[(unsigned char)C] & CC_NEWLINE; }
+static inline bool isIdentStart(int C) { return CharClasses.Class[(unsigned char)C] & CC_ALPHA; }
+static inline bool isIdentChar(int C) { return CharClasses.Class[(unsigned char)C] & (CC_ALPHA | CC_DIGIT); }
+static inline bool isDigitChar(int C) { return CharClasses.Class[(unsigned char)C] & CC_DIGIT; }
+
+//===----------------------------------------------------------------------===//
+// Run scanners
+//===----------------------------------------------------------------------===//
+
+// The lexer spends most of its time in three kinds of runs: whitespace,
+// identifier characters and // comment bodies. Each scanner takes [P, End)
+// and returns the first character that ends the run. skipSpace also counts
+// the newlines it crossed and remembers the last one, so the caller can keep
+// lineNo/columnNo exact. The vector versions test 16 or 32 bytes at a time
+// and finish the tail with the scalar version.
+struct RunScanners
+{
+  const char *Name;
+  const char *(*skipSpace)(const char *P, const char *End, unsigned &Newlines, const char *&LastNewline);
+  const char *(*scanIdent)(const char *P, const char *End);
+  const char *(*scanLineEnd)(const char *P, const char *End);
+};
+
+static const char *skipSpaceScalar(const char *P, const char *End, unsigned &Newlines, const char *&LastNewline)
+{
+  for (; P != End && isSpaceChar(*P); ++P)
+  {
+    if (isNewlineChar(*P))
+    {
+      Newlines++;
+      LastNewline = P;
+    }
+  }
+  return P;
+}
+
+static const char *scanIdentScalar(const char *P, const char *End)
+{
+  while (P != End && isIdentChar(*P))
+    ++P;
+  return P;
+}
+
+static const char *scanLineEndScalar(const char *P, const char *End)
+{
+  while (P != End && !isNewlineChar(*P))
+    ++P;
+  return P;
+}
+
+static const RunScanners ScalarScanners = {"scalar", skipSpaceScalar, scanIdentScalar, scanLineEndScalar};
+
+#ifdef MCCOMP_X86_SIMD
+// Account for the newlines selected by Mask in the block starting at P.
+static inline void countNewlines(const char *P, uint32_t Mask, unsigned &Newlines, const char *&LastNewline)
+{
+  if (Mask)
+  {
+    Newlines += countPopulation(Mask);
+    LastNewline = P + Log2_32(Mask);
+  }
+}
+
+// Per-width classifiers. Each returns one bit per byte: whitespace is ' ' or
+// '\t'..'\r', newlines are '\n' and '\r', identifier characters are letters
+// (tested after folding to lower case), digits and '_'. Range tests use the
+// unsigned-min trick: Lo <= V <= Lo + Span iff min(V - Lo, Span) == V - Lo.
+__attribute__((target("sse2"))) static inline __m128i inRange128(__m128i V, char Lo, char Span)
+{
+  __m128i T = _mm_sub_epi8(V, _mm_set1_epi8(Lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(T, _mm_set1_epi8(Span)), T);
+}
+
+__attribute__((target("sse2"))) static inline uint32_t spaceMask128(__m128i V)
+{
+  return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8(' ')), inRange128(V, '\t', '\r' - '\t')));
+}
+
+__attribute__((target("sse2"))) static inline uint32_t newlineMask128(__m128i V)
+{
+  return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(V, _mm_set1_epi8('\r'))));
+}
+
+__attribute__((target("sse2"))) static inline uint32_t identMask128(__m128i V)
+{
+  __m128i Alpha = inRange128(_mm_or_si128(V, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+  __m128i Digit = inRange128(V, '0', '9' - '0');
+  __m128i Under = _mm_cmpeq_epi8(V, _mm_set1_epi8('_'));
+  return _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(Alpha, Digit), Under));
+}
+
+__attribute__((target("avx2"))) static inline __m256i inRange256(__m256i V, char Lo, char Span)
+{
+  __m256i T = _mm256_sub_epi8(V, _mm256_set1_epi8(Lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(T, _mm256_set1_epi8(Span)), T);
+}
+
+__attribute__((target("avx2"))) static inline uint32_t spaceMask256(__m256i V)
+{
+  return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8(' ')), inRange256(V, '\t', '\r' - '\t')));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t newlineMask256(__m256i V)
+{
+  return _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8('\n')), _mm256_cmpeq_epi8(V, _mm256_set1_epi8('\r'))));
+}
+
+__attribute__((target("avx2"))) static inline uint32_t identMask256(__m256i V)
+{
+  __m256i Alpha = inRange256(_mm256_or_si256(V, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+  __m256i Digit = inRange256(V, '0', '9' - '0');
+  __m256i Under = _mm256_cmpeq_epi8(V, _mm256_set1_epi8('_'));
+  return _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(Alpha, Digit), Under));
+}
+
+__attribute__((target("sse2"))) static const char *skipSpaceSSE2(const char *P, const char *End, unsigned &Newlines, const char *&LastNewline)
+{
+  for (; End - P >= 16; P += 16)
+  {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    uint32_t Space = spaceMask128(V);
+    uint32_t NL = newlineMask128(V);
+    if (Space != 0xFFFF)
+    {
+      unsigned Stop = countTrailingZeros(~Space);
+      countNewlines(P, NL & ((1u << Stop) - 1), Newlines, LastNewline);
+      return P + Stop;
+    }
+    countNewlines(P, NL, Newlines, LastNewline);
+  }
+  return skipSpaceScalar(P, End, Newlines, LastNewline);
+}
+
+__attribute__((target("sse2"))) static const char *scanIdentSSE2(const char *P, const char *End)
+{
+  for (; End - P >= 16; P += 16)
+  {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    uint32_t Ident = identMask128(V);
+    if (Ident != 0xFFFF)
+      return P + countTrailingZeros(~Ident);
+  }
+  return scanIdentScalar(P, End);
+}
+
+__attribute__((target("sse2"))) static const char *scanLineEndSSE2(const char *P, const char *End)
+{
+  for (; End - P >= 16; P += 16)
+  {
+    __m128i V = _mm_loadu_si128((const __m128i *)P);
+    uint32_t NL = newlineMask128(V);
+    if (NL)
+      return P + countTrailingZeros(NL);
+  }
+  return scanLineEndScalar(P, End);
+}
+
+__attribute__((target("avx2"))) static const char *skipSpaceAVX2(const char *P, const char *End, unsigned &Newlines, const char *&LastNewline)
+{
+  for (; End - P >= 32; P += 32)
+  {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    uint32_t Space = spaceMask256(V);
+    uint32_t NL = newlineMask256(V);
+    if (Space != 0xFFFFFFFF)
+    {
+      unsigned Stop = countTrailingZeros(~Space);
+      countNewlines(P, NL & (uint32_t)((1ull << Stop) - 1), Newlines, LastNewline);
+      return P + Stop;
+    }
+    countNewlines(P, NL, Newlines, LastNewline);
+  }
+  return skipSpaceScalar(P, End, Newlines, LastNewline);
+}
+
+__attribute__((target("avx2"))) static const char *scanIdentAVX2(const char *P, const char *End)
+{
+  for (; End - P >= 32; P += 32)
+  {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    uint32_t Ident = identMask256(V);
+    if (Ident != 0xFFFFFFFF)
+      return P + countTrailingZeros(~Ident);
+  }
+  return scanIdentScalar(P, End);
+}
+
+__attribute__((target("avx2"))) static const char *scanLineEndAVX2(const char *P, const char *End)
+{
+  for (; End - P >= 32; P += 32)
+  {
+    __m256i V = _mm256_loadu_si256((const __m256i *)P);
+    uint32_t NL = newlineMask256(V);
+    if (NL)
+      return P + countTrailingZeros(NL);
+  }
+  return scanLineEndScalar(P, End);
+}
+
+static const RunScanners SSE2Scanners = {"sse2", skipSpaceSSE2, scanIdentSSE2, scanLineEndSSE2};
+static const RunScanners AVX2Scanners = {"avx2", skipSpaceAVX2, scanIdentAVX2, scanLineEndAVX2};
+#endif
+
+enum class ScanMode
+{
+  Auto,
+  Scalar,
+  SSE2,
+  AVX2
+};
+
+static const RunScanners *Scanners = &ScalarScanners;
+
+// selectScanners - Pick the run scanners once, at startup. Auto uses the
+// widest vector unit the host supports; an explicit mode the host cannot run
+// falls back to scalar.
+static void selectScanners(ScanMode Mode)
+{
+  Scanners = &ScalarScanners;
+#ifdef MCCOMP_X86_SIMD
+  __builtin_cpu_init();
+  bool HasSSE2 = __builtin_cpu_supports("sse2");
+  bool HasAVX2 = __builtin_cpu_supports("avx2");
+  if ((Mode == ScanMode::Auto || Mode == ScanMode::AVX2) && HasAVX2)
+    Scanners = &AVX2Scanners;
+  else if ((Mode == ScanMode::Auto || Mode == ScanMode::SSE2) && HasSSE2)
+    Scanners = &SSE2Scanners;
+#endif
+}
+
+// Keywords are recognised through a perfect hash on (first char, last char,
+// length). The seed is searched for at compile time, so adding a keyword that
+// breaks perfection fails the build instead of silently slowing the lexer.
+struct KeywordEntry
+{
+  const char *Spelling;
+  unsigned Length;
+  int Kind;
+};
+
+static constexpr KeywordEntry Keywords[] = {
+    {"int", 3, INT_TOK}, {"bool", 4, BOOL_TOK}, {"float", 5, FLOAT_TOK}, {"void", 4, VOID_TOK}, {"extern", 6, EXTERN}, {"if", 2, IF}, {"else", 4, ELSE}, {"while", 5, WHILE}, {"return", 6, RETURN}, {"true", 4, BOOL_LIT}, {"false", 5, BOOL_LIT}};
+
+static constexpr unsigned NumKeywords = sizeof(Keywords) / sizeof(Keywords[0]);
+static constexpr unsigned KeywordTableSize = 32;
+
+static constexpr unsigned keywordHash(unsigned char First, unsigned char Last, size_t Length, unsigned Seed)
+{
+  return (First * Seed + Last + Length) % KeywordTableSize;
+}
+
+static constexpr unsigned findKeywordSeed()
+{
+  for (unsigned Seed = 1; Seed < 4096; ++Seed)
+  {
+    bool Used[KeywordTableSize] = {};
+    bool Perfect = true;
+    for (const KeywordEntry &K : Keywords)
+    {
+      unsigned H = keywordHash(K.Spelling[0], K.Spelling[K.Length - 1], K.Length, Seed);
+      Perfect &= !Used[H];
+      Used[H] = true;
+    }
+    if (Perfect)
+      return Seed;
+  }
+  return 0;
+}
+
+static constexpr unsigned KeywordSeed = findKeywordSeed();
+static_assert(KeywordSeed != 0, "no perfect hash seed for the keyword set");
+
+// Slot -> index into Keywords, or -1 for an empty slot.
+struct KeywordTable
+{
+  signed char Index[KeywordTableSize];
 };
 
-static std::string IdentifierStr; // Filled in if IDENT
-static int IntVal;                // Filled in if INT_LIT
-static bool BoolVal;              // Filled in if BOOL_LIT
-static float FloatVal;            // Filled in if FLOAT_LIT
-static std::string StringVal;     // Filled in if String Literal
-static int lineNo, columnNo;
+static constexpr KeywordTable makeKeywordTable()
+{
+  KeywordTable T{};
+  for (unsigned H = 0; H < KeywordTableSize; ++H)
+    T.Index[H] = -1;
+  for (unsigned I = 0; I < NumKeywords; ++I)
+    T.Index[keywordHash(Keywords[I].Spelling[0], Keywords[I].Spelling[Keywords[I].Length - 1], Keywords[I].Length, KeywordSeed)] = I;
+  return T;
+}
+
+static constexpr KeywordTable KeywordSlots = makeKeywordTable();
+
+// lookupKeyword - Index into Keywords of the identifier S, or -1.
+static inline int lookupKeyword(StringRef S)
+{
+  int I = KeywordSlots.Index[keywordHash(S.front(), S.back(), S.size(), KeywordSeed)];
+  if (I >= 0 && Keywords[I].Length == S.size() && memcmp(Keywords[I].Spelling, S.data(), S.size()) == 0)
+    return I;
+  return -1;
+}
+
+// Tokens with a fixed spelling are interned once, up front, by initLexer():
+// per kind for punctuation and operators, per entry for the keywords.
+static SymbolId FixedSymbols[256 - INVALID];
+static SymbolId KeywordSymbols[NumKeywords];
+
+static void initLexer(ScanMode Mode)
+{
+  selectScanners(Mode);
+
+  static const struct
+  {
+    int Kind;
+    const char *Spelling;
+  } FixedTokens[] = {
+      {ASSIGN, "="}, {EQ, "=="}, {LBRA, "{"}, {RBRA, "}"}, {LPAR, "("}, {RPAR, ")"}, {SC, ";"}, {COMMA, ","}, {AND, "&&"}, {int('&'), "&"}, {OR, "||"}, {int('|'), "|"}, {NE, "!="}, {NOT, "!"}, {LE, "<="}, {LT, "<"}, {GE, ">="}, {GT, ">"}, {PLUS, "+"}, {MINUS, "-"}, {ASTERIX, "*"}, {DIV, "/"}, {MOD, "%"}, {EOF_TOK, "0"}};
+
+  for (const auto &T : FixedTokens)
+    FixedSymbols[T.Kind - INVALID] = Symbols.intern(T.Spelling);
+  for (unsigned I = 0; I < NumKeywords; ++I)
+  {
+    KeywordSymbols[I] = Symbols.intern(StringRef(Keywords[I].Spelling, Keywords[I].Length));
+    if (Keywords[I].Kind != BOOL_LIT)
+      FixedSymbols[Keywords[I].Kind - INVALID] = KeywordSymbols[I];
+  }
+
+  // Prime the lookahead as if a space preceded the source.
+  lineNo = 1;
+  columnNo = 2;
+  LastChar = readChar();
+}
 
-static TOKEN returnTok(std::string lexVal, int tok_type)
+static TOKEN returnTok(StringRef lexVal, int tok_type, SymbolId sym)
 {
   TOKEN return_tok;
-  return_tok.lexeme = lexVal;
   return_tok.type = tok_type;
+  return_tok.sym = sym;
+  return_tok.offset = TokStart - SourceBuf->getBufferStart();
   return_tok.lineNo = lineNo;
-  return_tok.columnNo = columnNo - lexVal.length() - 1;
+  return_tok.columnNo = columnNo - lexVal.size() - 1;
   return return_tok;
 }
 
+static TOKEN returnTok(StringRef lexVal, int tok_type)
+{
+  SymbolId Sym = FixedSymbols[tok_type - INVALID];
+  return returnTok(lexVal, tok_type, Sym ? Sym : internLexeme(lexVal));
+}
+
+// lexemeFrom - The lexeme that starts at Start and ends just before LastChar,
+// the lookahead character that has already been read from the buffer.
+static inline StringRef lexemeFrom(const char *Start, int LastChar)
+{
+  const char *End = LastChar == EOF ? CurPtr : CurPtr - 1;
+  return StringRef(Start, End - Start);
+}
+
+// Number lexemes are views into the source, so copy them into a small
+// null-terminated buffer before handing them to the C conversion routines.
+static float lexemeToFloat(StringRef S)
+{
+  SmallString<32> Tmp(S);
+  return strtof(Tmp.c_str(), nullptr);
+}
+
+static int lexemeToInt(StringRef S)
+{
+  SmallString<32> Tmp(S);
+  return strtod(Tmp.c_str(), nullptr);
+}
+
 // Read file line by line -- or look for \n and if found add 1 to line number
 // and reset column number to 0
 /// gettok - Return the next token from standard input.
 static TOKEN gettok()
 {
 
-  static int LastChar = ' ';
-  static int NextChar = ' ';
+  int NextChar;
 
-  // Skip any whitespace.
-  while (isspace(LastChar))
-  {
-    if (LastChar == '\n' || LastChar == '\r')
+  // Skip any whitespace. The column ends up one past the distance from the
+  // last newline crossed, or advanced by the length of the run if there was
+  // none.
+  if (isSpaceChar(LastChar) && CurPtr != BufEnd && !isSpaceChar(*CurPtr))
+  { // a single space or newline is by far the most common run
+    if (isNewlineChar(LastChar))
     {
       lineNo++;
       columnNo = 1;
     }
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
   }
-
-  if (isalpha(LastChar) ||
-      (LastChar == '_'))
-  { // identifier: [a-zA-Z_][a-zA-Z_0-9]*
-    IdentifierStr = LastChar;
-    columnNo++;
-
-    while (isalnum((LastChar = getc(pFile))) || (LastChar == '_'))
+  else if (isSpaceChar(LastChar))
+  {
+    const char *Start = CurPtr - 1;
+    unsigned Newlines = 0;
+    const char *LastNewline = nullptr;
+    CurPtr = Scanners->skipSpace(Start, BufEnd, Newlines, LastNewline);
+    if (Newlines)
     {
-      IdentifierStr += LastChar;
-      columnNo++;
+      lineNo += Newlines;
+      columnNo = 1 + (CurPtr - LastNewline);
     }
+    else
+      columnNo += CurPtr - Start;
+    LastChar = readChar();
+  }
 
-    if (IdentifierStr == "int")
-      return returnTok("int", INT_TOK);
-    if (IdentifierStr == "bool")
-      return returnTok("bool", BOOL_TOK);
-    if (IdentifierStr == "float")
-      return returnTok("float", FLOAT_TOK);
-    if (IdentifierStr == "void")
-      return returnTok("void", VOID_TOK);
-    if (IdentifierStr == "bool")
-      return returnTok("bool", BOOL_TOK);
-    if (IdentifierStr == "extern")
-      return returnTok("extern", EXTERN);
-    if (IdentifierStr == "if")
-      return returnTok("if", IF);
-    if (IdentifierStr == "else")
-      return returnTok("else", ELSE);
-    if (IdentifierStr == "while")
-      return returnTok("while", WHILE);
-    if (IdentifierStr == "return")
-      return returnTok("return", RETURN);
-    if (IdentifierStr == "true")
-    {
-      BoolVal = true;
-      return returnTok("true", BOOL_LIT);
-    }
-    if (IdentifierStr == "false")
-    {
-      BoolVal = false;
-      return returnTok("false", BOOL_LIT);
-    }
+  TokStart = LastChar == EOF ? CurPtr : CurPtr - 1;
+
+  if (isIdentStart(LastChar))
+  { // identifier: [a-zA-Z_][a-zA-Z_0-9]*
+    const char *Start = CurPtr - 1;
+    CurPtr = Scanners->scanIdent(CurPtr, BufEnd);
+    columnNo += CurPtr - Start;
+    StringRef IdentifierStr(Start, CurPtr - Start);
+    LastChar = readChar();
+
+    int K = lookupKeyword(IdentifierStr);
+    if (K >= 0)
+      return returnTok(IdentifierStr, Keywords[K].Kind, KeywordSymbols[K]);
 
-    return returnTok(IdentifierStr.c_str(), IDENT);
+    return returnTok(IdentifierStr, IDENT);
   }
 
   if (LastChar == '=')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '=')
     { // EQ: ==
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok("==", EQ);
     }
@@ -216,81 +805,78 @@ static TOKEN gettok()
 
   if (LastChar == '{')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok("{", LBRA);
   }
   if (LastChar == '}')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok("}", RBRA);
   }
   if (LastChar == '(')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok("(", LPAR);
   }
   if (LastChar == ')')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok(")", RPAR);
   }
   if (LastChar == ';')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok(";", SC);
   }
   if (LastChar == ',')
   {
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     return returnTok(",", COMMA);
   }
 
-  if (isdigit(LastChar) || LastChar == '.')
+  if (isDigitChar(LastChar) || LastChar == '.')
   { // Number: [0-9]+.
-    std::string NumStr;
+    const char *Start = CurPtr - 1;
 
     if (LastChar == '.')
     { // Floatingpoint Number: .[0-9]+
       do
       {
-        NumStr += LastChar;
-        LastChar = getc(pFile);
+        LastChar = readChar();
         columnNo++;
-      } while (isdigit(LastChar));
+      } while (isDigitChar(LastChar));
 
-      FloatVal = strtof(NumStr.c_str(), nullptr);
+      StringRef NumStr = lexemeFrom(Start, LastChar);
       return returnTok(NumStr, FLOAT_LIT);
     }
     else
     {
       do
       { // Start of Number: [0-9]+
-        NumStr += LastChar;
-        LastChar = getc(pFile);
+        LastChar = readChar();
         columnNo++;
-      } while (isdigit(LastChar));
+      } while (isDigitChar(LastChar));
 
       if (LastChar == '.')
       { // Floatingpoint Number: [0-9]+.[0-9]+)
         do
         {
-          NumStr += LastChar;
-          LastChar = getc(pFile);
+          LastChar = readChar();
           columnNo++;
-        } while (isdigit(LastChar));
+        } while (isDigitChar(LastChar));
 
-        FloatVal = strtof(NumStr.c_str(), nullptr);
+        StringRef NumStr = lexemeFrom(Start, LastChar);
         return returnTok(NumStr, FLOAT_LIT);
       }
       else
       { // Integer : [0-9]+
-        IntVal = strtod(NumStr.c_str(), nullptr);
+        StringRef NumStr = lexemeFrom(Start, LastChar);
         return returnTok(NumStr, INT_LIT);
       }
     }
@@ -298,10 +884,10 @@ static TOKEN gettok()
 
   if (LastChar == '&')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '&')
     { // AND: &&
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok("&&", AND);
     }
@@ -315,10 +901,10 @@ static TOKEN gettok()
 
   if (LastChar == '|')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '|')
     { // OR: ||
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok("||", OR);
     }
@@ -332,10 +918,10 @@ static TOKEN gettok()
 
   if (LastChar == '!')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '=')
     { // NE: !=
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok("!=", NE);
     }
@@ -350,10 +936,10 @@ static TOKEN gettok()
 
   if (LastChar == '<')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '=')
     { // LE: <=
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok("<=", LE);
     }
@@ -367,10 +953,10 @@ static TOKEN gettok()
 
   if (LastChar == '>')
   {
-    NextChar = getc(pFile);
+    NextChar = readChar();
     if (NextChar == '=')
     { // GE: >=
-      LastChar = getc(pFile);
+      LastChar = readChar();
       columnNo += 2;
       return returnTok(">=", GE);
     }
@@ -384,15 +970,14 @@ static TOKEN gettok()
 
   if (LastChar == '/')
   { // could be division or could be the start of a comment
-    LastChar = getc(pFile);
+    LastChar = readChar();
     columnNo++;
     if (LastChar == '/')
     { // definitely a comment
-      do
-      {
-        LastChar = getc(pFile);
-        columnNo++;
-      } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+      const char *Body = CurPtr;
+      CurPtr = Scanners->scanLineEnd(Body, BufEnd);
+      columnNo += CurPtr - Body + 1;
+      LastChar = readChar();
 
       if (LastChar != EOF)
         return gettok();
@@ -410,51 +995,161 @@ static TOKEN gettok()
 
   // Otherwise, just return the character as its ascii value.
   int ThisChar = LastChar;
-  std::string s(1, ThisChar);
-  LastChar = getc(pFile);
+  StringRef s(CurPtr - 1, 1);
+  LastChar = readChar();
   columnNo++;
   return returnTok(s, int(ThisChar));
 }
 
 //===----------------------------------------------------------------------===//
-// Parsertok_identifierd updates CurTok with its results.
-static TOKEN CurTok;
-static std::deque<TOKEN> tok_buffer;
-static TOKEN error_token; // for error recovery in the syntax analysis
-static int errorLineNo, errorColumnNo;
+// Token ring
+//===----------------------------------------------------------------------===//
 
-static TOKEN getNextToken()
+// TokenRing - Bounded single-producer/single-consumer queue of tokens, from
+// the lexer thread to the parser thread under --pipeline. Head and Tail only
+// ever grow; each side owns one of them and reads the other with acquire
+// ordering, so a token's slot (and the interned strings it refers to) is
+// published before the parser can see it. A side that finds the ring full or
+// empty yields its core rather than spinning.
+class TokenRing
 {
-  error_token = CurTok;
-  errorLineNo = CurTok.lineNo;
-  errorColumnNo = CurTok.columnNo;
+  static const size_t Size = 4096; // a power of two
 
-  if (tok_buffer.size() == 0)
-    tok_buffer.push_back(gettok());
+  TOKEN Slots[Size];
+  alignas(64) std::atomic<size_t> Head{0}; // next token to pop
+  alignas(64) std::atomic<size_t> Tail{0}; // next slot to push into
+  alignas(64) size_t CachedHead = 0;       // producer's last look at Head
 
-  TOKEN temp = tok_buffer.front();
+public:
+  void push(const TOKEN &Tok)
+  {
+    size_t T = Tail.load(std::memory_order_relaxed);
+    while (T - CachedHead == Size)
+    {
+      CachedHead = Head.load(std::memory_order_acquire);
+      if (T - CachedHead == Size)
+        std::this_thread::yield();
+    }
+    Slots[T & (Size - 1)] = Tok;
+    Tail.store(T + 1, std::memory_order_release);
+  }
 
-  tok_buffer.pop_front();
+  TOKEN pop()
+  {
+    size_t H = Head.load(std::memory_order_relaxed);
+    while (Tail.load(std::memory_order_acquire) == H)
+      std::this_thread::yield();
+    TOKEN Tok = Slots[H & (Size - 1)];
+    Head.store(H + 1, std::memory_order_release);
+    return Tok;
+  }
+};
 
-  return CurTok = temp;
+// Set while the lexer runs on its own thread; the parser then reads tokens
+// from here instead of calling gettok().
+static TokenRing *LexerRing = nullptr;
+
+// lexerThread - Lex the rest of the input, from where Start left off, into
+// LexerRing, up to and including EOF.
+static void lexerThread(LexerState Start)
+{
+  restoreLexer(Start);
+  TOKEN Tok;
+  do
+  {
+    Tok = gettok();
+    LexerRing->push(Tok);
+  } while (Tok.type != EOF_TOK);
 }
 
-// Return the first token from the buffer without removing it.
-static TOKEN lookahead1()
+// fetchToken - The next token of the input, from the lexer thread if there is
+// one. Past the end, EOF is returned again.
+static TOKEN fetchToken()
 {
-  if (tok_buffer.size() == 0)
-    tok_buffer.push_back(gettok());
-  return tok_buffer.front();
+  if (!LexerRing)
+    return gettok();
+  static TOKEN Last;
+  if (Last.type != EOF_TOK)
+    Last = LexerRing->pop();
+  return Last;
 }
 
-// Return the second token from the buffer without removing it.
-static TOKEN lookahead2()
+//===----------------------------------------------------------------------===//
+// Parsertok_identifierd updates CurTok with its results.
+// Each thread parses from its own token stream (--parallel-parse), so the
+// parser's current token, lookahead and error position are thread_local.
+
+// TokenBuffer - The tokens read ahead by lookahead1/2 (or put back) and not
+// consumed yet; a fixed array, so that it needs no thread_local constructor.
+struct TokenBuffer
 {
-  if (tok_buffer.size() == 0)
-    tok_buffer.push_back(gettok());
+  TOKEN Toks[3];
+  unsigned Size = 0;
 
-  if (tok_buffer.size() == 1)
-    tok_buffer.push_back(gettok());
+  unsigned size() const { return Size; }
+  TOKEN &front() { return Toks[0]; }
+  TOKEN &operator[](unsigned I) { return Toks[I]; }
+
+  void push_back(const TOKEN &Tok)
+  {
+    assert(Size < 3 && "lookahead is at most two tokens");
+    Toks[Size++] = Tok;
+  }
+
+  void push_front(const TOKEN &Tok)
+  {
+    assert(Size < 3 && "lookahead is at most two tokens");
+    for (unsigned I = Size; I > 0; --I)
+      Toks[I] = Toks[I - 1];
+    Toks[0] = Tok;
+    Size++;
+  }
+
+  void pop_front()
+  {
+    for (unsigned I = 1; I < Size; ++I)
+      Toks[I - 1] = Toks[I];
+    Size--;
+  }
+};
+
+static thread_local TOKEN CurTok;
+static thread_local TokenBuffer tok_buffer;
+static thread_local TOKEN error_token; // for error recovery in the syntax analysis
+static thread_local int errorLineNo, errorColumnNo;
+
+static TOKEN getNextToken()
+{
+  error_token = CurTok;
+  errorLineNo = CurTok.lineNo;
+  errorColumnNo = CurTok.columnNo;
+
+  if (tok_buffer.size() == 0)
+    tok_buffer.push_back(fetchToken());
+
+  TOKEN temp = tok_buffer.front();
+
+  tok_buffer.pop_front();
+
+  return CurTok = temp;
+}
+
+// Return the first token from the buffer without removing it.
+static TOKEN lookahead1()
+{
+  if (tok_buffer.size() == 0)
+    tok_buffer.push_back(fetchToken());
+  return tok_buffer.front();
+}
+
+// Return the second token from the buffer without removing it.
+static TOKEN lookahead2()
+{
+  if (tok_buffer.size() == 0)
+    tok_buffer.push_back(fetchToken());
+
+  if (tok_buffer.size() == 1)
+    tok_buffer.push_back(fetchToken());
 
   return tok_buffer[1];
 }
@@ -465,37 +1160,213 @@ static void putBackToken(TOKEN tok) { tok_buffer.push_front(tok); }
 // AST nodes
 //===----------------------------------------------------------------------===//
 
+// All AST nodes of a compilation, and their child lists, are bump-allocated
+// from the arena of the thread that parsed them: MainASTArena, or one per
+// --parallel-parse worker. Nodes are never destroyed one by one: freeing the
+// program is releasing the arenas' slabs, so node classes must stay trivially
+// destructible (names are SymbolIds, spellings and types are static
+// StringRefs, children are arena arrays).
+static BumpPtrAllocator MainASTArena;
+static thread_local BumpPtrAllocator *ASTArena = &MainASTArena;
+static thread_local uint64_t NumASTNodes = 0;
+
+template <typename T, typename... ArgTs>
+static T *newNode(ArgTs &&...Args)
+{
+  static_assert(std::is_trivially_destructible<T>::value, "AST nodes are never destroyed");
+  NumASTNodes++;
+  return new (ASTArena->Allocate<T>()) T(std::forward<ArgTs>(Args)...);
+}
+
+// copyToArena - Copy a child list built up by the parser into the arena.
+template <typename T>
+static ArrayRef<T> copyToArena(ArrayRef<T> Elts)
+{
+  if (Elts.empty())
+    return ArrayRef<T>();
+  T *Mem = ASTArena->Allocate<T>(Elts.size());
+  std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+  return ArrayRef<T>(Mem, Elts.size());
+}
+
+class ASTnode;
+class VarDeclASTnode;
+// Child lists while they are being parsed; most fit the inline storage.
+typedef SmallVector<ASTnode *, 8> NodeList;
+typedef SmallVector<VarDeclASTnode *, 4> ParamList;
+
+// ASTEvent - Writes one event of --dump-ast=json, a JSON object on a line of
+// its own, as the node's attributes are added and the event goes out of
+// scope. A node with children is a "begin" event, the events of its children
+// in order and an "end" event; a node without is a single "leaf" event. The
+// strings written are identifiers, type names and operators, which need no
+// escaping.
+class ASTEvent
+{
+  raw_ostream &OS;
+
+public:
+  ASTEvent(raw_ostream &OS, StringRef Event, StringRef Kind, const TOKEN *Tok = nullptr) : OS(OS)
+  {
+    OS << "{\"event\":\"" << Event << "\",\"kind\":\"" << Kind << "\"";
+    if (Tok)
+      OS << ",\"line\":" << Tok->lineNo << ",\"column\":" << Tok->columnNo;
+  }
+  ~ASTEvent() { OS << "}\n"; }
+
+  ASTEvent &attr(StringRef Key, StringRef Value)
+  {
+    OS << ",\"" << Key << "\":\"" << Value << "\"";
+    return *this;
+  }
+  ASTEvent &attr(StringRef Key, const char *Value) { return attr(Key, StringRef(Value)); }
+  ASTEvent &attr(StringRef Key, int Value)
+  {
+    OS << ",\"" << Key << "\":" << Value;
+    return *this;
+  }
+  ASTEvent &attr(StringRef Key, float Value)
+  {
+    OS << ",\"" << Key << "\":" << format("%.9g", Value);
+    return *this;
+  }
+  ASTEvent &attr(StringRef Key, bool Value)
+  {
+    OS << ",\"" << Key << "\":" << (Value ? "true" : "false");
+    return *this;
+  }
+};
+
 /// ASTnode - Base class for all AST nodes.
+class ASTFolder;
+template <typename NodeT>
+struct Folded;
+
 class ASTnode
 {
 public:
-  virtual ~ASTnode() {}
   virtual Value *codegen() = 0;
-  virtual std::string to_string() const
-  {
-    return "ASTnode";
-  };
+  // print - Write the node and its subtree as --dump-ast prints it
+  virtual void print(raw_ostream &OS) const = 0;
+  // printJSON - Write the events of the node and its subtree (--dump-ast=json)
+  virtual void printJSON(raw_ostream &OS) const = 0;
+  // declare - For a top-level declaration, declare in TheModule what the code
+  // after it sees of it and return that, or null if it clashes with an earlier
+  // declaration (--lazy)
+  virtual Value *declare() { return nullptr; }
+  // hasBody - Whether this is a function definition
+  virtual bool hasBody() const { return false; }
+  // fold - Fold the constants in the subtree and simplify its expressions,
+  // returning the node that takes its place (--fold)
+  virtual Folded<ASTnode *> fold(ASTFolder &F);
+  // isCheap - Whether this is an expression of at most Budget nodes (taken
+  // off Budget) that calls nothing, assigns nothing and does not divide, so
+  // that && and || may as well evaluate it whatever their left operand is
+  virtual bool isCheap(unsigned &Budget) const { return false; }
+  // children - Append the node's children, in order; only the nodes inside
+  // function bodies, which dead code elimination may drop, list theirs
+  virtual void children(SmallVectorImpl<ASTnode *> &Kids) const {}
 };
 
-/// LogError* - These are little helper functions for error handling.
-std::unique_ptr<ASTnode> LogError(const char *Str)
+// the Budget of isCheap for the right operand of && and ||
+static const unsigned CheapOperandNodes = 8;
+
+static bool takeCheapNode(unsigned &Budget)
 {
-  fprintf(stderr, "Ln: %d, Col:%d - Syntax Error: %s\n", errorLineNo, errorColumnNo, Str);
+  if (!Budget)
+    return false;
+  Budget--;
+  return true;
+}
+
+// Set while other threads (of --pipeline, or --parallel-parse workers) may
+// still be running.
+static std::atomic<bool> ThreadsRunning{false};
+
+// exitOnError - Stop compiling once an error has been reported. While other
+// threads are still running, static destructors must not run under them, so
+// leave without them (and without flushing stdout).
+[[noreturn]] static void exitOnError()
+{
+  if (ThreadsRunning)
+  {
+    fflush(stderr);
+    _Exit(-1);
+  }
   exit(-1);
+}
+
+// Set on --parallel-parse worker threads
+static thread_local bool InParseWorker = false;
+
+// ParseAbandoned is set when a --parallel-parse worker gives up; the other
+// workers then stop at the next declaration and no more batches are started.
+// Under ParseDoneLock, BatchesBusy counts the batches being parsed and
+// BatchesDone those finished; ParseDone is notified when either changes.
+static std::atomic<bool> ParseAbandoned{false};
+static size_t BatchesBusy = 0, BatchesDone = 0;
+static std::mutex ParseDoneLock;
+static std::condition_variable ParseDone;
+
+// parkThread - Park a worker thread that has given up for good
+[[noreturn]] static void parkThread()
+{
+  for (;;)
+    std::this_thread::sleep_for(std::chrono::hours(24));
+}
+
+// abandonParse - A --parallel-parse worker has hit a syntax error. It does not
+// report it: the message depends on the tokens before it and an earlier batch
+// may hold an earlier error. The program is parsed again sequentially
+// instead, which reports the error as it always would. The worker cannot
+// unwind out of the parser, so it parks for good.
+[[noreturn]] static void abandonParse()
+{
+  {
+    std::lock_guard<std::mutex> Guard(ParseDoneLock);
+    ParseAbandoned = true;
+    BatchesBusy--;
+  }
+  ParseDone.notify_all();
+  parkThread();
+}
+
+// syntaxError - Report a syntax error at the last token consumed and stop
+[[noreturn]] static void syntaxError(const char *Str)
+{
+  if (InParseWorker)
+    abandonParse();
+  fprintf(stderr, "Ln: %d, Col:%d - Syntax Error: %s\n", errorLineNo, errorColumnNo, Str);
+  exitOnError();
+}
+
+/// LogError* - These are little helper functions for error handling.
+std::nullptr_t LogError(const char *Str)
+{
+  syntaxError(Str);
   return nullptr;
 }
 
-std::unique_ptr<ASTnode> LogErrorSemantic(const char *Str, TOKEN tok)
+// Set while the code of a function is generated for --lazy: the warnings and
+// error of that code, which are reported when the function is first called
+static thread_local std::string *CodegenDiags = nullptr;
+[[noreturn]] static void abandonLazyCodegen();
+
+ASTnode *LogErrorSemantic(const char *Str, TOKEN tok)
 {
+  if (CodegenDiags)
+  {
+    raw_string_ostream(*CodegenDiags) << "Ln: " << tok.lineNo << ", Col:" << tok.columnNo << " - Semantic Error: " << Str << "\n";
+    abandonLazyCodegen();
+  }
   fprintf(stderr, "Ln: %d, Col:%d - Semantic Error: %s\n", tok.lineNo, tok.columnNo, Str);
-  exit(-1);
+  exitOnError();
   return nullptr;
 }
 
-std::string LogErrorStr(const char *Str)
+StringRef LogErrorStr(const char *Str)
 {
-  fprintf(stderr, "Ln: %d, Col:%d - Syntax Error: %s\n", errorLineNo, errorColumnNo, Str);
-  exit(-1);
+  syntaxError(Str);
   return "";
 }
 
@@ -506,13 +1377,16 @@ class IntASTnode : public ASTnode
   int Val;
 
 public:
-  IntASTnode(TOKEN tok, int val) : Val(val), Tok(tok) {}
+  IntASTnode(TOKEN tok, int val) : Tok(tok), Val(val) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override { OS << Val; }
+  void printJSON(raw_ostream &OS) const override
   {
-    return std::to_string(Val);
-  };
+    ASTEvent(OS, "leaf", "Int", &Tok).attr("value", Val);
+  }
 
+  bool isCheap(unsigned &Budget) const override { return takeCheapNode(Budget); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
@@ -525,11 +1399,14 @@ class FloatASTnode : public ASTnode
 public:
   FloatASTnode(TOKEN tok, float val) : Val(val), Tok(tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override { OS << format("%f", Val); }
+  void printJSON(raw_ostream &OS) const override
   {
-    return std::to_string(Val);
-  };
+    ASTEvent(OS, "leaf", "Float", &Tok).attr("value", Val);
+  }
 
+  bool isCheap(unsigned &Budget) const override { return takeCheapNode(Budget); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
@@ -542,60 +1419,67 @@ class BoolASTnode : public ASTnode
 public:
   BoolASTnode(TOKEN tok, bool val) : Val(val), Tok(tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override { OS << (Val ? "1" : "0"); }
+  void printJSON(raw_ostream &OS) const override
   {
-    return std::to_string(Val);
-  };
+    ASTEvent(OS, "leaf", "Bool", &Tok).attr("value", Val);
+  }
 
+  bool isCheap(unsigned &Budget) const override { return takeCheapNode(Budget); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // VarCallASTnode - Class for variable calls like a, b, c
 class VarCallASTnode : public ASTnode
 {
-  std::string Name;
+  SymbolId Name;
   TOKEN Tok; // token of the call
 
 public:
-  VarCallASTnode(TOKEN tok, std::string name) : Name(name), Tok(tok) {}
+  VarCallASTnode(TOKEN tok, SymbolId name) : Name(name), Tok(tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override { OS << Symbols.str(Name); }
+  void printJSON(raw_ostream &OS) const override
   {
-    return Name;
-  };
+    ASTEvent(OS, "leaf", "VarCall", &Tok).attr("name", Symbols.str(Name));
+  }
 
+  bool isCheap(unsigned &Budget) const override { return takeCheapNode(Budget); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // VarDeclASTnode - Class for variable declarations and function parameters like int a, float b, bool c -
 class VarDeclASTnode : public ASTnode
 {
-  std::string Name;
-  std::string Type;
+  SymbolId Name;
+  StringRef Type;
   TOKEN Tok; // token at the name of the variable declaration
 
 public:
-  VarDeclASTnode(TOKEN Tok, std::string Name, std::string Type)
+  VarDeclASTnode(TOKEN Tok, SymbolId Name, StringRef Type)
       : Name(Name), Type(Type), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override { OS << "Variable Decl: " << Type << " " << Symbols.str(Name); }
+  void printJSON(raw_ostream &OS) const override
   {
-    std::string s = "Variable Decl: " + Type + " " + Name;
-    return s;
-  };
+    ASTEvent(OS, "leaf", "VarDecl", &Tok).attr("name", Symbols.str(Name)).attr("type", Type);
+  }
 
-  const std::string getName() const { return Name; }
+  SymbolId getName() const { return Name; }
 
-  const std::string getType() const { return Type; }
+  StringRef getType() const { return Type; }
 
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
+  Value *declare() override;
 };
 
 // LogErrorP - error handling for parameter nodes
-std::unique_ptr<VarDeclASTnode> LogErrorP(const char *Str)
+std::nullptr_t LogErrorP(const char *Str)
 {
-  fprintf(stderr, "Ln: %d, Col:%d - Syntax Error: %s\n", errorLineNo, errorColumnNo, Str);
-  exit(-1);
+  syntaxError(Str);
   return nullptr;
 }
 
@@ -604,36 +1488,76 @@ class UnaryASTnode : public ASTnode
 {
   TOKEN Tok; // token at the unary expression
   char Op;
-  std::unique_ptr<ASTnode> RHS;
+  ASTnode *RHS;
 
 public:
-  UnaryASTnode(TOKEN tok, char Op, std::unique_ptr<ASTnode> RHS)
-      : Tok(tok), Op(Op), RHS(std::move(RHS)) {}
+  UnaryASTnode(TOKEN tok, char Op, ASTnode *RHS)
+      : Tok(tok), Op(Op), RHS(RHS) {}
 
-  virtual std::string to_string() const override
+  // the operator is printed as its character code
+  void print(raw_ostream &OS) const override
+  {
+    OS << int(Op);
+    RHS->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
   {
-    return std::string(std::to_string(Op) + RHS->to_string());
+    ASTEvent(OS, "begin", "Unary", &Tok).attr("op", StringRef(&Op, 1));
+    RHS->printJSON(OS);
+    ASTEvent(OS, "end", "Unary");
   }
 
+  bool isCheap(unsigned &Budget) const override { return takeCheapNode(Budget) && RHS->isCheap(Budget); }
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override { Kids.push_back(RHS); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
+// BinaryOp - The binary operators, as the parser hands them to the AST
+enum class BinaryOp : uint8_t
+{
+  Add, Sub, Mul, Div, Rem,
+  Lt, Gt, Le, Ge, Eq, Ne,
+  And, Or,
+};
+static const unsigned NumBinaryOps = unsigned(BinaryOp::Or) + 1;
+
+// spelling of each operator, by BinaryOp
+static const char *const BinaryOpSpellings[NumBinaryOps] = {"+", "-", "*", "/", "%", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+
 // BinaryASTnode - Class for binary expressions like + and <
 class BinaryASTnode : public ASTnode
 {
   TOKEN Tok; // token at the operand
-  std::string Op;
-  std::unique_ptr<ASTnode> LHS, RHS;
+  BinaryOp Op;
+  ASTnode *LHS, *RHS;
 
 public:
-  BinaryASTnode(TOKEN tok, std::unique_ptr<ASTnode> LHS, std::unique_ptr<ASTnode> RHS, std::string op)
-      : Tok(tok), LHS(std::move(LHS)), RHS(std::move(RHS)), Op(op) {}
+  BinaryASTnode(TOKEN tok, ASTnode *LHS, ASTnode *RHS, BinaryOp op)
+      : Tok(tok), Op(op), LHS(LHS), RHS(RHS) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    return std::string(LHS->to_string() + " " + Op + " " + RHS->to_string());
-  };
+    LHS->print(OS);
+    OS << " " << BinaryOpSpellings[unsigned(Op)] << " ";
+    RHS->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Binary", &Tok).attr("op", BinaryOpSpellings[unsigned(Op)]);
+    LHS->printJSON(OS);
+    RHS->printJSON(OS);
+    ASTEvent(OS, "end", "Binary");
+  }
 
+  // an integer division may trap
+  bool isCheap(unsigned &Budget) const override
+  {
+    return Op != BinaryOp::Div && Op != BinaryOp::Rem && takeCheapNode(Budget) &&
+           LHS->isCheap(Budget) && RHS->isCheap(Budget);
+  }
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override { Kids.append({LHS, RHS}); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
@@ -641,18 +1565,30 @@ public:
 class FunctionCallASTnode : public ASTnode
 {
   TOKEN Tok;
-  std::string Name;
-  std::vector<std::unique_ptr<ASTnode>> Args;
+  SymbolId Name;
+  ArrayRef<ASTnode *> Args;
 
 public:
-  FunctionCallASTnode(TOKEN tok, std::string Name, std::vector<std::unique_ptr<ASTnode>> Args)
-      : Tok(tok), Name(Name), Args(std::move(Args)) {}
+  FunctionCallASTnode(TOKEN tok, SymbolId Name, ArrayRef<ASTnode *> Args)
+      : Tok(tok), Name(Name), Args(copyToArena(Args)) {}
 
-  virtual std::string to_string() const override
+  // only the first argument is printed
+  void print(raw_ostream &OS) const override
   {
-    return std::string(Name + "(" + Args[0]->to_string() + ")");
-  };
+    OS << Symbols.str(Name) << "(";
+    Args[0]->print(OS);
+    OS << ")";
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Call", &Tok).attr("name", Symbols.str(Name));
+    for (ASTnode *Arg : Args)
+      Arg->printJSON(OS);
+    ASTEvent(OS, "end", "Call");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override { Kids.append(Args.begin(), Args.end()); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
@@ -660,148 +1596,200 @@ public:
 class BlockASTnode : public ASTnode
 {
   int IndentLevel;
-  std::vector<std::unique_ptr<ASTnode>> local_decls;
-  std::vector<std::unique_ptr<ASTnode>> statements;
+  ArrayRef<ASTnode *> local_decls;
+  ArrayRef<ASTnode *> statements;
   TOKEN Tok; // token at the beginning of the block
 
 public:
-  BlockASTnode(TOKEN Tok, std::vector<std::unique_ptr<ASTnode>> local_decls, std::vector<std::unique_ptr<ASTnode>> statements, int indentLevel)
-      : local_decls(std::move(local_decls)), statements(std::move(statements)), IndentLevel(indentLevel), Tok(Tok) {}
+  BlockASTnode(TOKEN Tok, ArrayRef<ASTnode *> local_decls, ArrayRef<ASTnode *> statements, int indentLevel)
+      : IndentLevel(indentLevel), local_decls(copyToArena(local_decls)), statements(copyToArena(statements)), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "";
-    std::string gap = "|    ";
-    std::string indent = "|____";
-
-    for (auto &i : local_decls)
-    {
-      s += "\n";
-      for (int j = 0; j < IndentLevel - 1; j++)
-      {
-        s += gap;
-      }
-      s += indent + i->to_string();
-    }
-    for (auto &i : statements)
-    {
-      if (i != nullptr)
+    for (ArrayRef<ASTnode *> List : {local_decls, statements})
+      for (auto &i : List)
       {
-        s += "\n";
+        if (i == nullptr)
+          continue;
+        OS << "\n";
         for (int j = 0; j < IndentLevel - 1; j++)
-        {
-          s += gap;
-        }
-        s += indent + i->to_string();
+          OS << "|    ";
+        OS << "|____";
+        i->print(OS);
       }
-    }
-    return s;
-  };
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Block", &Tok);
+    for (ArrayRef<ASTnode *> List : {local_decls, statements})
+      for (auto &i : List)
+        if (i != nullptr)
+          i->printJSON(OS);
+    ASTEvent(OS, "end", "Block");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override
+  {
+    for (ArrayRef<ASTnode *> List : {local_decls, statements})
+      for (ASTnode *i : List)
+        if (i != nullptr)
+          Kids.push_back(i);
+  }
+  // dropUnusedDecls - Drop the local declarations of names that nothing in
+  // the function uses (dead code elimination)
+  void dropUnusedDecls(ASTFolder &F);
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // WhileASTnode - Class for while loops
 class WhileASTnode : public ASTnode
 {
-  std::unique_ptr<ASTnode> Condition;
-  std::unique_ptr<ASTnode> Stmt;
+  ASTnode *Condition;
+  ASTnode *Stmt;
   TOKEN Tok; // token at the while keyword
 
 public:
-  WhileASTnode(TOKEN Tok, std::unique_ptr<ASTnode> Condition, std::unique_ptr<ASTnode> Stmt)
-      : Condition(std::move(Condition)), Stmt(std::move(Stmt)), Tok(Tok) {}
+  WhileASTnode(TOKEN Tok, ASTnode *Condition, ASTnode *Stmt)
+      : Condition(Condition), Stmt(Stmt), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "While: " + Condition->to_string() + " " + Stmt->to_string();
-    return s;
-  };
+    OS << "While: ";
+    Condition->print(OS);
+    OS << " ";
+    if (Stmt != nullptr)
+      Stmt->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "While", &Tok);
+    Condition->printJSON(OS);
+    if (Stmt != nullptr)
+      Stmt->printJSON(OS);
+    ASTEvent(OS, "end", "While");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override
+  {
+    Kids.push_back(Condition);
+    if (Stmt != nullptr)
+      Kids.push_back(Stmt);
+  }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // IfASTnode - Class for if statements
 class IfASTnode : public ASTnode
 {
-  std::unique_ptr<ASTnode> IfCondition;
-  std::unique_ptr<ASTnode> IfBlock, ElseBlock;
+  ASTnode *IfCondition;
+  ASTnode *IfBlock, *ElseBlock;
   int IndentLevel;
   TOKEN Tok; // token at the if keyword
 
 public:
-  IfASTnode(TOKEN Tok, std::unique_ptr<ASTnode> IfCondition, std::unique_ptr<ASTnode> IfBlock, std::unique_ptr<ASTnode> ElseBlock, int IndentLevel)
-      : IfCondition(std::move(IfCondition)), IfBlock(std::move(IfBlock)), ElseBlock(std::move(ElseBlock)), IndentLevel(IndentLevel), Tok(Tok) {}
+  IfASTnode(TOKEN Tok, ASTnode *IfCondition, ASTnode *IfBlock, ASTnode *ElseBlock, int IndentLevel)
+      : IfCondition(IfCondition), IfBlock(IfBlock), ElseBlock(ElseBlock), IndentLevel(IndentLevel), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "If: " + IfCondition->to_string() + " " + IfBlock->to_string();
+    OS << "If: ";
+    IfCondition->print(OS);
+    OS << " ";
+    IfBlock->print(OS);
     if (ElseBlock != nullptr)
     {
-      s += "\n";
+      OS << "\n";
       for (int i = 0; i < IndentLevel - 1; i++)
-      {
-        s += "|    ";
-      }
-      s += "|____Else: " + ElseBlock->to_string();
+        OS << "|    ";
+      OS << "|____Else: ";
+      ElseBlock->print(OS);
     }
-    return s;
-  };
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "If", &Tok);
+    IfCondition->printJSON(OS);
+    IfBlock->printJSON(OS);
+    if (ElseBlock != nullptr)
+      ElseBlock->printJSON(OS);
+    ASTEvent(OS, "end", "If");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override
+  {
+    Kids.append({IfCondition, IfBlock});
+    if (ElseBlock != nullptr)
+      Kids.push_back(ElseBlock);
+  }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // AssignASTnode - Class for assignments like x = 1
 class AssignASTnode : public ASTnode
 {
-  std::string Name;
-  std::unique_ptr<ASTnode> RHS;
+  SymbolId Name;
+  ASTnode *RHS;
   TOKEN Tok; // token at the equals sign
 
 public:
-  AssignASTnode(TOKEN Tok, std::string name, std::unique_ptr<ASTnode> RHS)
-      : Name(name), RHS(std::move(RHS)), Tok(Tok) {}
+  AssignASTnode(TOKEN Tok, SymbolId name, ASTnode *RHS)
+      : Name(name), RHS(RHS), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "Assign: " + Name + " = " + RHS->to_string();
-    return s;
-  };
+    OS << "Assign: " << Symbols.str(Name) << " = ";
+    RHS->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Assign", &Tok).attr("name", Symbols.str(Name));
+    RHS->printJSON(OS);
+    ASTEvent(OS, "end", "Assign");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override { Kids.push_back(RHS); }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // PrototypeASTnode - Class for function prototypes
 class PrototypeASTnode
 {
-  std::string Name;
-  std::vector<std::unique_ptr<VarDeclASTnode>> Params;
-  std::string Type_spec;
+  SymbolId Name;
+  ArrayRef<VarDeclASTnode *> Params;
+  StringRef Type_spec;
   TOKEN Tok;
 
 public:
-  PrototypeASTnode(TOKEN Tok, std::string name, std::vector<std::unique_ptr<VarDeclASTnode>> Params, std::string Type_spec)
-      : Name(name), Params(std::move(Params)), Type_spec(Type_spec), Tok(Tok) {}
+  PrototypeASTnode(TOKEN Tok, SymbolId name, ArrayRef<VarDeclASTnode *> Params, StringRef Type_spec)
+      : Name(name), Params(copyToArena(Params)), Type_spec(Type_spec), Tok(Tok) {}
 
-  virtual std::string to_string() const
+  void print(raw_ostream &OS) const
   {
-    std::string s = "Function Declaration: " + Name + "(";
+    OS << "Function Declaration: " << Symbols.str(Name) << "(";
+    ListSeparator Comma;
     for (auto &param : Params)
     {
-      s += param->to_string() + ", ";
+      OS << Comma;
+      param->print(OS);
     }
-    // get rid of the last comma
-    if (Params.size() > 0)
-    {
-      s = s.substr(0, s.size() - 2);
-    }
-    s += ") -> " + Type_spec;
-    return s;
-  };
+    OS << ") -> " << Type_spec;
+  }
 
-  const std::string getName() const { return Name; }
-  const std::vector<std::unique_ptr<VarDeclASTnode>> &getParams() const { return Params; }
-  const std::string getType() const { return Type_spec; }
+  // printJSON - Begin the FunDecl node and write the parameters
+  void printJSON(raw_ostream &OS) const
+  {
+    ASTEvent(OS, "begin", "FunDecl", &Tok).attr("name", Symbols.str(Name)).attr("type", Type_spec);
+    for (auto &param : Params)
+      param->printJSON(OS);
+  }
+
+  SymbolId getName() const { return Name; }
+  const ArrayRef<VarDeclASTnode *> &getParams() const { return Params; }
+  StringRef getType() const { return Type_spec; }
 
   Function *codegen();
 };
@@ -809,959 +1797,1252 @@ public:
 // ExternASTnode - Class for extern declarations
 class ExternASTnode : public ASTnode
 {
-  std::string Type;
-  std::string Name;
-  std::vector<std::unique_ptr<VarDeclASTnode>> Params;
+  StringRef Type;
+  SymbolId Name;
+  ArrayRef<VarDeclASTnode *> Params;
   TOKEN Tok; // Token at the function name
 
 public:
-  ExternASTnode(TOKEN Tok, std::string Type, std::string Name, std::vector<std::unique_ptr<VarDeclASTnode>> Params)
-      : Type(Type), Name(Name), Params(std::move(Params)), Tok(Tok) {}
+  ExternASTnode(TOKEN Tok, StringRef Type, SymbolId Name, ArrayRef<VarDeclASTnode *> Params)
+      : Type(Type), Name(Name), Params(copyToArena(Params)), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  // without parameters, the " (" is cut off along with the name's last character
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "Extern: " + Name + " (";
+    StringRef Str = Symbols.str(Name);
+    if (Params.empty())
+    {
+      OS << "Extern: " << Str.drop_back() << ")";
+      return;
+    }
+    OS << "Extern: " << Str << " (";
+    ListSeparator Comma;
     for (auto &param : Params)
     {
-      s += param->to_string() + ", ";
+      OS << Comma;
+      param->print(OS);
     }
-    s = s.substr(0, s.size() - 2);
-    s += ")";
-    return s;
-  };
+    OS << ")";
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Extern", &Tok).attr("name", Symbols.str(Name)).attr("type", Type);
+    for (auto &param : Params)
+      param->printJSON(OS);
+    ASTEvent(OS, "end", "Extern");
+  }
 
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Function *codegen() override;
+  Value *declare() override;
 };
 
 // FunDeclASTnode - Class for function definitions
 class FunDeclASTnode : public ASTnode
 {
-  std::unique_ptr<PrototypeASTnode> Prototype;
-  std::unique_ptr<ASTnode> Block;
-  TOKEN Tok; // Token at the function name
+  PrototypeASTnode *Prototype;
+  ASTnode *Block;
+  TOKEN Tok;    // Token at the function name
+  TOKEN EndTok; // token at the closing brace
 public:
-  FunDeclASTnode(TOKEN Tok, std::unique_ptr<PrototypeASTnode> Prototype, std::unique_ptr<ASTnode> Block)
-      : Prototype(std::move(Prototype)), Block(std::move(Block)), Tok(Tok) {}
+  FunDeclASTnode(TOKEN Tok, TOKEN EndTok, PrototypeASTnode *Prototype, ASTnode *Block)
+      : Prototype(Prototype), Block(Block), Tok(Tok), EndTok(EndTok) {}
 
-  virtual std::string to_string() const
+  void print(raw_ostream &OS) const override
   {
+    Prototype->print(OS);
     if (Block != nullptr)
-      return std::string(Prototype->to_string() + Block->to_string());
-    else
-      return std::string(Prototype->to_string());
-  };
+      Block->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    Prototype->printJSON(OS);
+    if (Block != nullptr)
+      Block->printJSON(OS);
+    ASTEvent(OS, "end", "FunDecl");
+  }
 
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Function *codegen();
+  Value *declare() override;
+  bool hasBody() const override { return true; }
 
-  const std::string getName() const { return Prototype->getName(); }
+  SymbolId getName() const { return Prototype->getName(); }
 };
 
 // ReturnASTnode - Class for return statements
 class ReturnASTnode : public ASTnode
 {
-  std::unique_ptr<ASTnode> ReturnExpression;
+  ASTnode *ReturnExpression;
   TOKEN Tok; // token at the return keyword
 
 public:
-  ReturnASTnode(TOKEN Tok, std::unique_ptr<ASTnode> ReturnExpression)
-      : ReturnExpression(std::move(ReturnExpression)), Tok(Tok) {}
+  ReturnASTnode(TOKEN Tok, ASTnode *ReturnExpression)
+      : ReturnExpression(ReturnExpression), Tok(Tok) {}
 
-  virtual std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
+    OS << "Return: ";
     if (ReturnExpression != nullptr)
-    {
-      return std::string("Return: " + ReturnExpression->to_string());
-    }
-    else
-    {
-      return std::string("Return: ");
-    }
-  };
+      ReturnExpression->print(OS);
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Return", &Tok);
+    if (ReturnExpression != nullptr)
+      ReturnExpression->printJSON(OS);
+    ASTEvent(OS, "end", "Return");
+  }
 
+  void children(SmallVectorImpl<ASTnode *> &Kids) const override
+  {
+    if (ReturnExpression != nullptr)
+      Kids.push_back(ReturnExpression);
+  }
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 // ProgramASTnode - Root of the AST
 class ProgramASTnode : public ASTnode
 {
-  std::vector<std::unique_ptr<ASTnode>> Extern_list;
-  std::vector<std::unique_ptr<ASTnode>> Decl_list;
+  ArrayRef<ASTnode *> Extern_list;
+  ArrayRef<ASTnode *> Decl_list;
   TOKEN Tok; // token at the start of the program
 public:
-  ProgramASTnode(TOKEN Tok, std::vector<std::unique_ptr<ASTnode>> Extern_list, std::vector<std::unique_ptr<ASTnode>> Decl_list)
-      : Extern_list(std::move(Extern_list)), Decl_list(std::move(Decl_list)), Tok(Tok) {}
+  ProgramASTnode(TOKEN Tok, ArrayRef<ASTnode *> Extern_list, ArrayRef<ASTnode *> Decl_list)
+      : Extern_list(copyToArena(Extern_list)), Decl_list(copyToArena(Decl_list)), Tok(Tok) {}
 
-  std::string to_string() const override
+  void print(raw_ostream &OS) const override
   {
-    std::string s = "Program: ";
-    for (auto &i : Extern_list)
-    {
-      s += "\n|____" + i->to_string() + " ";
-    }
-
-    for (auto &i : Decl_list)
-    {
-      s += "\n|____" + i->to_string() + " ";
-    }
+    OS << "Program: ";
+    for (ArrayRef<ASTnode *> List : {Extern_list, Decl_list})
+      for (auto &i : List)
+      {
+        OS << "\n|____";
+        i->print(OS);
+        OS << " ";
+      }
+    OS << "\n|EOF";
+  }
+  void printJSON(raw_ostream &OS) const override
+  {
+    ASTEvent(OS, "begin", "Program");
+    for (ArrayRef<ASTnode *> List : {Extern_list, Decl_list})
+      for (auto &i : List)
+        i->printJSON(OS);
+    ASTEvent(OS, "end", "Program");
+  }
 
-    s += "\n|EOF";
-    return s;
-  };
+  ArrayRef<ASTnode *> getExterns() const { return Extern_list; }
+  ArrayRef<ASTnode *> getDecls() const { return Decl_list; }
 
+  Folded<ASTnode *> fold(ASTFolder &F) override;
   Value *codegen() override;
 };
 
 //===----------------------------------------------------------------------===//
-// Recursive Descent Parser - Function call for each production
+// Flat AST
 //===----------------------------------------------------------------------===//
-// Note: Parser is written bottom up (ie: the root node is the last to be declared)
-
-// global variable for the indent level for the to_string methods
-int indentLevel = 1;
+// An alternative layout of the whole program as a structure of arrays: node i
+// is Kind[i] plus its operands in Data[i]/Aux[i], addressed by 32-bit index
+// instead of by pointer. Nodes are stored in postorder, the order the parser
+// finishes them in: a node's Count[i] children are the subtrees directly
+// before it, and Start[i] is the first index of its own subtree. First[i] is
+// its first child and Next[c] the child after c, both set as the node is
+// added, so that its children are found without walking the subtrees before
+// it. The root (the program) is the last node. Printing is one pass with a
+// stack of the nodes still open (walk); codegen visits every subtree in
+// increasing index order.
+
+enum class FlatKind : uint8_t
+{
+  Int,     // Data = value
+  Float,   // Data = bits of the value
+  Bool,    // Data = value
+  VarCall, // Data = name
+  VarDecl, // Data = name, Aux = type; also used for parameters
+  Unary,   // Data = operator character
+  Binary,  // Data = BinaryOp
+  Call,    // Data = name; children are the arguments
+  Block,   // Data = number of local decls, Aux = indent level; children are the decls then statements
+  While,   // children are the condition and (if any) the body
+  If,      // Aux = indent level; children are the condition, the block and (if any) the else block
+  Assign,  // Data = name
+  Return,  // children are the expression, if any
+  Extern,  // Data = name, Aux = return type; children are the parameters
+  FunDecl, // Data = name, Aux = return type; children are the parameters then the block
+  Program, // Data = number of externs; children are the externs then the decls
+};
 
-static std::unique_ptr<ASTnode> ParseExpr();
+// type names stored in Aux, by index
+static const char *const FlatTypeNames[] = {"void", "int", "float", "bool"};
 
-// arg_list' ::= expr "," arg_list' | epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseArgListPrime()
+static uint32_t flatTypeIndex(StringRef Type)
 {
-  // FOLLOW(arg_list') = {")"}
-  if (CurTok.type == RBRA)
-  {
-    return std::vector<std::unique_ptr<ASTnode>>(); // empty vector == epsilon
-  }
-  else
-  {
-    std::vector<std::unique_ptr<ASTnode>> arglist;
-    auto Expression = ParseExpr(); // parse the expression
-    while (CurTok.type == COMMA)
-    {
-      getNextToken();                           // eat the ,
-      arglist.push_back(std::move(Expression)); // add the expression to the vector
-      Expression = ParseExpr();                 // parse the next expression
-    }
-    arglist.push_back(std::move(Expression)); // add the last expression to the vector
-    return arglist;
-  }
+  for (uint32_t i = 0; i < array_lengthof(FlatTypeNames); i++)
+    if (Type == FlatTypeNames[i])
+      return i;
+  llvm_unreachable("not a MiniC type");
 }
 
-// arg_list ::= expr "," arg_list'
-static std::vector<std::unique_ptr<ASTnode>> ParseArgList()
+// FlatRef - A node of the flat AST while parsing; null for an absent node.
+struct FlatRef
 {
-  auto Expression = ParseExpr(); // parse the expression
-  if (CurTok.type == COMMA)
-  {
-    getNextToken();                                                   // eat the ,
-    auto ArgListPrime = ParseArgListPrime();                          // parse the arg_list'
-    ArgListPrime.insert(ArgListPrime.begin(), std::move(Expression)); // if there is an arg_list', add the expression to the front of the vector
-    return ArgListPrime;
-  }
-  else
-  { // if there is no arg_list', return a vector with just the expression
-    std::vector<std::unique_ptr<ASTnode>> arglist;
-    arglist.push_back(std::move(Expression));
-    return arglist;
-  }
-}
+  uint32_t Idx = ~0u;
+
+  FlatRef() = default;
+  FlatRef(std::nullptr_t) {}
+  explicit FlatRef(uint32_t Idx) : Idx(Idx) {}
+  explicit operator bool() const { return Idx != ~0u; }
+};
 
-// args ::= arg_list
-// |  epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseArgs()
+// FlatList - A child list of the flat AST while parsing. The children are
+// already laid out in front of where their parent will go, so all the parent
+// needs is how many there are; absent (null) nodes are not counted.
+struct FlatList
 {
-  if (CurTok.type == RBRA)
-  {                                                 // FOLLOW(epsilon) = {")"}
-    return std::vector<std::unique_ptr<ASTnode>>(); // empty vector == epsilon
-  }
-  else
-  {
-    return ParseArgList(); // parse the arg_list
-  }
-}
+  uint32_t Count = 0;
 
-// rval1 ::=  "-" rval1 | "!" rval1
-//       | "(" expr ")"
-//       | IDENT | IDENT "(" args ")"
-//       | INT_LIT | FLOAT_LIT | BOOL_LIT
+  void push_back(FlatRef N) { Count += bool(N); }
+};
+
+class FlatBuilder;
 
-static std::unique_ptr<ASTnode> ParseRval1()
+// FlatProgramASTnode - Root of a program in the flat layout
+class FlatProgramASTnode : public ASTnode
 {
-  std::unique_ptr<ASTnode> Result;
-  switch (CurTok.type)
-  {
-  default:
-    return LogError("Unknown token when expecting an expression");
-  case MINUS:
+  ArrayRef<FlatKind> Kind;
+  ArrayRef<uint32_t> Data;
+  ArrayRef<uint32_t> Aux;
+  ArrayRef<uint32_t> Count;
+  ArrayRef<uint32_t> Start;
+  ArrayRef<uint32_t> First;
+  ArrayRef<uint32_t> Next;
+  ArrayRef<TOKEN> Toks; // only read for error messages and --dump-ast=json
+  ArrayRef<std::pair<uint32_t, TOKEN>> FunEnds; // each function's closing brace, by node
+
+  // ChildIterator - The children of a node, in order
+  class ChildIterator : public iterator_facade_base<ChildIterator, std::forward_iterator_tag, const uint32_t>
+  {
+    const uint32_t *Next;
+    uint32_t Kid, Left;
+
+  public:
+    ChildIterator(const uint32_t *Next, uint32_t Kid, uint32_t Left) : Next(Next), Kid(Kid), Left(Left) {}
+    bool operator==(const ChildIterator &RHS) const { return Left == RHS.Left; }
+    const uint32_t &operator*() const { return Kid; }
+    ChildIterator &operator++()
+    {
+      // the last child's Next is not set
+      if (--Left)
+        Kid = Next[Kid];
+      return *this;
+    }
+  };
+
+  iterator_range<ChildIterator> children(uint32_t I) const
   {
-    TOKEN a = CurTok;
-    getNextToken(); // eat the -
-    return std::make_unique<UnaryASTnode>(a, '-', ParseRval1());
+    return {ChildIterator(Next.data(), First[I], Count[I]), ChildIterator(Next.data(), 0, 0)};
   }
-  case NOT:
+  // child - Node I's K'th child
+  uint32_t child(uint32_t I, uint32_t K) const
   {
-    TOKEN a = CurTok;
-    getNextToken(); // eat the !
-    return std::make_unique<UnaryASTnode>(a, '!', ParseRval1());
+    uint32_t Kid = First[I];
+    while (K--)
+      Kid = Next[Kid];
+    return Kid;
   }
-  case LPAR:
+
+  // OpenNode - A node that walk is in the middle of, with what its visitors
+  // ask of it kept at hand
+  struct OpenNode
   {
-    getNextToken();                // eat the (
-    auto Expression = ParseExpr(); // eat expr
-    if (CurTok.type != RPAR)
-    {
-      return LogError("Expected )"); // FOLLOW(expr) = )
-    }
-    getNextToken(); // eat the )
-    return Expression;
-  }
-  case IDENT:
+    uint32_t Node, Kid, Done, Count; // Kid is the Done'th child, the one in progress
+    FlatKind Kind;
+  };
+
+  StringRef typeOf(uint32_t I) const { return FlatTypeNames[Aux[I]]; }
+  TOKEN endOf(uint32_t I) const
   {
-    std::string identifierStr = IdentifierStr;
-    TOKEN a = CurTok;
-    getNextToken(); // eat the IDENT
-    if (CurTok.type != LPAR)
-    { // if the next token is not a (, then it is a variable
-      return std::make_unique<VarCallASTnode>(a, identifierStr);
-    }
-    else
-    {                          // if the next token is a (, then it is a function call
-      getNextToken();          // eat (
-      auto Args = ParseArgs(); // parse the args - if no args then it will return an empty vector
-      if (CurTok.type != RPAR)
-      { // FOLLOW(args) = )
-        return LogError("Expected )");
-      }
-      getNextToken(); // eat )
-      return std::make_unique<FunctionCallASTnode>(a, identifierStr, std::move(Args));
-    }
-  }
-  case INT_LIT:
-  {
-    Result = std::make_unique<IntASTnode>(CurTok, IntVal);
-    getNextToken(); // eat the number
-    return std::move(Result);
-  }
-  case FLOAT_LIT:
-  {
-    Result = std::make_unique<FloatASTnode>(CurTok, FloatVal);
-    getNextToken(); // eat the number
-    return std::move(Result);
+    return partition_point(FunEnds, [&](const std::pair<uint32_t, TOKEN> &E) { return E.first < I; })->second;
   }
-  case BOOL_LIT:
+  template <typename EnterFn, typename LeaveFn> void walk(EnterFn Enter, LeaveFn Leave) const;
+  bool isCheapNode(uint32_t I, unsigned &Budget) const;
+  Folded<FlatRef> foldNode(uint32_t I, FlatBuilder &B, ASTFolder &F) const;
+  Value *codegenNode(uint32_t I);
+
+public:
+  FlatProgramASTnode(ArrayRef<FlatKind> Kind, ArrayRef<uint32_t> Data, ArrayRef<uint32_t> Aux,
+                     ArrayRef<uint32_t> Count, ArrayRef<uint32_t> Start, ArrayRef<uint32_t> First,
+                     ArrayRef<uint32_t> Next, ArrayRef<TOKEN> Toks, ArrayRef<std::pair<uint32_t, TOKEN>> FunEnds)
+      : Kind(copyToArena(Kind)), Data(copyToArena(Data)), Aux(copyToArena(Aux)), Count(copyToArena(Count)),
+        Start(copyToArena(Start)), First(copyToArena(First)), Next(copyToArena(Next)), Toks(copyToArena(Toks)),
+        FunEnds(copyToArena(FunEnds)) {}
+
+  void print(raw_ostream &OS) const override;
+  void printJSON(raw_ostream &OS) const override;
+
+  Folded<ASTnode *> fold(ASTFolder &F) override;
+  Value *codegen() override;
+};
+
+// walk - Visit the nodes in one pass, each as its subtree starts and ends,
+// keeping a stack of the nodes still open and how far each has got through
+// its children. Enter(N, P) is called as N, the P->Done'th child of P (null
+// for the root), starts, and may return false to skip N's subtree; Leave(N,
+// P) after N's last child. The nodes end in increasing index order, as they
+// are stored.
+template <typename EnterFn, typename LeaveFn> void FlatProgramASTnode::walk(EnterFn Enter, LeaveFn Leave) const
+{
+  SmallVector<OpenNode, 32> Stack;
+  uint32_t N = Kind.size() - 1;
+  for (;;)
   {
-    Result = std::make_unique<BoolASTnode>(CurTok, BoolVal);
-    getNextToken(); // eat the bool
-    return std::move(Result);
-  }
+    const OpenNode *P = Stack.empty() ? nullptr : &Stack.back();
+    bool Entered = Enter(N, P);
+    if (Entered && Count[N])
+    {
+      Stack.push_back({N, First[N], 0, Count[N], Kind[N]});
+      N = First[N];
+      continue;
+    }
+    // leave N, and each open node that N ends the last child of
+    for (;;)
+    {
+      OpenNode *P = Stack.empty() ? nullptr : &Stack.back();
+      if (Entered)
+        Leave(N, P);
+      if (!P)
+        return;
+      Entered = true;
+      if (++P->Done < P->Count)
+      {
+        N = P->Kid = Next[P->Kid];
+        break;
+      }
+      N = P->Node;
+      Stack.pop_back();
+    }
   }
 }
 
-// rval2' ::= "*" rval1 rval2'
-// | "/" rval1 rval2'
-// | "%" rval1 rval2'
-// | epsilon
-static std::unique_ptr<ASTnode> ParseRval2Prime(std::unique_ptr<ASTnode> LHS)
+// The same output as the tree nodes' print()
+void FlatProgramASTnode::print(raw_ostream &OS) const
 {
-  if (CurTok.type == ASTERIX)
-  {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the *
-    std::unique_ptr<ASTnode> RHS = ParseRval1();                                                     // parse rval1
-    return ParseRval2Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "*")); // parse rval2'
-  }
-  else if (CurTok.type == DIV)
-  {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the /
-    std::unique_ptr<ASTnode> RHS = ParseRval1();                                                     // parse rval1
-    return ParseRval2Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "/")); // parse rval2'
-  }
-  else if (CurTok.type == MOD)
-  {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the %
-    std::unique_ptr<ASTnode> RHS = ParseRval1();                                                     // parse rval1
-    return ParseRval2Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "%")); // parse rval2'
-  }
-  else
-  { // Pass the epsilon through
-    return LHS;
-  }
+  // the text before a statement of a block at each indent level
+  SmallVector<std::string, 16> Branches;
+  auto Branch = [&](uint32_t Level) -> StringRef {
+    while (Branches.size() <= Level)
+    {
+      std::string B = "\n";
+      for (uint32_t j = 0; j + 1 < Branches.size(); j++)
+        B += "|    ";
+      Branches.push_back(B + "|____");
+    }
+    return Branches[Level];
+  };
+  auto Enter = [&](uint32_t I, const OpenNode *P) {
+    // what comes between the parent's text and this child's
+    uint32_t K = P ? P->Done : 0;
+    switch (P ? P->Kind : FlatKind::Int)
+    {
+    case FlatKind::Binary:
+      if (K == 1)
+        OS << " " << BinaryOpSpellings[Data[P->Node]] << " ";
+      break;
+    case FlatKind::Call:
+      // only the first argument is printed
+      if (K > 0)
+        return false;
+      break;
+    case FlatKind::Block:
+      OS << Branch(Aux[P->Node]);
+      break;
+    case FlatKind::While:
+      if (K == 1)
+        OS << " ";
+      break;
+    case FlatKind::If:
+      if (K == 1)
+        OS << " ";
+      else if (K == 2)
+        OS << Branch(Aux[P->Node]) << "Else: ";
+      break;
+    case FlatKind::Extern:
+      if (K > 0)
+        OS << ", ";
+      break;
+    case FlatKind::FunDecl:
+      // the parameters, then the block
+      if (K + 1 == P->Count)
+        OS << ") -> " << typeOf(P->Node);
+      else if (K > 0)
+        OS << ", ";
+      break;
+    case FlatKind::Program:
+      OS << "\n|____";
+      break;
+    default:
+      break;
+    }
+
+    switch (Kind[I])
+    {
+    case FlatKind::Int:
+      OS << (int)Data[I];
+      break;
+    case FlatKind::Float:
+      OS << format("%f", BitsToFloat(Data[I]));
+      break;
+    case FlatKind::Bool:
+      OS << (Data[I] ? "1" : "0");
+      break;
+    case FlatKind::VarCall:
+      OS << Symbols.str(Data[I]);
+      break;
+    case FlatKind::VarDecl:
+      OS << "Variable Decl: " << typeOf(I) << " " << Symbols.str(Data[I]);
+      break;
+    case FlatKind::Unary:
+      OS << int((char)Data[I]);
+      break;
+    case FlatKind::Call:
+      OS << Symbols.str(Data[I]) << "(";
+      break;
+    case FlatKind::While:
+      OS << "While: ";
+      break;
+    case FlatKind::If:
+      OS << "If: ";
+      break;
+    case FlatKind::Assign:
+      OS << "Assign: " << Symbols.str(Data[I]) << " = ";
+      break;
+    case FlatKind::Return:
+      OS << "Return: ";
+      break;
+    case FlatKind::Extern:
+      // as ExternASTnode::print
+      if (Count[I] == 0)
+        OS << "Extern: " << Symbols.str(Data[I]).drop_back() << ")";
+      else
+        OS << "Extern: " << Symbols.str(Data[I]) << " (";
+      break;
+    case FlatKind::FunDecl:
+      OS << "Function Declaration: " << Symbols.str(Data[I]) << "(";
+      break;
+    case FlatKind::Program:
+      OS << "Program: ";
+      break;
+    default:
+      break;
+    }
+    return true;
+  };
+  auto Leave = [&](uint32_t I, const OpenNode *P) {
+    switch (Kind[I])
+    {
+    case FlatKind::Call:
+      OS << ")";
+      break;
+    case FlatKind::While:
+      // the space before a missing body
+      if (Count[I] == 1)
+        OS << " ";
+      break;
+    case FlatKind::Extern:
+      if (Count[I] != 0)
+        OS << ")";
+      break;
+    case FlatKind::Program:
+      OS << "\n|EOF";
+      break;
+    default:
+      break;
+    }
+    if (P && P->Kind == FlatKind::Program)
+      OS << " ";
+  };
+  walk(Enter, Leave);
 }
 
-// rval2 ::= rval1 rval2'
-static std::unique_ptr<ASTnode> ParseRval2()
+// The same events as the tree nodes' printJSON()
+void FlatProgramASTnode::printJSON(raw_ostream &OS) const
 {
-  std::unique_ptr<ASTnode> LHS = ParseRval1(); // parse rval1
-  return ParseRval2Prime(std::move(LHS));      // parse rval2'
+  static const char *const KindNames[] = {"Int", "Float", "Bool", "VarCall", "VarDecl", "Unary", "Binary", "Call",
+                                          "Block", "While", "If", "Assign", "Return", "Extern", "FunDecl", "Program"};
+  auto Enter = [&](uint32_t I, const OpenNode *) {
+    const TOKEN *Tok = Kind[I] == FlatKind::Program ? nullptr : &Toks[I];
+    // the kinds up to VarDecl are the leaves
+    ASTEvent E(OS, Kind[I] <= FlatKind::VarDecl ? "leaf" : "begin", KindNames[unsigned(Kind[I])], Tok);
+    switch (Kind[I])
+    {
+    case FlatKind::Int:
+      E.attr("value", (int)Data[I]);
+      break;
+    case FlatKind::Float:
+      E.attr("value", BitsToFloat(Data[I]));
+      break;
+    case FlatKind::Bool:
+      E.attr("value", bool(Data[I]));
+      break;
+    case FlatKind::VarDecl:
+    case FlatKind::Extern:
+    case FlatKind::FunDecl:
+      E.attr("name", Symbols.str(Data[I])).attr("type", typeOf(I));
+      break;
+    case FlatKind::VarCall:
+    case FlatKind::Call:
+    case FlatKind::Assign:
+      E.attr("name", Symbols.str(Data[I]));
+      break;
+    case FlatKind::Unary:
+    {
+      char Op = Data[I];
+      E.attr("op", StringRef(&Op, 1));
+      break;
+    }
+    case FlatKind::Binary:
+      E.attr("op", BinaryOpSpellings[Data[I]]);
+      break;
+    default:
+      break;
+    }
+    return true;
+  };
+  auto Leave = [&](uint32_t I, const OpenNode *) {
+    if (Kind[I] > FlatKind::VarDecl)
+      ASTEvent(OS, "end", KindNames[unsigned(Kind[I])]);
+  };
+  walk(Enter, Leave);
 }
 
-// rval3' ::= "+" rval2 rval3'
-// | "-" rval2 rval3'
-// | epsilon
-static std::unique_ptr<ASTnode> ParseRval3Prime(std::unique_ptr<ASTnode> LHS)
+// As the tree nodes' isCheap()
+bool FlatProgramASTnode::isCheapNode(uint32_t I, unsigned &Budget) const
 {
-  if (CurTok.type == PLUS)
-  {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the +
-    std::unique_ptr<ASTnode> RHS = ParseRval2();                                                     // parse rval2
-    return ParseRval3Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "+")); // parse rval3'
-  }
-  else if (CurTok.type == MINUS)
-  {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the -
-    std::unique_ptr<ASTnode> RHS = ParseRval2();                                                     // parse rval2
-    return ParseRval3Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "-")); // parse rval3'
+  switch (Kind[I])
+  {
+  case FlatKind::Int:
+  case FlatKind::Float:
+  case FlatKind::Bool:
+  case FlatKind::VarCall:
+    return takeCheapNode(Budget);
+  case FlatKind::Unary:
+  case FlatKind::Binary:
+  {
+    if (Kind[I] == FlatKind::Binary && (BinaryOp(Data[I]) == BinaryOp::Div || BinaryOp(Data[I]) == BinaryOp::Rem))
+      return false;
+    if (!takeCheapNode(Budget))
+      return false;
+    for (uint32_t Kid : children(I))
+      if (!isCheapNode(Kid, Budget))
+        return false;
+    return true;
   }
-  else
-  {
-    return LHS; // Pass the epsilon through
+  default:
+    return false;
   }
 }
 
-//  rval3 ::= rval2 rval3'
-static std::unique_ptr<ASTnode> ParseRval3()
+// FlatBuilder - Parser builder that appends nodes to the flat AST
+class FlatBuilder
 {
-  std::unique_ptr<ASTnode> LHS = ParseRval2(); // parse rval2
-  return ParseRval3Prime(std::move(LHS));      // parse rval3'
-}
+  std::vector<FlatKind> Kind;
+  std::vector<uint32_t> Data, Aux, Count, Start, First, Next;
+  std::vector<TOKEN> Toks;
+  std::vector<std::pair<uint32_t, TOKEN>> FunEnds;
+
+  void resize(uint32_t Size)
+  {
+    while (!FunEnds.empty() && FunEnds.back().first >= Size)
+      FunEnds.pop_back();
+    Kind.resize(Size);
+    Data.resize(Size);
+    Aux.resize(Size);
+    Count.resize(Size);
+    Start.resize(Size);
+    First.resize(Size);
+    Next.resize(Size);
+    Toks.resize(Size);
+  }
+
+  FlatRef add(FlatKind K, TOKEN Tok, uint32_t D, uint32_t A, uint32_t NumChildren)
+  {
+    uint32_t I = Kind.size();
+    // the children are the NumChildren subtrees right before I; link them
+    // up from the last
+    uint32_t Begin = I, Kid = 0;
+    for (uint32_t k = 0; k < NumChildren; k++)
+    {
+      Next[Begin - 1] = Kid;
+      Kid = Begin - 1;
+      Begin = Start[Kid];
+    }
+    Kind.push_back(K);
+    Data.push_back(D);
+    Aux.push_back(A);
+    Count.push_back(NumChildren);
+    Start.push_back(Begin);
+    First.push_back(Kid);
+    Next.push_back(0);
+    Toks.push_back(Tok);
+    NumASTNodes++;
+    return FlatRef(I);
+  }
 
-// rval4' ::= "<=" rval3 rval4'
-// | "<" rval3 rval4'
-// | ">=" rval3 rval4'
-// | ">" rval3 rval4'
-static std::unique_ptr<ASTnode> ParseRval4Prime(std::unique_ptr<ASTnode> LHS)
-{
-  if (CurTok.type == LE)
+public:
+  // reserve for about one node per 8 bytes of source (11-12 on typical code)
+  FlatBuilder()
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the <=
-    std::unique_ptr<ASTnode> RHS = ParseRval3();                                                      // parse rval3
-    return ParseRval4Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "<=")); // parse rval4'
+    size_t Guess = SourceBuf ? SourceBuf->getBufferSize() / 8 : 0;
+    Kind.reserve(Guess);
+    Data.reserve(Guess);
+    Aux.reserve(Guess);
+    Count.reserve(Guess);
+    Start.reserve(Guess);
+    First.reserve(Guess);
+    Next.reserve(Guess);
+    Toks.reserve(Guess);
   }
-  else if (CurTok.type == LT)
+
+  typedef FlatRef Node;
+  typedef FlatRef ParamNode;
+  typedef FlatList List;
+  typedef FlatList ParamList;
+
+  // Children are counted as they are parsed, so the order of a list does
+  // not matter here.
+  void prepend(FlatList &L, FlatRef N) { L.push_back(N); }
+
+  FlatRef makeInt(TOKEN Tok, int Val) { return add(FlatKind::Int, Tok, Val, 0, 0); }
+  FlatRef makeFloat(TOKEN Tok, float Val) { return add(FlatKind::Float, Tok, FloatToBits(Val), 0, 0); }
+  FlatRef makeBool(TOKEN Tok, bool Val) { return add(FlatKind::Bool, Tok, Val, 0, 0); }
+  FlatRef makeVarCall(TOKEN Tok, SymbolId Name) { return add(FlatKind::VarCall, Tok, Name, 0, 0); }
+  FlatRef makeVarDecl(TOKEN Tok, SymbolId Name, StringRef Type) { return add(FlatKind::VarDecl, Tok, Name, flatTypeIndex(Type), 0); }
+  FlatRef makeParam(TOKEN Tok, SymbolId Name, StringRef Type) { return makeVarDecl(Tok, Name, Type); }
+  FlatRef makeUnary(TOKEN Tok, char Op, FlatRef) { return add(FlatKind::Unary, Tok, Op, 0, 1); }
+  FlatRef makeBinary(TOKEN Tok, FlatRef, FlatRef, BinaryOp Op) { return add(FlatKind::Binary, Tok, uint32_t(Op), 0, 2); }
+  FlatRef makeCall(TOKEN Tok, SymbolId Name, const FlatList &Args) { return add(FlatKind::Call, Tok, Name, 0, Args.Count); }
+  FlatRef makeAssign(TOKEN Tok, SymbolId Name, FlatRef) { return add(FlatKind::Assign, Tok, Name, 0, 1); }
+  FlatRef makeReturn(TOKEN Tok, FlatRef Expr) { return add(FlatKind::Return, Tok, 0, 0, bool(Expr)); }
+  FlatRef makeWhile(TOKEN Tok, FlatRef, FlatRef Stmt) { return add(FlatKind::While, Tok, 0, 0, 1 + bool(Stmt)); }
+
+  FlatRef makeIf(TOKEN Tok, FlatRef, FlatRef, FlatRef Else, int IndentLevel)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the <
-    std::unique_ptr<ASTnode> RHS = ParseRval3();                                                     // parse rval3
-    return ParseRval4Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "<")); // parse rval4'
+    return add(FlatKind::If, Tok, 0, IndentLevel, 2 + bool(Else));
   }
-  else if (CurTok.type == GE)
+
+  FlatRef makeBlock(TOKEN Tok, const FlatList &Decls, const FlatList &Stmts, int IndentLevel)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the >=
-    std::unique_ptr<ASTnode> RHS = ParseRval3();                                                      // parse rval3
-    return ParseRval4Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), ">=")); // parse rval4'
+    return add(FlatKind::Block, Tok, Decls.Count, IndentLevel, Decls.Count + Stmts.Count);
   }
-  else if (CurTok.type == GT)
+
+  FlatRef makeExtern(TOKEN Tok, StringRef Type, SymbolId Name, const FlatList &Params)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                  // eat the >
-    std::unique_ptr<ASTnode> RHS = ParseRval3();                                                     // parse rval3
-    return ParseRval4Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), ">")); // parse rval4'
+    return add(FlatKind::Extern, Tok, Name, flatTypeIndex(Type), Params.Count);
   }
-  else
+
+  FlatRef makeFunDecl(TOKEN Tok, TOKEN EndTok, SymbolId Name, const FlatList &Params, StringRef Type, FlatRef)
   {
-    return LHS;
+    FlatRef N = add(FlatKind::FunDecl, Tok, Name, flatTypeIndex(Type), Params.Count + 1);
+    FunEnds.push_back({N.Idx, EndTok});
+    return N;
   }
-}
 
-// rval4 ::= rval3 rval4'
-static std::unique_ptr<ASTnode> ParseRval4()
-{
-  std::unique_ptr<ASTnode> LHS = ParseRval3(); // parse rval3
-  return ParseRval4Prime(std::move(LHS));      // parse rval4'
-}
+  FlatRef makeProgram(TOKEN Tok, const FlatList &Externs, const FlatList &Decls)
+  {
+    return add(FlatKind::Program, Tok, Externs.Count, 0, Externs.Count + Decls.Count);
+  }
 
-// rval5' ::= "==" rval4 rval5'
-// | "!=" rval4 rval5'
-// | epsilon
-static std::unique_ptr<ASTnode> ParseRval5Prime(std::unique_ptr<ASTnode> LHS)
-{
-  if (CurTok.type == EQ)
+  // For the folding pass, which builds the folded program bottom up and
+  // takes back what it has just built of a subtree that folds away:
+  // truncate - Drop the subtree of N and all after it
+  void truncate(FlatRef N) { resize(Start[N.Idx]); }
+  // keepUpTo - Drop all after N
+  void keepUpTo(FlatRef N) { resize(N.Idx + 1); }
+  // keepOnly - Drop the subtrees from that of From up to Kept, the last one
+  // built, and move Kept into their place; this copies Kept, which is why
+  // dead code elimination only does it for the few statements that hang off
+  // a literal if condition
+  FlatRef keepOnly(FlatRef From, FlatRef Kept)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the ==
-    std::unique_ptr<ASTnode> RHS = ParseRval4();                                                      // parse rval4
-    return ParseRval5Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "==")); // parse rval5'
+    uint32_t To = Start[From.Idx], Gap = Start[Kept.Idx] - To;
+    for (uint32_t i = Start[Kept.Idx]; i < Kind.size(); i++, To++)
+    {
+      Kind[To] = Kind[i];
+      Data[To] = Data[i];
+      Aux[To] = Aux[i];
+      Count[To] = Count[i];
+      Start[To] = Start[i] - Gap;
+      // Kept's own Next is set when its parent is added
+      First[To] = Count[i] ? First[i] - Gap : 0;
+      Next[To] = i < Kept.Idx ? Next[i] - Gap : 0;
+      Toks[To] = Toks[i];
+    }
+    resize(To);
+    return FlatRef(Kept.Idx - Gap);
   }
-  else if (CurTok.type == NE)
+  // size - The number of nodes in the subtree of N
+  uint32_t size(FlatRef N) const { return N.Idx + 1 - Start[N.Idx]; }
+  // isPure - Whether the expression N calls nothing, assigns nothing and
+  // does not divide, so that nothing comes of evaluating it but its value
+  bool isPure(FlatRef N) const
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the !=
-    std::unique_ptr<ASTnode> RHS = ParseRval4();                                                      // parse rval4
-    return ParseRval5Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "!=")); // parse rval5'
+    for (uint32_t i = Start[N.Idx]; i <= N.Idx; i++)
+      if (Kind[i] == FlatKind::Call || Kind[i] == FlatKind::Assign ||
+          (Kind[i] == FlatKind::Binary && (BinaryOp(Data[i]) == BinaryOp::Div || BinaryOp(Data[i]) == BinaryOp::Rem)))
+        return false;
+    return true;
   }
-  else
-  { // Pass the epsilon through
-    return LHS;
+
+  // finish - Move the parsed program into the AST arena
+  ASTnode *finish()
+  {
+    return newNode<FlatProgramASTnode>(Kind, Data, Aux, Count, Start, First, Next, Toks, FunEnds);
   }
-}
+};
 
-// rval5 ::= rval4 rval5'
-static std::unique_ptr<ASTnode> ParseRval5()
+// TreeBuilder - Parser builder that allocates the AST node classes
+class TreeBuilder
 {
-  std::unique_ptr<ASTnode> LHS = ParseRval4(); // parse rval4
-  return ParseRval5Prime(std::move(LHS));      // parse rval5'
-}
+public:
+  typedef ASTnode *Node;
+  typedef VarDeclASTnode *ParamNode;
+  typedef ::NodeList List;
+  typedef ::ParamList ParamList;
+
+  void prepend(List &L, Node N) { L.insert(L.begin(), N); }
+  void prepend(ParamList &L, ParamNode N) { L.insert(L.begin(), N); }
+  // as FlatBuilder's; a folded-away node is just left unused here
+  void truncate(Node) {}
+  void keepUpTo(Node) {}
+  Node keepOnly(Node, Node Kept) { return Kept; }
+
+  static uint32_t size(Node N)
+  {
+    uint32_t Size = 0;
+    SmallVector<ASTnode *, 16> Work = {N};
+    while (!Work.empty())
+    {
+      Size++;
+      Work.pop_back_val()->children(Work);
+    }
+    return Size;
+  }
 
-// rval6' ::= "&&" rval5 rval6'
-// | epsilon
-static std::unique_ptr<ASTnode> ParseRval6Prime(std::unique_ptr<ASTnode> LHS)
-{
-  if (CurTok.type == AND)
+  static bool isPure(Node N)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the &&
-    std::unique_ptr<ASTnode> RHS = ParseRval5();                                                      // parse rval5
-    return ParseRval6Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "&&")); // parse rval6'
+    unsigned Budget = ~0u;
+    return N->isCheap(Budget);
   }
-  else
-  { // Pass the epsilon through
-    return LHS;
-  }
-}
 
-// rval6 ::= rval5 rval6'
-static std::unique_ptr<ASTnode> ParseRval6()
-{
-  std::unique_ptr<ASTnode> LHS = ParseRval5(); // parse rval5
-  return ParseRval6Prime(std::move(LHS));      // parse rval6'
-}
+  Node makeInt(TOKEN Tok, int Val) { return newNode<IntASTnode>(Tok, Val); }
+  Node makeFloat(TOKEN Tok, float Val) { return newNode<FloatASTnode>(Tok, Val); }
+  Node makeBool(TOKEN Tok, bool Val) { return newNode<BoolASTnode>(Tok, Val); }
+  Node makeVarCall(TOKEN Tok, SymbolId Name) { return newNode<VarCallASTnode>(Tok, Name); }
+  Node makeVarDecl(TOKEN Tok, SymbolId Name, StringRef Type) { return newNode<VarDeclASTnode>(Tok, Name, Type); }
+  ParamNode makeParam(TOKEN Tok, SymbolId Name, StringRef Type) { return newNode<VarDeclASTnode>(Tok, Name, Type); }
+  Node makeUnary(TOKEN Tok, char Op, Node RHS) { return newNode<UnaryASTnode>(Tok, Op, RHS); }
+  Node makeBinary(TOKEN Tok, Node LHS, Node RHS, BinaryOp Op) { return newNode<BinaryASTnode>(Tok, LHS, RHS, Op); }
+  Node makeCall(TOKEN Tok, SymbolId Name, const List &Args) { return newNode<FunctionCallASTnode>(Tok, Name, Args); }
+  Node makeAssign(TOKEN Tok, SymbolId Name, Node RHS) { return newNode<AssignASTnode>(Tok, Name, RHS); }
+  Node makeReturn(TOKEN Tok, Node Expr) { return newNode<ReturnASTnode>(Tok, Expr); }
+  Node makeWhile(TOKEN Tok, Node Cond, Node Stmt) { return newNode<WhileASTnode>(Tok, Cond, Stmt); }
 
-// rval7' ::= "||" rval6 rval7'
-// | epsilon
-static std::unique_ptr<ASTnode> ParseRval7Prime(std::unique_ptr<ASTnode> LHS)
-{
-  if (CurTok.type == OR)
+  Node makeIf(TOKEN Tok, Node Cond, Node Then, Node Else, int IndentLevel)
   {
-    TOKEN a = CurTok;
-    getNextToken();                                                                                   // eat the ||
-    std::unique_ptr<ASTnode> RHS = ParseRval6();                                                      // parse rval6
-    return ParseRval7Prime(std::make_unique<BinaryASTnode>(a, std::move(LHS), std::move(RHS), "||")); // parse rval7'
+    return newNode<IfASTnode>(Tok, Cond, Then, Else, IndentLevel);
   }
-  else
-  { // Pass the epsilon through
-    return LHS;
+
+  Node makeBlock(TOKEN Tok, const List &Decls, const List &Stmts, int IndentLevel)
+  {
+    return newNode<BlockASTnode>(Tok, Decls, Stmts, IndentLevel);
   }
-}
 
-// rval7 ::= rval6 rval7'
-static std::unique_ptr<ASTnode> ParseRval7()
-{
-  std::unique_ptr<ASTnode> LHS = ParseRval6(); // parse rval6
-  return ParseRval7Prime(std::move(LHS));      // parse rval7'
-}
+  Node makeExtern(TOKEN Tok, StringRef Type, SymbolId Name, const ParamList &Params)
+  {
+    return newNode<ExternASTnode>(Tok, Type, Name, Params);
+  }
 
-// expr ::= IDENT "=" expr
-// | rval7
-static std::unique_ptr<ASTnode> ParseExpr()
-{
-  if (CurTok.type == IDENT)
-  { // could be an rval or an assignment - FIRST(rval7) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","("}
-    if (lookahead1().type == ASSIGN)
-    {
-      std::string Name = IdentifierStr;
-      getNextToken(); // eat the IDENT
-      TOKEN a = CurTok;
-      getNextToken();                                                   // eat the =
-      std::unique_ptr<ASTnode> expr = ParseExpr();                      // parse expr
-      return std::make_unique<AssignASTnode>(a, Name, std::move(expr)); // return the assignment
-    }
-    else
-    {
-      return ParseRval7(); // parse rval7
-    }
+  Node makeFunDecl(TOKEN Tok, TOKEN EndTok, SymbolId Name, const ParamList &Params, StringRef Type, Node Block)
+  {
+    PrototypeASTnode *Proto = newNode<PrototypeASTnode>(Tok, Name, Params, Type);
+    return newNode<FunDeclASTnode>(Tok, EndTok, Proto, Block);
   }
-  else
+
+  Node makeProgram(TOKEN Tok, const List &Externs, const List &Decls)
   {
-    return ParseRval7(); // parse rval7
+    return newNode<ProgramASTnode>(Tok, Externs, Decls);
   }
-}
+};
+
+//===----------------------------------------------------------------------===//
+// Recursive Descent Parser - Function call for each production
+//===----------------------------------------------------------------------===//
+// Note: Parser is written bottom up (ie: the root node is the last to be declared)
 
-// return_stmt ::= "return" ";"
-// |  "return" expr ";"
-static std::unique_ptr<ASTnode> ParseReturnStmt()
+// global variable for the indent level for the print methods
+static thread_local int indentLevel = 1;
+
+// Parser - The recursive descent parser, generic over the AST it builds:
+// Builder::make* create the node for each production (TreeBuilder allocates
+// the node classes above, FlatBuilder appends to the flat AST), and
+// Node/ParamNode/List/ParamList are the builder's handle and list types.
+template <typename Builder>
+class Parser
 {
-  if (CurTok.type == RETURN)
+public:
+  typedef typename Builder::Node Node;
+  typedef typename Builder::ParamNode ParamNode;
+  typedef typename Builder::List List;
+  typedef typename Builder::ParamList ParamList;
+
+  Builder Build;
+  TOKEN BlockEnd; // the closing brace of the block parsed last
+
+  // If set, called with every extern, global variable and function as soon
+  // as it has been parsed, in source order (--pipeline, --stream).
+  std::function<void(Node)> OnTopLevelDecl;
+
+  Node topLevel(Node Decl)
   {
-    TOKEN a = CurTok;
-    getNextToken(); // eat the return
-    if (CurTok.type == SC)
+    if (OnTopLevelDecl)
+      OnTopLevelDecl(Decl);
+    return Decl;
+  }
+
+  // arg_list' ::= expr "," arg_list' | epsilon
+  List ParseArgListPrime()
+  {
+    // FOLLOW(arg_list') = {")"}
+    if (CurTok.type == RBRA)
     {
-      getNextToken();                                     // eat the ;
-      return std::make_unique<ReturnASTnode>(a, nullptr); // void return
+      return List(); // empty vector == epsilon
     }
     else
     {
-      std::unique_ptr<ASTnode> expr = ParseExpr(); // parse expr
-      if (CurTok.type == SC)
-      {
-        getNextToken();                                             // eat the ;
-        return std::make_unique<ReturnASTnode>(a, std::move(expr)); // return with expr
-      }
-      else
+      List arglist;
+      auto Expression = ParseExpr(); // parse the expression
+      while (CurTok.type == COMMA)
       {
-        return LogError("Expected ;");
+        getNextToken();                           // eat the ,
+        arglist.push_back(Expression); // add the expression to the vector
+        Expression = ParseExpr();                 // parse the next expression
       }
+      arglist.push_back(Expression); // add the last expression to the vector
+      return arglist;
     }
   }
-  else
-  {
-    return LogError("Expected return statement");
-  }
-}
-
-static std::unique_ptr<ASTnode> ParseBlock();
 
-static std::unique_ptr<ASTnode> ParseStmt();
-
-// else_stmt  ::= "else" block
-// |  epsilon
-static std::unique_ptr<ASTnode> ParseElseStmt()
-{
-  if (CurTok.type == ELSE)
+  // arg_list ::= expr "," arg_list'
+  List ParseArgList()
   {
-    getNextToken();      // eat the else
-    return ParseBlock(); // parse block
-  }
-  // FIRST(block) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",LBRA,IF,WHILE,ELSE,RETURN,RBRA}
-  if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN || CurTok.type == RBRA)
-  {
-    return nullptr; // epsilon transition == nullptr
+    auto Expression = ParseExpr(); // parse the expression
+    if (CurTok.type == COMMA)
+    {
+      getNextToken();                                                   // eat the ,
+      auto ArgListPrime = ParseArgListPrime();                          // parse the arg_list'
+      Build.prepend(ArgListPrime, Expression); // if there is an arg_list', add the expression to the front of the vector
+      return ArgListPrime;
+    }
+    else
+    { // if there is no arg_list', return a vector with just the expression
+      List arglist;
+      arglist.push_back(Expression);
+      return arglist;
+    }
   }
-  else
+
+  // args ::= arg_list
+  // |  epsilon
+  List ParseArgs()
   {
-    return LogError("Expected 'else' statement or another statement");
+    if (CurTok.type == RBRA)
+    {                                                 // FOLLOW(epsilon) = {")"}
+      return List(); // empty vector == epsilon
+    }
+    else
+    {
+      return ParseArgList(); // parse the arg_list
+    }
   }
-}
 
-// if_stmt ::= "if" "(" expr ")" block else_stmt
-static std::unique_ptr<ASTnode> ParseIfStmt()
-{
-  if (CurTok.type == IF)
+  // rval1 ::=  "-" rval1 | "!" rval1
+  //       | "(" expr ")"
+  //       | IDENT | IDENT "(" args ")"
+  //       | INT_LIT | FLOAT_LIT | BOOL_LIT
+
+  Node ParseRval1()
   {
-    TOKEN a = CurTok;
-    getNextToken(); // eat the if
-    if (CurTok.type == LPAR)
+    Node Result;
+    switch (CurTok.type)
+    {
+    default:
+      return LogError("Unknown token when expecting an expression");
+    case MINUS:
     {
-      getNextToken();                                     // eat the (
-      std::unique_ptr<ASTnode> ifCondition = ParseExpr(); // parse expr
-      if (CurTok.type == RPAR)
+      TOKEN a = CurTok;
+      getNextToken(); // eat the -
+      return Build.makeUnary(a, '-', ParseRval1());
+    }
+    case NOT:
+    {
+      TOKEN a = CurTok;
+      getNextToken(); // eat the !
+      return Build.makeUnary(a, '!', ParseRval1());
+    }
+    case LPAR:
+    {
+      getNextToken();                // eat the (
+      auto Expression = ParseExpr(); // eat expr
+      if (CurTok.type != RPAR)
       {
-        getNextToken(); // eat the )
-        indentLevel++;
-        std::unique_ptr<ASTnode> ifBlock = ParseBlock();      // parse block
-        std::unique_ptr<ASTnode> elseBlock = ParseElseStmt(); // parse else_stmt
-        std::unique_ptr<ASTnode> ifast = std::make_unique<IfASTnode>(a, std::move(ifCondition), std::move(ifBlock), std::move(elseBlock), indentLevel);
-        indentLevel--;
-        return ifast;
+        return LogError("Expected )"); // FOLLOW(expr) = )
+      }
+      getNextToken(); // eat the )
+      return Expression;
+    }
+    case IDENT:
+    {
+      SymbolId identifierStr = CurTok.sym;
+      TOKEN a = CurTok;
+      getNextToken(); // eat the IDENT
+      if (CurTok.type != LPAR)
+      { // if the next token is not a (, then it is a variable
+        return Build.makeVarCall(a, identifierStr);
       }
       else
-      {
-        return LogError("Expected )");
+      {                          // if the next token is a (, then it is a function call
+        getNextToken();          // eat (
+        auto Args = ParseArgs(); // parse the args - if no args then it will return an empty vector
+        if (CurTok.type != RPAR)
+        { // FOLLOW(args) = )
+          return LogError("Expected )");
+        }
+        getNextToken(); // eat )
+        return Build.makeCall(a, identifierStr, Args);
       }
     }
-    else
+    case INT_LIT:
+    {
+      Result = Build.makeInt(CurTok, lexemeToInt(Symbols.str(CurTok.sym)));
+      getNextToken(); // eat the number
+      return Result;
+    }
+    case FLOAT_LIT:
     {
-      return LogError("Expected (");
+      Result = Build.makeFloat(CurTok, lexemeToFloat(Symbols.str(CurTok.sym)));
+      getNextToken(); // eat the number
+      return Result;
+    }
+    case BOOL_LIT:
+    {
+      Result = Build.makeBool(CurTok, Symbols.str(CurTok.sym) == "true");
+      getNextToken(); // eat the bool
+      return Result;
+    }
     }
   }
-  else
+
+  // rval2' ::= "*" rval1 rval2'
+  // | "/" rval1 rval2'
+  // | "%" rval1 rval2'
+  // | epsilon
+  Node ParseRval2Prime(Node LHS)
   {
-    return LogError("Expected 'if' keyword");
+    if (CurTok.type == ASTERIX)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the *
+      Node RHS = ParseRval1();                                                     // parse rval1
+      return ParseRval2Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Mul)); // parse rval2'
+    }
+    else if (CurTok.type == DIV)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the /
+      Node RHS = ParseRval1();                                                     // parse rval1
+      return ParseRval2Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Div)); // parse rval2'
+    }
+    else if (CurTok.type == MOD)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the %
+      Node RHS = ParseRval1();                                                     // parse rval1
+      return ParseRval2Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Rem)); // parse rval2'
+    }
+    else
+    { // Pass the epsilon through
+      return LHS;
+    }
   }
-}
 
-// expr_stmt ::= expr ";"
-// |  ";"
+  // rval2 ::= rval1 rval2'
+  Node ParseRval2()
+  {
+    Node LHS = ParseRval1(); // parse rval1
+    return ParseRval2Prime(LHS);      // parse rval2'
+  }
 
-static std::unique_ptr<ASTnode> ParseExprStmt()
-{
-  // FIRST(expr) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","("}
-  if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR)
+  // rval3' ::= "+" rval2 rval3'
+  // | "-" rval2 rval3'
+  // | epsilon
+  Node ParseRval3Prime(Node LHS)
   {
-    std::unique_ptr<ASTnode> expr = ParseExpr(); // parse expr
-    if (CurTok.type == SC)
+    if (CurTok.type == PLUS)
     {
-      getNextToken(); // eat the ;
-      return expr;
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the +
+      Node RHS = ParseRval2();                                                     // parse rval2
+      return ParseRval3Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Add)); // parse rval3'
+    }
+    else if (CurTok.type == MINUS)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the -
+      Node RHS = ParseRval2();                                                     // parse rval2
+      return ParseRval3Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Sub)); // parse rval3'
     }
     else
     {
-      return LogError("Expected ;");
+      return LHS; // Pass the epsilon through
     }
   }
-  else if (CurTok.type == SC)
-  {
-    getNextToken(); // eat the ;
-    return nullptr; // epsilon transition == nullptr
-  }
-  else
+
+  //  rval3 ::= rval2 rval3'
+  Node ParseRval3()
   {
-    return LogError("Expected expression statement or ;");
+    Node LHS = ParseRval2(); // parse rval2
+    return ParseRval3Prime(LHS);      // parse rval3'
   }
-}
 
-// while_stmt ::= "while" "(" expr ")" stmt
-static std::unique_ptr<ASTnode> ParseWhileStmt()
-{
-  if (CurTok.type == WHILE)
+  // rval4' ::= "<=" rval3 rval4'
+  // | "<" rval3 rval4'
+  // | ">=" rval3 rval4'
+  // | ">" rval3 rval4'
+  Node ParseRval4Prime(Node LHS)
   {
-    TOKEN a = CurTok;
-    getNextToken(); // eat the while
-    if (CurTok.type == LPAR)
+    if (CurTok.type == LE)
     {
-      getNextToken();                              // eat the (
-      std::unique_ptr<ASTnode> expr = ParseExpr(); // parse expr
-      if (CurTok.type == RPAR)
-      {
-        getNextToken(); // eat the )
-        indentLevel = indentLevel + 2;
-        std::unique_ptr<ASTnode> stmt = ParseStmt(); // parse stmt
-        indentLevel = indentLevel - 1;
-        std::unique_ptr<WhileASTnode> w = std::make_unique<WhileASTnode>(a, std::move(expr), std::move(stmt));
-        indentLevel = indentLevel - 1;
-        return w;
-      }
-      else
-      {
-        return LogError("Expected )");
-      }
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the <=
+      Node RHS = ParseRval3();                                                      // parse rval3
+      return ParseRval4Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Le)); // parse rval4'
+    }
+    else if (CurTok.type == LT)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the <
+      Node RHS = ParseRval3();                                                     // parse rval3
+      return ParseRval4Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Lt)); // parse rval4'
+    }
+    else if (CurTok.type == GE)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the >=
+      Node RHS = ParseRval3();                                                      // parse rval3
+      return ParseRval4Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Ge)); // parse rval4'
+    }
+    else if (CurTok.type == GT)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                  // eat the >
+      Node RHS = ParseRval3();                                                     // parse rval3
+      return ParseRval4Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Gt)); // parse rval4'
     }
     else
     {
-      return LogError("Expected (");
+      return LHS;
     }
   }
-  else
+
+  // rval4 ::= rval3 rval4'
+  Node ParseRval4()
   {
-    return LogError("Expected 'while' keyword");
+    Node LHS = ParseRval3(); // parse rval3
+    return ParseRval4Prime(LHS);      // parse rval4'
   }
-}
 
-// stmt ::= expr_stmt
-// |  block
-// |  if_stmt
-// |  while_stmt
-// |  return_stmt
-static std::unique_ptr<ASTnode> ParseStmt()
-{
-  // FIRST(expr_stmt) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",";"}
-  if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == SC)
+  // rval5' ::= "==" rval4 rval5'
+  // | "!=" rval4 rval5'
+  // | epsilon
+  Node ParseRval5Prime(Node LHS)
   {
-    return ParseExprStmt();
+    if (CurTok.type == EQ)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the ==
+      Node RHS = ParseRval4();                                                      // parse rval4
+      return ParseRval5Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Eq)); // parse rval5'
+    }
+    else if (CurTok.type == NE)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the !=
+      Node RHS = ParseRval4();                                                      // parse rval4
+      return ParseRval5Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Ne)); // parse rval5'
+    }
+    else
+    { // Pass the epsilon through
+      return LHS;
+    }
   }
-  // FIRST(block)={"{"}
-  else if (CurTok.type == LBRA)
+
+  // rval5 ::= rval4 rval5'
+  Node ParseRval5()
   {
-    return ParseBlock();
+    Node LHS = ParseRval4(); // parse rval4
+    return ParseRval5Prime(LHS);      // parse rval5'
   }
-  // FIRST(if_stmt)={"if"}
-  else if (CurTok.type == IF)
-  {
-    return ParseIfStmt();
-  }
-  // FIRST(while_stmt) = {"while"}
-  else if (CurTok.type == WHILE)
-  {
-    return ParseWhileStmt();
-  }
-  // FIRST(return_stmt) = {"return"}
-  else if (CurTok.type == RETURN)
-  {
-    return ParseReturnStmt();
-  }
-  else
-  {
-    return LogError("Expected expression statement, block, if statement, while statement, or return statement");
-  }
-}
 
-// stmt_list ::= stmt stmt_list
-// |  epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseStmtList()
-{
-  std::vector<std::unique_ptr<ASTnode>> stmt_list;
-  // FIRST(stmt) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(","{","if","while","return",";"}
-  while (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == SC || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN)
-  {
-    stmt_list.push_back(ParseStmt()); // parse stmt
-  }
-  // FOLLOW(stmt_list) = {"}"}
-  if (CurTok.type == RBRA)
-  {
-    return stmt_list;
-  }
-  else
+  // rval6' ::= "&&" rval5 rval6'
+  // | epsilon
+  Node ParseRval6Prime(Node LHS)
   {
-    std::vector<std::unique_ptr<ASTnode>> errors;
-    std::unique_ptr<ASTnode> error = LogError("Expected }");
-    errors.push_back(std::move(error));
-    return errors;
+    if (CurTok.type == AND)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the &&
+      Node RHS = ParseRval5();                                                      // parse rval5
+      return ParseRval6Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::And)); // parse rval6'
+    }
+    else
+    { // Pass the epsilon through
+      return LHS;
+    }
   }
-}
 
-// not necessary but makes the code more readable
-//  var_type  ::= "int" |  "float" | "bool"
-static std::string ParseVarType()
-{
-  if (CurTok.type == INT_TOK)
-  {
-    return "int";
-  }
-  else if (CurTok.type == FLOAT_TOK)
+  // rval6 ::= rval5 rval6'
+  Node ParseRval6()
   {
-    return "float";
+    Node LHS = ParseRval5(); // parse rval5
+    return ParseRval6Prime(LHS);      // parse rval6'
   }
-  else if (CurTok.type == BOOL_TOK)
+
+  // rval7' ::= "||" rval6 rval7'
+  // | epsilon
+  Node ParseRval7Prime(Node LHS)
   {
-    return "bool";
+    if (CurTok.type == OR)
+    {
+      TOKEN a = CurTok;
+      getNextToken();                                                                                   // eat the ||
+      Node RHS = ParseRval6();                                                      // parse rval6
+      return ParseRval7Prime(Build.makeBinary(a, LHS, RHS, BinaryOp::Or)); // parse rval7'
+    }
+    else
+    { // Pass the epsilon through
+      return LHS;
+    }
   }
-  else
+
+  // rval7 ::= rval6 rval7'
+  Node ParseRval7()
   {
-    return LogErrorStr("Expected variable type - 'int', 'float', or 'bool'");
+    Node LHS = ParseRval6(); // parse rval6
+    return ParseRval7Prime(LHS);      // parse rval7'
   }
-}
 
-// local_decl ::= var_type IDENT ";"
-static std::unique_ptr<ASTnode> ParseLocalDecl()
-{
-  // FIRST(var_type) = {"int","float","bool"}
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+  // expr ::= IDENT "=" expr
+  // | rval7
+  Node ParseExpr()
   {
-    std::string var_type = ParseVarType(); // parse var_type
-    getNextToken();                        // eat the var_type
     if (CurTok.type == IDENT)
-    {
-      TOKEN a = CurTok;
-      std::string IDENT = IdentifierStr; // get the IDENT name
-      getNextToken();                    // eat the IDENT
-      if (CurTok.type == SC)
+    { // could be an rval or an assignment - FIRST(rval7) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","("}
+      if (lookahead1().type == ASSIGN)
       {
-        getNextToken(); // eat the ;
-        return std::make_unique<VarDeclASTnode>(a, IDENT, var_type);
+        SymbolId Name = CurTok.sym;
+        getNextToken(); // eat the IDENT
+        TOKEN a = CurTok;
+        getNextToken();                                                   // eat the =
+        Node expr = ParseExpr();                      // parse expr
+        return Build.makeAssign(a, Name, expr); // return the assignment
       }
       else
       {
-        return LogError("Expected ;");
+        return ParseRval7(); // parse rval7
       }
     }
     else
     {
-      return LogError("Expected variable name");
+      return ParseRval7(); // parse rval7
     }
   }
-  else
-  {
-    return LogError("Expected variable type - 'int', 'float', or 'bool'");
-  }
-}
-
-// local_decls ::= local_decl local_decls
-// |  epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseLocalDecls()
-{
-  std::vector<std::unique_ptr<ASTnode>> local_decls; // return empty vector if it is an epsilon transition
-  // FIRST(local_decl) = {"int","float","bool"}
-  while (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
-  {
-    local_decls.push_back(ParseLocalDecl()); // parse local_decl
-  }
-  // FOLLOW(local_decls) = {IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",";","{","if","while","else","return","}"}
-  if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN || CurTok.type == RBRA)
-  {
-    return local_decls;
-  }
-  else
-  {
-    std::vector<std::unique_ptr<ASTnode>> errors;
-    std::unique_ptr<ASTnode> error = LogError("Expected variable name, expression statement, 'if', 'while', 'else', 'return', or }");
-    errors.push_back(std::move(error));
-    return errors;
-  }
-}
 
-// block ::= "{" local_decls stmt_list "}"
-static std::unique_ptr<ASTnode> ParseBlock()
-{
-  if (CurTok.type == LBRA)
+  // return_stmt ::= "return" ";"
+  // |  "return" expr ";"
+  Node ParseReturnStmt()
   {
-    getNextToken(); // eat the {
-    TOKEN a = CurTok;
-    std::vector<std::unique_ptr<ASTnode>> local_decls = ParseLocalDecls(); // parse local_decls
-    std::vector<std::unique_ptr<ASTnode>> stmt_list = ParseStmtList();     // parse stmt_list
-    if (CurTok.type == RBRA)
+    if (CurTok.type == RETURN)
     {
-      getNextToken(); // eat the }
-      indentLevel++;
-      std::unique_ptr<ASTnode> block = std::make_unique<BlockASTnode>(a, std::move(local_decls), std::move(stmt_list), indentLevel);
-      indentLevel--;
-      return block;
+      TOKEN a = CurTok;
+      getNextToken(); // eat the return
+      if (CurTok.type == SC)
+      {
+        getNextToken();                                     // eat the ;
+        return Build.makeReturn(a, nullptr); // void return
+      }
+      else
+      {
+        Node expr = ParseExpr(); // parse expr
+        if (CurTok.type == SC)
+        {
+          getNextToken();                                             // eat the ;
+          return Build.makeReturn(a, expr); // return with expr
+        }
+        else
+        {
+          return LogError("Expected ;");
+        }
+      }
     }
     else
     {
-      return LogError("Expected }");
+      return LogError("Expected return statement");
     }
   }
-  else
-  {
-    return LogError("Expected {");
-  }
-}
 
-// param ::= var_type IDENT
-static std::unique_ptr<VarDeclASTnode> ParseParam()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+  // else_stmt  ::= "else" block
+  // |  epsilon
+  Node ParseElseStmt()
   {
-    std::string var_type = ParseVarType(); // parse var_type
-    getNextToken();
-    if (CurTok.type == IDENT)
+    if (CurTok.type == ELSE)
     {
-      TOKEN a = CurTok;
-      std::string ident = IdentifierStr; // get the IDENT name
-      getNextToken();                    // eat the IDENT
-      return std::make_unique<VarDeclASTnode>(a, ident, var_type);
+      getNextToken();      // eat the else
+      return ParseBlock(); // parse block
     }
-    else
+    // FIRST(block) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",LBRA,IF,WHILE,ELSE,RETURN,RBRA}
+    if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN || CurTok.type == RBRA)
     {
-      return LogErrorP("Expected variable name");
-    }
-  }
-  else
-  {
-    return LogErrorP("Expected variable type - 'int', 'float', or 'bool'");
-  }
-}
-
-// param_list' ::= param "," paramlist' | epsilon
-static std::vector<std::unique_ptr<VarDeclASTnode>> ParseParamListPrime()
-{
-  std::vector<std::unique_ptr<VarDeclASTnode>> param_list; // return empty vector if it is an epsilon transition
-  std::unique_ptr<VarDeclASTnode> param = ParseParam();    // parse param - returns nullptr if it is an epsilon transition
-  while (CurTok.type == COMMA)
-  {
-    getNextToken();                     // eat the ,
-    param_list.push_back(ParseParam()); // parse param
-  }
-  if (CurTok.type != RPAR)
-  {
-    std::vector<std::unique_ptr<VarDeclASTnode>> errors;
-    std::unique_ptr<VarDeclASTnode> error = LogErrorP("Expected )");
-    errors.push_back(std::move(error));
-    return errors;
-  }
-  else
-  {
-    param_list.insert(std::move(param_list.begin()), std::move(param));
-    return param_list;
-  }
-}
-
-// param_list ::= param "," param_list'
-//                | param
-static std::vector<std::unique_ptr<VarDeclASTnode>> ParseParamList()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
-  {
-    std::unique_ptr<VarDeclASTnode> param = ParseParam(); // parse param
-    if (CurTok.type == COMMA)
-    {                                                                                  // param_list' transition
-      getNextToken();                                                                  // eat the ,
-      std::vector<std::unique_ptr<VarDeclASTnode>> param_list = ParseParamListPrime(); // parse param_list'
-      if (param)
-      {
-        param_list.insert(param_list.begin(), std::move(param)); // insert param into the front of the vector
-      }
-      return param_list;
+      return nullptr; // epsilon transition == nullptr
     }
     else
-    { // param_list ::= param
-      std::vector<std::unique_ptr<VarDeclASTnode>> param_list;
-      param_list.push_back(std::move(param));
-      return param_list;
+    {
+      return LogError("Expected 'else' statement or another statement");
     }
   }
-  else
-  { // param_list ::= epsilon
-    std::unique_ptr<VarDeclASTnode> error = LogErrorP("Expected variable type - 'int', 'float', or 'bool'");
-    std::vector<std::unique_ptr<VarDeclASTnode>> param_list;
-    param_list.push_back(std::move(error));
-    return param_list;
-  }
-}
-
-// params ::= param_list
-// |  "void" | epsilon
-static std::vector<std::unique_ptr<VarDeclASTnode>> ParseParams()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
-  {
-    return ParseParamList(); // parse param_list
-  }
-  else if (CurTok.type == VOID_TOK)
-  {
-    std::unique_ptr<VarDeclASTnode> v = std::make_unique<VarDeclASTnode>(CurTok, "", "void"); // create a void variable
-    getNextToken();                                                                           // eat the void
-    std::vector<std::unique_ptr<VarDeclASTnode>> param_list;
-    param_list.push_back(std::move(v));
-    return param_list;
-  }
-  else if (CurTok.type == RPAR)
-  { // FOLLOW(params) = {")"}
-    return std::vector<std::unique_ptr<VarDeclASTnode>>{};
-  }
-  else
-  {
-    std::unique_ptr<VarDeclASTnode> error = LogErrorP("Incorrect parameter declaration - expected parameter type, 'void' or ')'");
-    std::vector<std::unique_ptr<VarDeclASTnode>> errors;
-    errors.push_back(std::move(error));
-    return errors;
-  }
-}
-
-// type_spec ::= "void"
-// |  var_type
-static std::string ParseTypeSpec()
-{
-  if (CurTok.type == VOID_TOK)
-  {
-    return "void"; // return void
-  }
-  else if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
-  {
-    return ParseVarType(); // parse var_type
-  }
-  else
-  {
-    return LogErrorStr("Expected type specifier - 'int', 'float', 'bool', or 'void'");
-  }
-}
 
-// fun_decl ::= type_spec IDENT "(" params ")" block
-static std::unique_ptr<ASTnode> ParseFunDecl()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
+  // if_stmt ::= "if" "(" expr ")" block else_stmt
+  Node ParseIfStmt()
   {
-    std::string type_spec = ParseTypeSpec(); // parse type_spec
-    getNextToken();                          // eat the type_spec
-    if (CurTok.type == IDENT)
+    if (CurTok.type == IF)
     {
       TOKEN a = CurTok;
-      std::string name = IdentifierStr; // get the IDENT name
-      getNextToken();                   // eat the IDENT
+      getNextToken(); // eat the if
       if (CurTok.type == LPAR)
       {
-        getNextToken();                                                      // eat the (
-        std::vector<std::unique_ptr<VarDeclASTnode>> params = ParseParams(); // parse params
+        getNextToken();                                     // eat the (
+        Node ifCondition = ParseExpr(); // parse expr
         if (CurTok.type == RPAR)
         {
           getNextToken(); // eat the )
-          // Fundecl = Prototype + Block
-          std::unique_ptr<ASTnode> block = ParseBlock(); // parse block
-          std::unique_ptr<PrototypeASTnode> proto = std::make_unique<PrototypeASTnode>(a, name, std::move(params), type_spec);
-          return std::make_unique<FunDeclASTnode>(a, std::move(proto), std::move(block));
+          indentLevel++;
+          Node ifBlock = ParseBlock();      // parse block
+          Node elseBlock = ParseElseStmt(); // parse else_stmt
+          Node ifast = Build.makeIf(a, ifCondition, ifBlock, elseBlock, indentLevel);
+          indentLevel--;
+          return ifast;
         }
         else
         {
@@ -1775,1163 +3056,5088 @@ static std::unique_ptr<ASTnode> ParseFunDecl()
     }
     else
     {
-      return LogError("Expected function name");
+      return LogError("Expected 'if' keyword");
     }
   }
-  else
-  {
-    return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
-  }
-}
 
-// var_decl ::= var_type IDENT ";"
-static std::unique_ptr<ASTnode> ParseVarDecl()
-{
-  // FIRST(var_type) = {"int", "float", "bool"}
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+  // expr_stmt ::= expr ";"
+  // |  ";"
+
+  Node ParseExprStmt()
   {
-    std::string var_type = ParseVarType(); // parse var_type
-    getNextToken();
-    if (CurTok.type == IDENT)
+    // FIRST(expr) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","("}
+    if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR)
     {
-      std::string name = IdentifierStr; // get the IDENT name
-      TOKEN a = CurTok;
-      getNextToken(); // eat the IDENT
+      Node expr = ParseExpr(); // parse expr
       if (CurTok.type == SC)
       {
         getNextToken(); // eat the ;
-        return std::make_unique<VarDeclASTnode>(a, name, var_type);
+        return expr;
       }
       else
       {
         return LogError("Expected ;");
       }
     }
+    else if (CurTok.type == SC)
+    {
+      getNextToken(); // eat the ;
+      return nullptr; // epsilon transition == nullptr
+    }
     else
     {
-      return LogError("Expected variable name");
+      return LogError("Expected expression statement or ;");
     }
   }
-  else
-  {
-    return LogError("Expected variable type - 'int', 'float', or 'bool'");
-  }
-}
 
-// decl ::= var_decl
-// |  fun_decl
-static std::unique_ptr<ASTnode> ParseDecl()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+  // while_stmt ::= "while" "(" expr ")" stmt
+  Node ParseWhileStmt()
   {
-    // either var_decl or fun_decl so we need to look ahead 2 to see if it is a semi-colon or bracket
-    if (lookahead1().type == IDENT)
+    if (CurTok.type == WHILE)
     {
-      if (lookahead2().type == LPAR)
-      {
-        // fun_decl
-        return ParseFunDecl();
-      }
-      else if (lookahead2().type == SC)
+      TOKEN a = CurTok;
+      getNextToken(); // eat the while
+      if (CurTok.type == LPAR)
       {
-        // var_decl
-        return ParseVarDecl();
+        getNextToken();                              // eat the (
+        Node expr = ParseExpr(); // parse expr
+        if (CurTok.type == RPAR)
+        {
+          getNextToken(); // eat the )
+          indentLevel = indentLevel + 2;
+          Node stmt = ParseStmt(); // parse stmt
+          indentLevel = indentLevel - 1;
+          Node w = Build.makeWhile(a, expr, stmt);
+          indentLevel = indentLevel - 1;
+          return w;
+        }
+        else
+        {
+          return LogError("Expected )");
+        }
       }
       else
       {
-        return LogError("Expected ; or ( for variable and function declaration respectively");
+        return LogError("Expected (");
       }
     }
     else
     {
-      return LogError("Expected function or variable name");
+      return LogError("Expected 'while' keyword");
     }
   }
-  else if (CurTok.type == VOID_TOK)
-  { // VOID_TOK is only in FIRST(fun_decl)
-    return ParseFunDecl();
-  }
-  else
-  {
-    return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
-  }
-}
 
-// decl_list' ::= decl decl_list'
-// | epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseDeclListPrime()
-{
-  std::vector<std::unique_ptr<ASTnode>> decl_list;
-  while (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
+  // stmt ::= expr_stmt
+  // |  block
+  // |  if_stmt
+  // |  while_stmt
+  // |  return_stmt
+  Node ParseStmt()
   {
-    decl_list.push_back(ParseDecl()); // parse decl
-  }
-  if (CurTok.type != EOF_TOK)
-  {
-    std::vector<std::unique_ptr<ASTnode>> errors;
-    std::unique_ptr<ASTnode> error = LogError("Expected EOF");
-    errors.push_back(std::move(error));
-    return errors;
+    // FIRST(expr_stmt) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",";"}
+    if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == SC)
+    {
+      return ParseExprStmt();
+    }
+    // FIRST(block)={"{"}
+    else if (CurTok.type == LBRA)
+    {
+      return ParseBlock();
+    }
+    // FIRST(if_stmt)={"if"}
+    else if (CurTok.type == IF)
+    {
+      return ParseIfStmt();
+    }
+    // FIRST(while_stmt) = {"while"}
+    else if (CurTok.type == WHILE)
+    {
+      return ParseWhileStmt();
+    }
+    // FIRST(return_stmt) = {"return"}
+    else if (CurTok.type == RETURN)
+    {
+      return ParseReturnStmt();
+    }
+    else
+    {
+      return LogError("Expected expression statement, block, if statement, while statement, or return statement");
+    }
   }
-  return decl_list;
-}
 
-// decl_list ::= decl decl_list'
-static std::vector<std::unique_ptr<ASTnode>> ParseDeclList()
-{
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
+  // stmt_list ::= stmt stmt_list
+  // |  epsilon
+  List ParseStmtList()
   {
-    std::unique_ptr<ASTnode> decl = ParseDecl(); // parse decl
-    if (decl)
+    List stmt_list;
+    // FIRST(stmt) = { IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(","{","if","while","return",";"}
+    while (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == SC || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN)
+    {
+      stmt_list.push_back(ParseStmt()); // parse stmt
+    }
+    // FOLLOW(stmt_list) = {"}"}
+    if (CurTok.type == RBRA)
     {
-      std::vector<std::unique_ptr<ASTnode>> decl_list = ParseDeclListPrime(); // parse decl list'
-      decl_list.insert(decl_list.begin(), std::move(decl));
-      return decl_list;
+      return stmt_list;
     }
     else
     {
-      std::unique_ptr<ASTnode> error = LogError("Expected function or variable declaration ");
-      std::vector<std::unique_ptr<ASTnode>> errors;
-      errors.push_back(std::move(error));
+      List errors;
+      Node error = LogError("Expected }");
+      errors.push_back(error);
       return errors;
     }
   }
-  else
+
+  // not necessary but makes the code more readable
+  //  var_type  ::= "int" |  "float" | "bool"
+  StringRef ParseVarType()
   {
-    std::unique_ptr<ASTnode> error = LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
-    std::vector<std::unique_ptr<ASTnode>> errors;
-    errors.push_back(std::move(error));
-    return errors;
+    if (CurTok.type == INT_TOK)
+    {
+      return "int";
+    }
+    else if (CurTok.type == FLOAT_TOK)
+    {
+      return "float";
+    }
+    else if (CurTok.type == BOOL_TOK)
+    {
+      return "bool";
+    }
+    else
+    {
+      return LogErrorStr("Expected variable type - 'int', 'float', or 'bool'");
+    }
   }
-}
 
-// extern ::= "extern" type_spec IDENT "(" params ")" ";"
-// FIRST(extern) = {extern}
-static std::unique_ptr<ASTnode> ParseExtern()
-{
-  if (CurTok.type == EXTERN)
+  // local_decl ::= var_type IDENT ";"
+  Node ParseLocalDecl()
   {
-    getNextToken(); // eat the extern
-    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
+    // FIRST(var_type) = {"int","float","bool"}
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
     {
-      std::string type_spec = ParseTypeSpec(); // deal with the type_spec
-      getNextToken();
+      StringRef var_type = ParseVarType(); // parse var_type
+      getNextToken();                        // eat the var_type
       if (CurTok.type == IDENT)
       {
         TOKEN a = CurTok;
-        std::string IDENT = IdentifierStr; // get the IDENT name
+        SymbolId IDENT = CurTok.sym; // get the IDENT name
         getNextToken();                    // eat the IDENT
-        if (CurTok.type == LPAR)
-        {                                                                      // deal with the params
-          getNextToken();                                                      // eat the (
-          std::vector<std::unique_ptr<VarDeclASTnode>> params = ParseParams(); // parse the params
-          if (CurTok.type == RPAR)
-          {                 // deal with the )
-            getNextToken(); // eat the )
-            if (CurTok.type == SC)
-            {                 // deal with the ;
-              getNextToken(); // eat the ;
-
-              return std::make_unique<ExternASTnode>(a, type_spec, IDENT, std::move(params));
-            }
-            else
-            {
-              return LogError("Expected ;");
-            }
-          }
-          else
-          {
-            return LogError("Expected )");
-          }
+        if (CurTok.type == SC)
+        {
+          getNextToken(); // eat the ;
+          return Build.makeVarDecl(a, IDENT, var_type);
         }
         else
         {
-          return LogError("Expected (");
+          return LogError("Expected ;");
         }
       }
       else
       {
-        return LogError("Expected function name");
+        return LogError("Expected variable name");
       }
     }
     else
     {
-      return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
+      return LogError("Expected variable type - 'int', 'float', or 'bool'");
     }
   }
-  else
-  {
-    return LogError("Expected 'extern' keyword");
-  }
-}
-
-// extern_list' ::= extern extern_List'
-// | epsilon
-static std::vector<std::unique_ptr<ASTnode>> ParseExternListPrime()
-{
-  std::vector<std::unique_ptr<ASTnode>> extern_list;
-  // FIRST(extern) = {extern}
-  while (CurTok.type == EXTERN)
-  {
-    extern_list.push_back(ParseExtern()); // parse extern
-  }
-  // FOLLOW(extern_list') = {"int","float","bool","void"}
-  if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
-  {
-    return extern_list;
-  }
-  else
-  {
-    std::vector<std::unique_ptr<ASTnode>> errorlist;
-    std::unique_ptr<ASTnode> error = LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
-    errorlist.push_back(std::move(error));
-    return extern_list;
-  }
-}
 
-// extern_list ::=  extern extern_list'
-static std::vector<std::unique_ptr<ASTnode>> ParseExternList()
-{
-  if (CurTok.type == EXTERN)
-  {                                                                             // FIRST(extern) = {extern}
-    std::unique_ptr<ASTnode> extern_node = ParseExtern();                       // parse extern
-    std::vector<std::unique_ptr<ASTnode>> extern_list = ParseExternListPrime(); // parse extern list'
-    extern_list.insert(extern_list.begin(), std::move(extern_node));            // add extern to front of list
-    return extern_list;
-  }
-  else
+  // local_decls ::= local_decl local_decls
+  // |  epsilon
+  List ParseLocalDecls()
   {
-    std::unique_ptr<ASTnode> error = LogError("Expected 'extern' keyword");
-    std::vector<std::unique_ptr<ASTnode>> errors;
-    errors.push_back(std::move(error));
-    return errors;
+    List local_decls; // return empty vector if it is an epsilon transition
+    // FIRST(local_decl) = {"int","float","bool"}
+    while (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+    {
+      local_decls.push_back(ParseLocalDecl()); // parse local_decl
+    }
+    // FOLLOW(local_decls) = {IDENT,INT_LIT,FLOAT_LIT,BOOL_LIT,"-","!","(",";","{","if","while","else","return","}"}
+    if (CurTok.type == IDENT || CurTok.type == INT_LIT || CurTok.type == FLOAT_LIT || CurTok.type == BOOL_LIT || CurTok.type == MINUS || CurTok.type == NOT || CurTok.type == LPAR || CurTok.type == LBRA || CurTok.type == IF || CurTok.type == WHILE || CurTok.type == ELSE || CurTok.type == RETURN || CurTok.type == RBRA)
+    {
+      return local_decls;
+    }
+    else
+    {
+      List errors;
+      Node error = LogError("Expected variable name, expression statement, 'if', 'while', 'else', 'return', or }");
+      errors.push_back(error);
+      return errors;
+    }
   }
-}
 
-// program ::= extern_list decl_list
-// | decl_list
-static std::unique_ptr<ASTnode> ParseProgram()
-{
-  TOKEN a = CurTok;
-  if (CurTok.type == EXTERN)
+  // block ::= "{" local_decls stmt_list "}"
+  Node ParseBlock()
   {
-    std::vector<std::unique_ptr<ASTnode>> extern_list = ParseExternList(); // parse extern list
-    // FIRST(program) = {EXTERN, INT_TOK, FLOAT_TOK, BOOL_TOK, VOID_TOK}
-    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
+    if (CurTok.type == LBRA)
     {
-      std::vector<std::unique_ptr<ASTnode>> decl_list = ParseDeclList(); // parse decl list
-      if (CurTok.type == EOF_TOK)
-      { // FOLLOW(program) = {EOF_TOK}
-        std::unique_ptr<ProgramASTnode> program = std::make_unique<ProgramASTnode>(a, std::move(extern_list), std::move(decl_list));
-        return program;
+      getNextToken(); // eat the {
+      TOKEN a = CurTok;
+      List local_decls = ParseLocalDecls(); // parse local_decls
+      List stmt_list = ParseStmtList();     // parse stmt_list
+      if (CurTok.type == RBRA)
+      {
+        BlockEnd = CurTok;
+        getNextToken(); // eat the }
+        indentLevel++;
+        Node block = Build.makeBlock(a, local_decls, stmt_list, indentLevel);
+        indentLevel--;
+        return block;
       }
       else
       {
-        return LogError("Expected EOF");
+        return LogError("Expected }");
       }
     }
     else
     {
-      return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
+      return LogError("Expected {");
     }
   }
-  else if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
+
+  // param ::= var_type IDENT
+  ParamNode ParseParam()
   {
-    std::vector<std::unique_ptr<ASTnode>> decl_list = ParseDeclList(); // parse decl list
-    if (CurTok.type == EOF_TOK)
-    { // check for eof
-      std::vector<std::unique_ptr<ASTnode>> extern_list;
-      std::unique_ptr<ProgramASTnode> program = std::make_unique<ProgramASTnode>(a, std::move(extern_list), std::move(decl_list));
-      return program;
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+    {
+      StringRef var_type = ParseVarType(); // parse var_type
+      getNextToken();
+      if (CurTok.type == IDENT)
+      {
+        TOKEN a = CurTok;
+        SymbolId ident = CurTok.sym; // get the IDENT name
+        getNextToken();                    // eat the IDENT
+        return Build.makeParam(a, ident, var_type);
+      }
+      else
+      {
+        return LogErrorP("Expected variable name");
+      }
     }
     else
     {
-      return LogError("Expected EOF");
+      return LogErrorP("Expected variable type - 'int', 'float', or 'bool'");
     }
   }
-  else
-  {
-    return LogError("Expected extern declaration or function declaration or variable declaration");
-  }
-}
-
-static std::unique_ptr<ASTnode> parser()
-{
-  return ParseProgram();
-}
-
-//===----------------------------------------------------------------------===//
-// Code Generation
-//===----------------------------------------------------------------------===//
-
-static LLVMContext TheContext;
-static IRBuilder<> Builder(TheContext);
-static std::unique_ptr<Module> TheModule;
-
-static std::unique_ptr<legacy::FunctionPassManager> TheFPM;
-
-// runtime stack of local variables
-static std::map<int, std::map<std::string, AllocaInst *>> VariableStack; // local variables as a stack
-static std::map<std::string, GlobalVariable *> GlobalVariables;          // global variables
-
-// runtime level
-static int level = 0;
-
-// error message for values
-Value *LogErrorV(const char *Str, TOKEN tok)
-{
-  LogErrorSemantic(Str, tok);
-  exit(-1);
-  return nullptr;
-}
-// error message for functions
-Function *LogErrorF(const char *Str, TOKEN tok)
-{
-  LogErrorSemantic(Str, tok);
-  exit(-1);
-  return nullptr;
-}
-
-static AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName, Type *type)
-{
-  IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-  return TmpB.CreateAlloca(type, nullptr, VarName);
-}
 
-Value *IntASTnode::codegen()
-{
-  return ConstantInt::get(TheContext, APInt(32, Val, true));
-}
-
-Value *FloatASTnode::codegen()
-{
-  return ConstantFP::get(TheContext, APFloat(Val));
-}
-
-Value *BoolASTnode::codegen()
-{
-  if (Val)
-    return ConstantInt::get(TheContext, APInt(1, 1, true));
-  else
-    return ConstantInt::get(TheContext, APInt(1, 0, true));
-}
-
-Value *VarCallASTnode::codegen()
-{
-  // check the local scope for the variable
-  for (int i = level; i >= 0; i--)
+  // param_list' ::= param "," paramlist' | epsilon
+  ParamList ParseParamListPrime()
   {
-    if (AllocaInst *alloca = VariableStack[i][Name])
+    ParamList param_list; // return empty vector if it is an epsilon transition
+    ParamNode param = ParseParam();    // parse param - returns nullptr if it is an epsilon transition
+    while (CurTok.type == COMMA)
+    {
+      getNextToken();                     // eat the ,
+      param_list.push_back(ParseParam()); // parse param
+    }
+    if (CurTok.type != RPAR)
+    {
+      ParamList errors;
+      ParamNode error = LogErrorP("Expected )");
+      errors.push_back(error);
+      return errors;
+    }
+    else
     {
-      return Builder.CreateLoad(alloca->getAllocatedType(), alloca, Name.c_str());
+      Build.prepend(param_list, param);
+      return param_list;
     }
   }
-  // if not found in local scope, check if a global variable exists
-  if (auto *G = TheModule->getNamedGlobal(Name))
-    return Builder.CreateLoad(G->getValueType(), G, Name.c_str());
-  return LogErrorV("Unknown variable name called", Tok);
-}
 
-Value *VarDeclASTnode::codegen()
-{
-  // check if variable is already declared in the current scope
-  for (int i = level; i >= 0; i--)
+  // param_list ::= param "," param_list'
+  //                | param
+  ParamList ParseParamList()
   {
-    if (VariableStack[i][Name])
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
     {
-      return LogErrorV("Variable already declared in the local scope", Tok);
+      ParamNode param = ParseParam(); // parse param
+      if (CurTok.type == COMMA)
+      {                                                                                  // param_list' transition
+        getNextToken();                                                                  // eat the ,
+        ParamList param_list = ParseParamListPrime(); // parse param_list'
+        if (param)
+        {
+          Build.prepend(param_list, param); // insert param into the front of the vector
+        }
+        return param_list;
+      }
+      else
+      { // param_list ::= param
+        ParamList param_list;
+        param_list.push_back(param);
+        return param_list;
+      }
+    }
+    else
+    { // param_list ::= epsilon
+      ParamNode error = LogErrorP("Expected variable type - 'int', 'float', or 'bool'");
+      ParamList param_list;
+      param_list.push_back(error);
+      return param_list;
     }
   }
 
-  // Create type and value for the alloca
-  llvm::Type *type = nullptr;
-  Constant *v = nullptr;
-  if (Type == "int")
-  {
-    type = Type::getInt32Ty(TheContext);
-    v = Constant::getNullValue(Type::getInt32Ty(TheContext));
-  }
-  else if (Type == "float")
-  {
-    type = Type::getFloatTy(TheContext);
-    v = Constant::getNullValue(Type::getFloatTy(TheContext));
-  }
-  else if (Type == "bool")
-  {
-    type = Type::getInt1Ty(TheContext);
-    v = Constant::getNullValue(Type::getInt1Ty(TheContext));
-  }
-  else
+  // params ::= param_list
+  // |  "void" | epsilon
+  ParamList ParseParams()
   {
-    return LogErrorV("Unknown type", Tok);
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+    {
+      return ParseParamList(); // parse param_list
+    }
+    else if (CurTok.type == VOID_TOK)
+    {
+      ParamNode v = Build.makeParam(CurTok, EmptySymbol, "void"); // create a void variable
+      getNextToken();                                                                           // eat the void
+      ParamList param_list;
+      param_list.push_back(v);
+      return param_list;
+    }
+    else if (CurTok.type == RPAR)
+    { // FOLLOW(params) = {")"}
+      return ParamList{};
+    }
+    else
+    {
+      ParamNode error = LogErrorP("Incorrect parameter declaration - expected parameter type, 'void' or ')'");
+      ParamList errors;
+      errors.push_back(error);
+      return errors;
+    }
   }
 
-  // Create the alloca
-  if (Builder.GetInsertBlock())
-  {
-    // local case
-    Function *TheFunction = Builder.GetInsertBlock()->getParent();
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Name, type);
-    VariableStack[level][Name] = Alloca;
-    return Alloca;
-  }
-  else
+  // type_spec ::= "void"
+  // |  var_type
+  StringRef ParseTypeSpec()
   {
-    // global case
-    GlobalVariable *g = new GlobalVariable(*(TheModule.get()), type, false, GlobalValue::CommonLinkage, v);
-    g->setAlignment(MaybeAlign(4));
-    g->setName(Name);
-    return g;
-  }
-};
-
-Value *UnaryASTnode::codegen()
-{
-  Value *R = RHS->codegen();
-  if (!R)
-    return nullptr;
-
-  switch (Op)
-  { // check the types and operands
-  case '-':
-    if (R->getType()->isIntegerTy(32))
+    if (CurTok.type == VOID_TOK)
     {
-      return Builder.CreateNeg(R, "negtmp");
+      return "void"; // return void
     }
-    else if (R->getType()->isFloatingPointTy())
+    else if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
     {
-      return Builder.CreateFNeg(R, "negtmp");
+      return ParseVarType(); // parse var_type
     }
     else
     {
-      return LogErrorV("Unknown type", Tok);
+      return LogErrorStr("Expected type specifier - 'int', 'float', 'bool', or 'void'");
     }
-  case '!':
-    if (R->getType()->isIntegerTy(1))
+  }
+
+  // fun_decl ::= type_spec IDENT "(" params ")" block
+  Node ParseFunDecl()
+  {
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
     {
-      return Builder.CreateNot(R, "nottmp");
+      StringRef type_spec = ParseTypeSpec(); // parse type_spec
+      getNextToken();                          // eat the type_spec
+      if (CurTok.type == IDENT)
+      {
+        TOKEN a = CurTok;
+        SymbolId name = CurTok.sym; // get the IDENT name
+        getNextToken();                   // eat the IDENT
+        if (CurTok.type == LPAR)
+        {
+          getNextToken();                                                      // eat the (
+          ParamList params = ParseParams(); // parse params
+          if (CurTok.type == RPAR)
+          {
+            getNextToken(); // eat the )
+            // Fundecl = Prototype + Block
+            Node block = ParseBlock(); // parse block
+            return Build.makeFunDecl(a, BlockEnd, name, params, type_spec, block);
+          }
+          else
+          {
+            return LogError("Expected )");
+          }
+        }
+        else
+        {
+          return LogError("Expected (");
+        }
+      }
+      else
+      {
+        return LogError("Expected function name");
+      }
     }
     else
     {
-      return LogErrorV("Unknown type", Tok);
+      return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
     }
-  default:
-    return LogErrorV("Invalid unary operator", Tok);
   }
-}
 
-Value *BinaryASTnode::codegen()
-{
-  Value *left = LHS->codegen();
-  Value *right = RHS->codegen();
-
-  if (!left || !right)
+  // var_decl ::= var_type IDENT ";"
+  Node ParseVarDecl()
   {
-    return nullptr;
+    // FIRST(var_type) = {"int", "float", "bool"}
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
+    {
+      StringRef var_type = ParseVarType(); // parse var_type
+      getNextToken();
+      if (CurTok.type == IDENT)
+      {
+        SymbolId name = CurTok.sym; // get the IDENT name
+        TOKEN a = CurTok;
+        getNextToken(); // eat the IDENT
+        if (CurTok.type == SC)
+        {
+          getNextToken(); // eat the ;
+          return Build.makeVarDecl(a, name, var_type);
+        }
+        else
+        {
+          return LogError("Expected ;");
+        }
+      }
+      else
+      {
+        return LogError("Expected variable name");
+      }
+    }
+    else
+    {
+      return LogError("Expected variable type - 'int', 'float', or 'bool'");
+    }
   }
 
-  Type *leftType = left->getType();
-  Type *rightType = right->getType();
-
-  // if both sides are ints
-  if (leftType == Type::getInt32Ty(TheContext) && rightType == Type::getInt32Ty(TheContext))
+  // decl ::= var_decl
+  // |  fun_decl
+  Node ParseDecl()
   {
-    if (Op == "+")
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK)
     {
-      return Builder.CreateAdd(left, right, "addtmp");
+      // either var_decl or fun_decl so we need to look ahead 2 to see if it is a semi-colon or bracket
+      if (lookahead1().type == IDENT)
+      {
+        if (lookahead2().type == LPAR)
+        {
+          // fun_decl
+          return ParseFunDecl();
+        }
+        else if (lookahead2().type == SC)
+        {
+          // var_decl
+          return ParseVarDecl();
+        }
+        else
+        {
+          return LogError("Expected ; or ( for variable and function declaration respectively");
+        }
+      }
+      else
+      {
+        return LogError("Expected function or variable name");
+      }
     }
-    else if (Op == "-")
-    {
-      return Builder.CreateSub(left, right, "subtmp");
+    else if (CurTok.type == VOID_TOK)
+    { // VOID_TOK is only in FIRST(fun_decl)
+      return ParseFunDecl();
     }
-    else if (Op == "*")
+    else
     {
-      return Builder.CreateMul(left, right, "multmp");
+      return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
     }
-    else if (Op == "/")
+  }
+
+  // decl_list' ::= decl decl_list'
+  // | epsilon
+  List ParseDeclListPrime()
+  {
+    List decl_list;
+    while (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
     {
-      return Builder.CreateSDiv(left, right, "divtmp");
+      decl_list.push_back(topLevel(ParseDecl())); // parse decl
     }
-    else if (Op == "%")
+    if (CurTok.type != EOF_TOK)
     {
-      return Builder.CreateSRem(left, right, "remtmp");
+      List errors;
+      Node error = LogError("Expected EOF");
+      errors.push_back(error);
+      return errors;
     }
-    else if (Op == "<")
+    return decl_list;
+  }
+
+  // decl_list ::= decl decl_list'
+  List ParseDeclList()
+  {
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
     {
-      return Builder.CreateICmpSLT(left, right, "cmptmp");
+      Node decl = topLevel(ParseDecl()); // parse decl
+      if (decl)
+      {
+        List decl_list = ParseDeclListPrime(); // parse decl list'
+        Build.prepend(decl_list, decl);
+        return decl_list;
+      }
+      else
+      {
+        Node error = LogError("Expected function or variable declaration ");
+        List errors;
+        errors.push_back(error);
+        return errors;
+      }
     }
-    else if (Op == ">")
+    else
     {
-      return Builder.CreateICmpSGT(left, right, "cmptmp");
+      Node error = LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
+      List errors;
+      errors.push_back(error);
+      return errors;
     }
-    else if (Op == "<=")
+  }
+
+  // extern ::= "extern" type_spec IDENT "(" params ")" ";"
+  // FIRST(extern) = {extern}
+  Node ParseExtern()
+  {
+    if (CurTok.type == EXTERN)
     {
-      return Builder.CreateICmpSLE(left, right, "cmptmp");
+      getNextToken(); // eat the extern
+      if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
+      {
+        StringRef type_spec = ParseTypeSpec(); // deal with the type_spec
+        getNextToken();
+        if (CurTok.type == IDENT)
+        {
+          TOKEN a = CurTok;
+          SymbolId IDENT = CurTok.sym; // get the IDENT name
+          getNextToken();                    // eat the IDENT
+          if (CurTok.type == LPAR)
+          {                                                                      // deal with the params
+            getNextToken();                                                      // eat the (
+            ParamList params = ParseParams(); // parse the params
+            if (CurTok.type == RPAR)
+            {                 // deal with the )
+              getNextToken(); // eat the )
+              if (CurTok.type == SC)
+              {                 // deal with the ;
+                getNextToken(); // eat the ;
+
+                return Build.makeExtern(a, type_spec, IDENT, params);
+              }
+              else
+              {
+                return LogError("Expected ;");
+              }
+            }
+            else
+            {
+              return LogError("Expected )");
+            }
+          }
+          else
+          {
+            return LogError("Expected (");
+          }
+        }
+        else
+        {
+          return LogError("Expected function name");
+        }
+      }
+      else
+      {
+        return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
+      }
     }
-    else if (Op == ">=")
+    else
     {
-      return Builder.CreateICmpSGE(left, right, "cmptmp");
+      return LogError("Expected 'extern' keyword");
     }
-    else if (Op == "==")
+  }
+
+  // extern_list' ::= extern extern_List'
+  // | epsilon
+  List ParseExternListPrime()
+  {
+    List extern_list;
+    // FIRST(extern) = {extern}
+    while (CurTok.type == EXTERN)
     {
-      return Builder.CreateICmpEQ(left, right, "cmptmp");
+      extern_list.push_back(topLevel(ParseExtern())); // parse extern
     }
-    else if (Op == "!=")
+    // FOLLOW(extern_list') = {"int","float","bool","void"}
+    if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
     {
-      return Builder.CreateICmpNE(left, right, "cmptmp");
+      return extern_list;
     }
     else
     {
-      return LogErrorV("invalid binary operator", Tok);
+      List errorlist;
+      Node error = LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
+      errorlist.push_back(error);
+      return extern_list;
     }
-  } // if both sides are floats
-  else if (leftType == Type::getFloatTy(TheContext) && rightType == Type::getFloatTy(TheContext))
+  }
+
+  // extern_list ::=  extern extern_list'
+  List ParseExternList()
   {
-    if (Op == "+")
-    {
-      return Builder.CreateFAdd(left, right, "addtmp");
+    if (CurTok.type == EXTERN)
+    {                                                                             // FIRST(extern) = {extern}
+      Node extern_node = topLevel(ParseExtern());             // parse extern
+      List extern_list = ParseExternListPrime(); // parse extern list'
+      Build.prepend(extern_list, extern_node);            // add extern to front of list
+      return extern_list;
     }
-    else if (Op == "-")
+    else
     {
-      return Builder.CreateFSub(left, right, "subtmp");
-    }
-    else if (Op == "*")
-    {
-      return Builder.CreateFMul(left, right, "multmp");
-    }
-    else if (Op == "/")
-    {
-      return Builder.CreateFDiv(left, right, "divtmp");
-    }
-    else if (Op == "%")
-    {
-      return Builder.CreateFRem(left, right, "remtmp");
-    }
-    else if (Op == "<")
-    {
-      return Builder.CreateFCmpULT(left, right, "cmptmp");
-    }
-    else if (Op == ">")
-    {
-      return Builder.CreateFCmpUGT(left, right, "cmptmp");
-    }
-    else if (Op == "<=")
-    {
-      return Builder.CreateFCmpULE(left, right, "cmptmp");
-    }
-    else if (Op == ">=")
-    {
-      return Builder.CreateFCmpUGE(left, right, "cmptmp");
-    }
-    else if (Op == "==")
-    {
-      return Builder.CreateFCmpUEQ(left, right, "cmptmp");
-    }
-    else if (Op == "!=")
-    {
-      return Builder.CreateFCmpUNE(left, right, "cmptmp");
-    }
-    else
-    {
-      return LogErrorV("invalid binary operator", Tok);
-    }
-  } // if one side is an int and one side is a float
-  else if ((leftType == Type::getInt32Ty(TheContext) && rightType == Type::getFloatTy(TheContext)) || (leftType == Type::getFloatTy(TheContext) && rightType == Type::getInt32Ty(TheContext)))
-  {
-    // cast the int to a float
-    if (leftType == Type::getInt32Ty(TheContext))
-    {
-      left = Builder.CreateSIToFP(left, Type::getFloatTy(TheContext), "casttmp");
-    }
-    else
-    {
-      right = Builder.CreateSIToFP(right, Type::getFloatTy(TheContext), "casttmp");
+      Node error = LogError("Expected 'extern' keyword");
+      List errors;
+      errors.push_back(error);
+      return errors;
     }
+  }
 
-    if (Op == "+")
-    {
-      return Builder.CreateFAdd(left, right, "addtmp");
-    }
-    else if (Op == "-")
-    {
-      return Builder.CreateFSub(left, right, "subtmp");
-    }
-    else if (Op == "*")
-    {
-      return Builder.CreateFMul(left, right, "multmp");
-    }
-    else if (Op == "/")
-    {
-      return Builder.CreateFDiv(left, right, "divtmp");
-    }
-    else if (Op == "%")
-    {
-      return Builder.CreateFRem(left, right, "remtmp");
-    }
-    else if (Op == "<")
-    {
-      return Builder.CreateFCmpULT(left, right, "cmptmp");
-    }
-    else if (Op == ">")
-    {
-      return Builder.CreateFCmpUGT(left, right, "cmptmp");
-    }
-    else if (Op == "<=")
-    {
-      return Builder.CreateFCmpULE(left, right, "cmptmp");
-    }
-    else if (Op == ">=")
-    {
-      return Builder.CreateFCmpUGE(left, right, "cmptmp");
-    }
-    else if (Op == "==")
-    {
-      return Builder.CreateFCmpUEQ(left, right, "cmptmp");
-    }
-    else if (Op == "!=")
-    {
-      return Builder.CreateFCmpUNE(left, right, "cmptmp");
-    }
-    else
-    {
-      return LogErrorV("invalid binary operator", Tok);
-    }
-  } // if both sides are bools
-  else if (leftType == Type::getInt1Ty(TheContext) && rightType == Type::getInt1Ty(TheContext))
+  // program ::= extern_list decl_list
+  // | decl_list
+  Node ParseProgram()
   {
-    if (Op == "&&")
+    TOKEN a = CurTok;
+    if (CurTok.type == EXTERN)
     {
-      // lazy evaluation
-      if (left == ConstantInt::get(TheContext, APInt(0, 0, true)))
-      {
-        return left;
-      }
-      else if (right == ConstantInt::get(TheContext, APInt(0, 0, true)))
+      List extern_list = ParseExternList(); // parse extern list
+      // FIRST(program) = {EXTERN, INT_TOK, FLOAT_TOK, BOOL_TOK, VOID_TOK}
+      if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
       {
-        return right;
+        List decl_list = ParseDeclList(); // parse decl list
+        if (CurTok.type == EOF_TOK)
+        { // FOLLOW(program) = {EOF_TOK}
+          Node program = Build.makeProgram(a, extern_list, decl_list);
+          return program;
+        }
+        else
+        {
+          return LogError("Expected EOF");
+        }
       }
       else
       {
-        return Builder.CreateAnd(left, right, "andtmp");
+        return LogError("Expected type specifier - 'int', 'float', 'bool', or 'void'");
       }
     }
-    else if (Op == "||")
+    else if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == BOOL_TOK || CurTok.type == VOID_TOK)
     {
-      // lazy evaluation
-      if (left == ConstantInt::get(TheContext, APInt(1, 0, true)))
-      {
-        return left;
-      }
-      else if (right == ConstantInt::get(TheContext, APInt(1, 0, true)))
-      {
-        return right;
+      List decl_list = ParseDeclList(); // parse decl list
+      if (CurTok.type == EOF_TOK)
+      { // check for eof
+        List extern_list;
+        Node program = Build.makeProgram(a, extern_list, decl_list);
+        return program;
       }
       else
       {
-        return Builder.CreateOr(left, right, "ortmp");
+        return LogError("Expected EOF");
       }
     }
-    else if (Op == "==")
-    {
-      return Builder.CreateICmpEQ(left, right, "cmptmp");
-    }
-    else if (Op == "!=")
-    {
-      return Builder.CreateICmpNE(left, right, "cmptmp");
-    }
     else
     {
-      return LogErrorV("Invalid binary operator", Tok);
+      return LogError("Expected extern declaration or function declaration or variable declaration");
     }
   }
-  else
-  {
-    return LogErrorV("Type of the left and right side of the binary expression does not match", Tok);
-  }
-}
+};
 
-Value *FunctionCallASTnode::codegen()
+// ASTLayout - How parser() lays out the AST it returns
+enum class ASTLayout
 {
-  // Look up the name in the global module table.
-  Function *CalleeF = TheModule->getFunction(Name);
-  if (!CalleeF)
-  {
-    return LogErrorV("Unknown function referenced", Tok);
-  }
-  // If there is an argument mismatch error.
-  if (CalleeF->arg_size() != Args.size())
-  {
-    return LogErrorV("Incorrect number of arguments passed", Tok);
-  }
+  Tree, // one heap node per AST node, linked by pointers
+  Flat, // the flat, index-based structure of arrays
+};
 
-  // generate the arguments and push onto the stack
-  std::vector<Value *> ArgsV;
-  for (unsigned i = 0, e = Args.size(); i != e; ++i)
+// parser - Parse the whole program. OnTopLevelDecl, if given, is called with
+// each top-level declaration as soon as it is parsed (tree layout only).
+static ASTnode *parser(ASTLayout Layout, std::function<void(ASTnode *)> OnTopLevelDecl = nullptr)
+{
+  if (Layout == ASTLayout::Flat)
   {
-    ArgsV.push_back(Args[i]->codegen());
-    if (!ArgsV.back())
-      return nullptr;
+    assert(!OnTopLevelDecl && "the flat AST only exists once the whole program is parsed");
+    Parser<FlatBuilder> P;
+    P.ParseProgram();
+    return P.Build.finish();
   }
+  Parser<TreeBuilder> P;
+  P.OnTopLevelDecl = std::move(OnTopLevelDecl);
+  return P.ParseProgram();
+}
 
-  // check argument value types are the same as in the call
-  for (unsigned i = 0, e = Args.size(); i != e; ++i)
-  {
-    if (ArgsV[i]->getType() != CalleeF->getFunctionType()->getParamType(i))
+//===----------------------------------------------------------------------===//
+// Parallel parsing (--parallel-parse)
+//===----------------------------------------------------------------------===//
+// A quick prescan splits the source at the end of every top-level
+// declaration; runs of declarations are then lexed and parsed by a thread
+// pool, each worker with its own lexer position, token stream and arena, and
+// the results are joined into one ProgramASTnode in source order. Anything
+// that would not parse the same sequentially (a syntax error, an extern after
+// a definition) is left to the sequential parser.
+
+// DeclStart - Where a top-level declaration may start, with the lexer's line
+// number and the start of the line there.
+struct DeclStart
+{
+  const char *Pos;
+  int Line;
+  const char *LineStart;
+};
+
+// prescanDecls - Split the source after every ';' or '}' that is outside all
+// braces and parentheses, skipping comments. Newlines are counted the way the
+// lexer counts them. Only valid programs need to be split right; the rest
+// fail to parse somewhere and get parsed again sequentially.
+static std::vector<DeclStart> prescanDecls()
+{
+  const char *Begin = SourceBuf->getBufferStart();
+  const char *End = SourceBuf->getBufferEnd();
+  std::vector<DeclStart> Starts;
+  Starts.push_back({Begin, 1, Begin});
+  int Line = 1, Braces = 0, Parens = 0;
+  const char *LineStart = Begin;
+  for (const char *P = Begin; P != End; ++P)
+  {
+    switch (*P)
     {
-      if (ArgsV[i]->getType() == Type::getInt32Ty(TheContext) && CalleeF->getFunctionType()->getParamType(i) == Type::getFloatTy(TheContext))
-      {
-        ArgsV[i] = Builder.CreateSIToFP(ArgsV[i], Type::getFloatTy(TheContext), "casttmp");
-        fprintf(stderr, "WARNING: Implicit assignment of function argument from int to float\n"); // parameter name
-      }
-      else if (ArgsV[i]->getType() == Type::getFloatTy(TheContext) && CalleeF->getFunctionType()->getParamType(i) == Type::getInt32Ty(TheContext))
-      {
-        ArgsV[i] = Builder.CreateFPToSI(ArgsV[i], Type::getInt32Ty(TheContext), "casttmp");
-        fprintf(stderr, "WARNING: Explicit assignment of function argument from int to float\n"); // parameter name
-      }
-      else
-      {
-        return LogErrorV("Incorrect function argument type", Tok); // name and parameter
-      }
+    case '\n':
+    case '\r':
+      Line++;
+      LineStart = P + 1;
+      break;
+    case '/':
+      if (P + 1 != End && P[1] == '/')
+        P = Scanners->scanLineEnd(P + 2, End) - 1;
+      break;
+    case '{':
+      Braces++;
+      break;
+    case '}':
+      if (--Braces == 0 && Parens == 0)
+        Starts.push_back({P + 1, Line, LineStart});
+      break;
+    case '(':
+      Parens++;
+      break;
+    case ')':
+      Parens--;
+      break;
+    case ';':
+      if (Braces == 0 && Parens == 0)
+        Starts.push_back({P + 1, Line, LineStart});
+      break;
     }
   }
-  return Builder.CreateCall(CalleeF, ArgsV, "calltmp");
+  return Starts;
 }
 
-Value *BlockASTnode::codegen()
+// resumeLexer - Lex [Start.Pos, End) from the state the lexer would be in at
+// Start.Pos after lexing everything before it (see initLexer).
+static void resumeLexer(const DeclStart &Start, const char *End)
 {
-  // increment the level of the scope
-  level++;
-  // create a new map for the new scope
-  VariableStack[level] = std::map<std::string, AllocaInst *>();
-  // generate the code for the local declarations and the statements
-  for (auto &i : local_decls)
+  CurPtr = Start.Pos;
+  BufEnd = End;
+  lineNo = Start.Line;
+  columnNo = 2 + (Start.Pos - Start.LineStart);
+  LastChar = readChar();
+}
+
+// ParseBatch - A run of top-level declarations parsed by one pool task
+struct ParseBatch
+{
+  DeclStart Begin;
+  const char *End;
+  TOKEN First; // for the program node
+  NodeList Externs, Decls;
+  bool ExternAfterDecl = false;
+};
+
+// The arenas of the --parallel-parse workers, which hold their part of the AST
+// until the end of the compilation, and the number of nodes they made.
+static std::vector<std::unique_ptr<BumpPtrAllocator>> WorkerArenas;
+static std::mutex WorkerArenasLock;
+static std::atomic<uint64_t> WorkerASTNodes{0};
+
+static void parseBatch(ParseBatch &B)
+{
+  static thread_local SymbolCache Cache;
+  InParseWorker = true;
+  LocalSymbols = &Cache;
+  if (ASTArena == &MainASTArena)
   {
-    i->codegen();
+    std::lock_guard<std::mutex> Guard(WorkerArenasLock);
+    WorkerArenas.push_back(std::make_unique<BumpPtrAllocator>());
+    ASTArena = WorkerArenas.back().get();
   }
 
-  for (auto &i : statements)
+  resumeLexer(B.Begin, B.End);
+  tok_buffer = TokenBuffer();
+  CurTok = TOKEN();
+  getNextToken();
+  B.First = CurTok;
+
+  Parser<TreeBuilder> P;
+  while (CurTok.type != EOF_TOK && !ParseAbandoned)
   {
-    if (i != nullptr)
+    if (CurTok.type == EXTERN)
     {
-      i->codegen();
+      B.ExternAfterDecl |= !B.Decls.empty();
+      B.Externs.push_back(P.ParseExtern());
     }
+    else if (CurTok.type == INT_TOK || CurTok.type == FLOAT_TOK || CurTok.type == VOID_TOK || CurTok.type == BOOL_TOK)
+      B.Decls.push_back(P.ParseDecl());
+    else
+      abandonParse();
   }
-
-  // pop the variables off of the stack
-  VariableStack[level].clear();
-  level--;
-  return nullptr;
+  WorkerASTNodes += NumASTNodes;
+  NumASTNodes = 0;
 }
 
-Value *WhileASTnode::codegen()
+// parseParallel - Parse the program on Jobs threads (0: one per core), or
+// return null if it has to be parsed sequentially after all.
+static ASTnode *parseParallel(unsigned Jobs)
 {
-  // increment the level of the scope
-  level++;
-  // create a new map for the new scope
-  VariableStack[level] = std::map<std::string, AllocaInst *>();
-
-  Function *TheFunction = Builder.GetInsertBlock()->getParent();
-
-  // create the basic blocks for the condition, loop block and the end of the loop
-  BasicBlock *cond = BasicBlock::Create(TheContext, "cond", TheFunction);
-  BasicBlock *loop = BasicBlock::Create(TheContext, "loop");
-  BasicBlock *end_ = BasicBlock::Create(TheContext, "afterloop");
-
-  // create the branch to the loop condition
-  Builder.CreateBr(cond);
-  Builder.SetInsertPoint(cond);
-  Value *condV = Condition->codegen(); // generate the condition
-  if (!condV)
+  std::vector<DeclStart> Starts = prescanDecls();
+
+  // Cut the declarations into batches of about 1/16th of a thread's share of
+  // the source, so that the threads stay busy until the end.
+  ThreadPoolStrategy Strategy = hardware_concurrency(Jobs);
+  size_t Target = std::max<size_t>(SourceBuf->getBufferSize() / (Strategy.compute_thread_count() * 16), 64 * 1024);
+  std::vector<ParseBatch> Batches;
+  for (const DeclStart &Start : Starts)
+  {
+    if (!Batches.empty() && size_t(Start.Pos - Batches.back().Begin.Pos) < Target)
+      continue;
+    if (!Batches.empty())
+      Batches.back().End = Start.Pos;
+    Batches.emplace_back();
+    Batches.back().Begin = Start;
+  }
+  Batches.back().End = SourceBuf->getBufferEnd();
+
+  ThreadsRunning = true;
+  auto Pool = std::make_unique<ThreadPool>(Strategy);
+  for (ParseBatch &B : Batches)
+    Pool->async([&B]()
+                {
+                  {
+                    std::lock_guard<std::mutex> Guard(ParseDoneLock);
+                    if (ParseAbandoned)
+                      return;
+                    BatchesBusy++;
+                  }
+                  parseBatch(B);
+                  {
+                    std::lock_guard<std::mutex> Guard(ParseDoneLock);
+                    BatchesBusy--;
+                    BatchesDone++;
+                  }
+                  ParseDone.notify_all();
+                });
+  {
+    // when giving up, wait until no worker is using Batches any more
+    std::unique_lock<std::mutex> Guard(ParseDoneLock);
+    ParseDone.wait(Guard, [&]()
+                   { return ParseAbandoned ? BatchesBusy == 0 : BatchesDone == Batches.size(); });
+  }
+  if (ParseAbandoned)
+  {
+    // a parked worker never finishes, so the pool must not be joined
+    Pool.release();
     return nullptr;
-  Value *comp = Builder.CreateICmpNE(condV, ConstantInt::get(TheContext, APInt(1, 0, false)), "ifcond");
-  Builder.CreateCondBr(comp, loop, end_); // create the branch to the loop or the end of the loop
-
-  // create the loop block
-  TheFunction->getBasicBlockList().push_back(loop);
-  Builder.SetInsertPoint(loop);
-  Stmt->codegen();        // generate the loop body
-  Builder.CreateBr(cond); // create the branch to the condition
+  }
+  Pool.reset();
+  ThreadsRunning = false;
 
-  TheFunction->getBasicBlockList().push_back(end_);
-  Builder.SetInsertPoint(end_);
+  // program ::= extern_list decl_list | decl_list
+  NodeList Externs, Decls;
+  for (ParseBatch &B : Batches)
+  {
+    if (B.ExternAfterDecl || (!B.Externs.empty() && !Decls.empty()))
+      return nullptr;
+    Externs.append(B.Externs.begin(), B.Externs.end());
+    Decls.append(B.Decls.begin(), B.Decls.end());
+  }
+  if (Decls.empty())
+    return nullptr;
+  TreeBuilder Build;
+  return Build.makeProgram(Batches.front().First, Externs, Decls);
+}
 
-  // pop the variables off of the stack
-  VariableStack[level].clear();
-  level--;
+//===----------------------------------------------------------------------===//
+// Code Generation
+//===----------------------------------------------------------------------===//
 
-  return Constant::getNullValue(Type::getInt32Ty(TheContext));
+// The context, builder and module that code is generated into: the main ones,
+// or those of a function generated for --lazy (see compileLazy).
+static LLVMContext MainContext;
+static IRBuilder<> MainBuilder(MainContext);
+static std::unique_ptr<Module> MainModule;
+static thread_local LLVMContext *TheContext = &MainContext;
+static thread_local IRBuilder<> *Builder = &MainBuilder;
+static thread_local Module *TheModule = nullptr;
+
+// The machine the code is for: the host, or the target, CPU and features of
+// --target, --mcpu and --mattr (see createTargetMachine)
+static std::unique_ptr<TargetMachine> TheTargetMachine;
+
+// setTarget - Stamp the target's triple and data layout onto a module
+static void setTarget(Module &M)
+{
+  M.setTargetTriple(TheTargetMachine->getTargetTriple().str());
+  M.setDataLayout(TheTargetMachine->createDataLayout());
 }
 
-Value *IfASTnode::codegen()
+// setTargetAttributes - Tell the optimizer, on each function, which CPU and
+// features it may use
+static void setTargetAttributes(Function &F)
 {
-  if (ElseBlock == nullptr)
-  { // if no else block
-
-    Value *cond = IfCondition->codegen();
-    Value *comp = Builder.CreateICmpNE(cond, ConstantInt::get(TheContext, APInt(1, 0, false)), "ifcond");
-
-    Function *TheFunction = Builder.GetInsertBlock()->getParent();
-    // create blocks for if the condition is true and the end of the if statement
-    BasicBlock *true_ =
-        BasicBlock::Create(TheContext, "ifthen", TheFunction);
-    BasicBlock *end_ = BasicBlock::Create(TheContext, "end");
-
-    // create conditional branch between the true block and the end block
-    Builder.CreateCondBr(comp, true_, end_);
-    // set the insertion point to the true block
-    Builder.SetInsertPoint(true_);
-    Value *ifV = IfBlock->codegen();
+  StringRef CPU = TheTargetMachine->getTargetCPU();
+  StringRef Features = TheTargetMachine->getTargetFeatureString();
+  if (!CPU.empty())
+    F.addFnAttr("target-cpu", CPU);
+  if (!Features.empty())
+    F.addFnAttr("target-features", Features);
+}
 
-    Builder.CreateBr(end_);
-    TheFunction->getBasicBlockList().push_back(end_);
-    Builder.SetInsertPoint(end_);
-    return Constant::getNullValue(Type::getInt32Ty(TheContext));
-    ;
-  }
-  else
-  { // if else block
-    // create conditional branch between the true block and the false block
-    Value *cond = IfCondition->codegen();
-    if (!cond)
-      return nullptr;
-    if (cond->getType() != Type::getInt1Ty(TheContext))
-    {
-      return LogErrorV("If statement condition must be a 'bool'", Tok);
-    }
-    Value *comp = Builder.CreateICmpNE(cond, ConstantInt::get(TheContext, APInt(1, 0, false)), "ifcond");
+// Set by --ssa: locals are SSA values built directly by SSABuilder, rather
+// than allocas that are loaded and stored
+static bool DirectSSA = false;
 
-    Function *TheFunction = Builder.GetInsertBlock()->getParent();
-    // create blocks for if the condition is true, false and when they merge
-    BasicBlock *true_ =
-        BasicBlock::Create(TheContext, "ifthen", TheFunction);
-    BasicBlock *false_ =
-        BasicBlock::Create(TheContext, "elsethen");
-    BasicBlock *merge = BasicBlock::Create(TheContext, "cont");
+// Set by --tre (the default): calls a function makes to itself in tail
+// position become loops as it is generated
+static bool EliminateTailCalls = true;
 
-    Builder.CreateCondBr(comp, true_, false_);
+// Set when the code generated for a function does not verify; each function
+// is verified as it is finished, so the module need not be again unless this
+// is set, and checkGenerated then fails the compile
+static std::atomic<bool> MalformedCode{false};
 
-    // set the insertion point to the true block and branch to the merge block
-    Builder.SetInsertPoint(true_);
+// LocalVar - A local variable or parameter of the function being generated
+struct LocalVar
+{
+  Type *Ty;
+  StringRef Name;
+  AllocaInst *Alloca; // null under --ssa
+};
 
-    Value *ifV = IfBlock->codegen();
-    Builder.CreateBr(merge);
-    // set the insertion point to the false block and branch to the merge block
-    TheFunction->getBasicBlockList().push_back(false_);
-    Builder.SetInsertPoint(false_);
+// ScopedSymbolTable - The local variables in scope. An open-addressing hash
+// table maps each name to its innermost binding; the bindings themselves are
+// kept in declaration order as an undo log, each linked to the one it hides,
+// so that leaving a scope pops just the bindings made in it.
+class ScopedSymbolTable
+{
+  struct Slot
+  {
+    SymbolId Name = EmptySymbol; // EmptySymbol: a free slot
+    int Innermost = -1;          // index in Log, or -1 when out of scope
+  };
+  struct Binding
+  {
+    SymbolId Name;
+    LocalVar *Var;
+    unsigned Depth; // of the scope that made it
+    int Hidden;     // the binding it hides, or -1
+  };
 
-    Value *elseV = ElseBlock->codegen();
-    Builder.CreateBr(merge);
+  std::vector<Slot> Slots = std::vector<Slot>(64); // a power of two
+  unsigned Shift = 32 - 6;                        // hash to slot: the top log2(size) bits
+  unsigned NumNames = 0;
+  std::vector<Binding> Log;
+  std::vector<unsigned> ScopeStarts; // the Log size when each open scope began
 
-    TheFunction->getBasicBlockList().push_back(merge);
-    // set the insertion point to the merge block
-    Builder.SetInsertPoint(merge);
-    return Constant::getNullValue(Type::getInt32Ty(TheContext)); // dont know why this is here tbh
+  unsigned probe(SymbolId Name) const
+  {
+    unsigned Mask = Slots.size() - 1;
+    unsigned I = (Name * 2654435769u) >> Shift;
+    while (Slots[I].Name != Name && Slots[I].Name != EmptySymbol)
+      I = (I + 1) & Mask;
+    return I;
   }
-};
 
-Value *AssignASTnode::codegen()
-{
-  // evaluate the rhs
-  Value *V = RHS->codegen();
-  if (!V)
-    return nullptr;
-  // look up the value in the local symbol table
-  bool found = false;
-  for (int i = level; i >= 0; i--)
+  // slotOf - Name's slot, added if it has none; the table is kept at most 3/4 full
+  Slot &slotOf(SymbolId Name)
   {
-    // update the variables in the stack in all the levels of the local declarations
-    if (VariableStack[i][Name])
-    { // if the local variable is found
-      // allow for implicit AND explicict assignment
-      if (V->getType() != VariableStack[i][Name]->getAllocatedType())
-      {
-        if ((V->getType() == Type::getInt32Ty(TheContext)) && (VariableStack[i][Name]->getAllocatedType() == Type::getFloatTy(TheContext)))
-        {
-          fprintf(stderr, "WARNING: Implicit assignment of local variable from int to float\n");
-          V = Builder.CreateSIToFP(V, Type::getFloatTy(TheContext), "tmp");
-        }
-        else if ((V->getType() == Type::getFloatTy(TheContext)) && (VariableStack[i][Name]->getAllocatedType() == Type::getInt32Ty(TheContext)))
-        {
-          fprintf(stderr, "WARNING: Implicit assignment of local variable from int to float\n");
-          V = Builder.CreateFPToSI(V, Type::getInt32Ty(TheContext), "tmp");
-        }
-        else
-        {
-          return LogErrorV("Type of local variable and expression do not match", Tok);
-        }
-      }
-      Builder.CreateStore(V, VariableStack[i][Name]);
-      found = true;
+    unsigned I = probe(Name);
+    if (Slots[I].Name == Name)
+      return Slots[I];
+    if ((NumNames + 1) * 4 > Slots.size() * 3)
+    {
+      std::vector<Slot> Old(Slots.size() * 2);
+      Old.swap(Slots);
+      Shift--;
+      for (const Slot &S : Old)
+        if (S.Name != EmptySymbol)
+          Slots[probe(S.Name)] = S;
+      I = probe(Name);
     }
+    NumNames++;
+    Slots[I].Name = Name;
+    return Slots[I];
   }
-  // if the variable is global
-  if (!found)
+
+public:
+  void pushScope() { ScopeStarts.push_back(Log.size()); }
+
+  void popScope()
   {
-    if (GlobalVariable *g = TheModule->getGlobalVariable(Name))
+    for (; Log.size() > ScopeStarts.back(); Log.pop_back())
+      Slots[probe(Log.back().Name)].Innermost = Log.back().Hidden;
+    ScopeStarts.pop_back();
+  }
+
+  // bind - Bind Name in the innermost scope, in place of any binding that
+  // scope has made for it already
+  void bind(SymbolId Name, LocalVar *Var)
+  {
+    if (Name == EmptySymbol) // a "void" parameter: nothing can refer to it
+      return;
+    Slot &S = slotOf(Name);
+    if (S.Innermost >= 0 && Log[S.Innermost].Depth == ScopeStarts.size())
     {
-      //attempt to cast the value to the global variable type
-      
-      // if(V->getType() != g->getType()->getPointerElementType()){
-      //   fprintf(stderr, "global - implicit assignment from int to float\n");
-      //   V = Builder.CreateSIToFP(V, Type::getFloatTy(TheContext), "tmp");
-      // }else if((V->getType() == Type::getFloatTy(TheContext)) && (g->getType() == Type::getInt32PtrTy(TheContext))){
-      //   fprintf(stderr, "global - explicit assignment from float to int\n");
-      //   V = Builder.CreateFPToSI(V, Type::getInt32Ty(TheContext), "tmp");
-      // }else{
-      //   return LogErrorV("assignment type mismatch", Tok);
-      // }
-      Builder.CreateStore(V, g);
-      found = true;
+      Log[S.Innermost].Var = Var;
+      return;
     }
+    Log.push_back({Name, Var, unsigned(ScopeStarts.size()), S.Innermost});
+    S.Innermost = Log.size() - 1;
   }
 
-  if (!found)
+  // lookup - Name's innermost binding, or null
+  LocalVar *lookup(SymbolId Name) const
   {
-    return LogErrorV("Unknown variable name called", Tok);
+    int B = Slots[probe(Name)].Innermost;
+    return B >= 0 ? Log[B].Var : nullptr;
   }
 
-  return V;
-}
+  // bindings - All of Name's bindings, innermost first
+  SmallVector<LocalVar *, 2> bindings(SymbolId Name) const
+  {
+    SmallVector<LocalVar *, 2> All;
+    for (int B = Slots[probe(Name)].Innermost; B >= 0; B = Log[B].Hidden)
+      All.push_back(Log[B].Var);
+    return All;
+  }
+};
 
-Function *PrototypeASTnode::codegen()
+// runtime stack of local variables
+static thread_local ScopedSymbolTable VariableStack;
+// the locals of the function being generated
+static thread_local std::deque<LocalVar> FunctionLocals;
+
+// SSABuilder - Builds the SSA form of the locals while their code is being
+// generated (--ssa), after Braun et al., "Simple and Efficient Construction of
+// Static Single Assignment Form". Each block maps a variable to its current
+// value; a read in a block without one looks through the predecessors,
+// placing a phi where they may disagree. A block is sealed once all of its
+// predecessors are known: until then the phis it needs stay incomplete, and
+// a phi whose operands turn out to be a single value is replaced by it.
+class SSABuilder
 {
-  // create a vector of the types of the parameters
-  std::vector<Type *> types;
-  for (auto &i : Params)
+  // tracking handles, so that a value stays current when a phi is replaced
+  DenseMap<std::pair<BasicBlock *, const LocalVar *>, WeakTrackingVH> CurrentDef;
+  SmallPtrSet<BasicBlock *, 32> Sealed;
+  DenseMap<BasicBlock *, SmallVector<std::pair<const LocalVar *, PHINode *>, 4>> IncompletePhis;
+
+  Value *readRecursive(const LocalVar *Var, BasicBlock *BB)
   {
-    if (i->getType() == "float")
-    {
-      types.push_back(Type::getFloatTy(TheContext));
-    }
-    else if (i->getType() == "int")
+    Value *Val;
+    if (!Sealed.count(BB))
     {
-      types.push_back(Type::getInt32Ty(TheContext));
+      PHINode *Phi = newPhi(Var, BB);
+      IncompletePhis[BB].push_back({Var, Phi});
+      Val = Phi;
     }
-    else if (i->getType() == "bool")
+    else if (BasicBlock *Pred = BB->getSinglePredecessor())
+      Val = read(Var, Pred);
+    else if (pred_empty(BB)) // the entry block, or unreachable code
+      Val = UndefValue::get(Var->Ty);
+    else
     {
-      types.push_back(Type::getInt1Ty(TheContext));
+      // the phi breaks cycles through loops
+      PHINode *Phi = newPhi(Var, BB);
+      write(Var, BB, Phi);
+      Val = addPhiOperands(Var, Phi);
     }
+    write(Var, BB, Val);
+    return Val;
   }
 
-  Function *F = nullptr;
-  // create the function type and add it to the module
-  if (Type_spec == "float")
+  PHINode *newPhi(const LocalVar *Var, BasicBlock *BB)
   {
-    FunctionType *FT = FunctionType::get(Type::getFloatTy(TheContext), types, false);
-    F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+    if (Instruction *First = BB->getFirstNonPHI())
+      return PHINode::Create(Var->Ty, 0, Var->Name, First);
+    return PHINode::Create(Var->Ty, 0, Var->Name, BB);
   }
-  else if (Type_spec == "int")
+
+  Value *addPhiOperands(const LocalVar *Var, PHINode *Phi)
   {
-    FunctionType *FT = FunctionType::get(Type::getInt32Ty(TheContext), types, false);
-    F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+    for (BasicBlock *Pred : predecessors(Phi->getParent()))
+      Phi->addIncoming(read(Var, Pred), Pred);
+    return tryRemoveTrivialPhi(Phi);
   }
-  else if (Type_spec == "bool")
+
+  // tryRemoveTrivialPhi - Replace a phi that only merges one value (and
+  // itself) by that value, then retry the phis that used it
+  Value *tryRemoveTrivialPhi(PHINode *Phi)
   {
-    FunctionType *FT = FunctionType::get(Type::getInt1Ty(TheContext), types, false);
-    F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+    Value *Same = nullptr;
+    for (Value *Op : Phi->incoming_values())
+    {
+      if (Op == Same || Op == Phi)
+        continue;
+      if (Same)
+        return Phi;
+      Same = Op;
+    }
+    if (!Same)
+      Same = UndefValue::get(Phi->getType());
+    // Same may be one of the users, and be replaced in turn
+    WeakTrackingVH Result = Same;
+
+    SmallVector<WeakVH, 4> Users;
+    for (User *U : Phi->users())
+      if (U != Phi && isa<PHINode>(U))
+        Users.push_back(U);
+    Phi->replaceAllUsesWith(Same);
+    Phi->eraseFromParent();
+    // a phi still having its operands added is left until it has them all
+    for (WeakVH &U : Users)
+      if (auto *UserPhi = dyn_cast_or_null<PHINode>(U))
+        if (UserPhi->getNumIncomingValues() == pred_size(UserPhi->getParent()))
+          tryRemoveTrivialPhi(UserPhi);
+    return Result;
   }
-  else if (Type_spec == "void")
+
+public:
+  void write(const LocalVar *Var, BasicBlock *BB, Value *Val) { CurrentDef[{BB, Var}] = Val; }
+
+  Value *read(const LocalVar *Var, BasicBlock *BB)
   {
-    FunctionType *FT = FunctionType::get(Type::getVoidTy(TheContext), types, false);
-    F = Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+    auto Def = CurrentDef.find({BB, Var});
+    if (Def != CurrentDef.end())
+      return Def->second;
+    return readRecursive(Var, BB);
   }
-  else
+
+  // seal - All of BB's predecessors have their branches to it now
+  void seal(BasicBlock *BB)
   {
-    return LogErrorF("Unknown function return type", Tok);
+    auto Incomplete = IncompletePhis.find(BB);
+    if (Incomplete != IncompletePhis.end())
+    {
+      auto Phis = std::move(Incomplete->second);
+      IncompletePhis.erase(Incomplete);
+      for (auto &VarPhi : Phis)
+        addPhiOperands(VarPhi.first, VarPhi.second);
+    }
+    Sealed.insert(BB);
+  }
+
+  void clear()
+  {
+    CurrentDef.clear();
+    Sealed.clear();
+    IncompletePhis.clear();
+  }
+};
+
+static thread_local SSABuilder SSA;
+
+// sealBlock - For --ssa, all of BB's predecessors branch to it by now
+static void sealBlock(BasicBlock *BB)
+{
+  if (DirectSSA)
+    SSA.seal(BB);
+}
+
+// newLocal - Make a local variable of the function being generated
+static LocalVar *newLocal(StringRef Name, Type *Ty)
+{
+  AllocaInst *Alloca = nullptr;
+  if (!DirectSSA)
+  {
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
+    Alloca = TmpB.CreateAlloca(Ty, nullptr, Name);
+  }
+  FunctionLocals.push_back({Ty, Name, Alloca});
+  return &FunctionLocals.back();
+}
+
+static Value *readLocal(LocalVar *Var)
+{
+  if (Var->Alloca)
+    return Builder->CreateLoad(Var->Ty, Var->Alloca, Var->Name);
+  return SSA.read(Var, Builder->GetInsertBlock());
+}
+
+static void writeLocal(LocalVar *Var, Value *V)
+{
+  if (Var->Alloca)
+    Builder->CreateStore(V, Var->Alloca);
+  else
+    SSA.write(Var, Builder->GetInsertBlock(), V);
+}
+static std::map<std::string, GlobalVariable *> GlobalVariables;          // global variables
+
+// Functions that --stream has written out and then removed from the module
+// altogether, with their types; a later call declares them again.
+static StringMap<FunctionType *> RetiredFunctions;
+
+// The top-level declarations in program order, the first of them to declare
+// each name and, while a function is generated for --lazy, its own.
+static std::vector<ASTnode *> TopLevelDecls;
+static StringMap<unsigned> FirstDeclaredAt;
+static thread_local unsigned CurrentDecl = 0;
+
+// declareEarlier - While a function is generated for --lazy, declare Name in
+// its module if a top-level declaration before the function declares it, as
+// it would already be in the main module.
+static Value *declareEarlier(StringRef Name)
+{
+  if (!CodegenDiags)
+    return nullptr;
+  auto First = FirstDeclaredAt.find(Name);
+  if (First == FirstDeclaredAt.end() || First->second >= CurrentDecl)
+    return nullptr;
+  return TopLevelDecls[First->second]->declare();
+}
+
+// lookupFunction - The function called Name, declaring it again if it has been
+// retired.
+static Function *lookupFunction(SymbolId Name)
+{
+  StringRef Str = Symbols.str(Name);
+  if (Function *F = TheModule->getFunction(Str))
+    return F;
+  if (CodegenDiags)
+    return dyn_cast_or_null<Function>(declareEarlier(Str));
+  auto Retired = RetiredFunctions.find(Str);
+  if (Retired == RetiredFunctions.end())
+    return nullptr;
+  Function *F = Function::Create(Retired->second, Function::ExternalLinkage, Str, TheModule);
+  setTargetAttributes(*F);
+  return F;
+}
+
+// lookupGlobal - The global variable called Name
+static GlobalVariable *lookupGlobal(SymbolId Name)
+{
+  StringRef Str = Symbols.str(Name);
+  if (GlobalVariable *G = TheModule->getNamedGlobal(Str))
+    return G;
+  return dyn_cast_or_null<GlobalVariable>(declareEarlier(Str));
+}
+
+// error message for values
+Value *LogErrorV(const char *Str, TOKEN tok)
+{
+  LogErrorSemantic(Str, tok);
+  exitOnError();
+  return nullptr;
+}
+// error message for functions
+Function *LogErrorF(const char *Str, TOKEN tok)
+{
+  LogErrorSemantic(Str, tok);
+  exitOnError();
+  return nullptr;
+}
+
+// The number of warnings reported
+static std::atomic<unsigned> NumWarnings{0};
+
+// codegenWarning - Report a warning, or keep it with a --lazy function for
+// when it is first called
+static void codegenWarning(const char *Str)
+{
+  NumWarnings++;
+  if (CodegenDiags)
+    raw_string_ostream(*CodegenDiags) << "WARNING: " << Str << "\n";
+  else
+    fprintf(stderr, "WARNING: %s\n", Str);
+}
+
+// ParamInfo - A parameter as code generation needs it
+struct ParamInfo
+{
+  SymbolId Name;
+  StringRef Type;
+};
+
+Value *IntASTnode::codegen()
+{
+  return ConstantInt::get(*TheContext, APInt(32, Val, true));
+}
+
+Value *FloatASTnode::codegen()
+{
+  return ConstantFP::get(*TheContext, APFloat(Val));
+}
+
+Value *BoolASTnode::codegen()
+{
+  if (Val)
+    return ConstantInt::get(*TheContext, APInt(1, 1, true));
+  else
+    return ConstantInt::get(*TheContext, APInt(1, 0, true));
+}
+
+// The codegen* helpers below hold the code generation logic for each kind of
+// node. They are shared by the tree nodes' codegen() methods and the flat AST
+// walker, so both AST layouts emit identical IR; children are passed in as
+// values when they are always generated first, and as callbacks when the
+// helper has to set up blocks or scopes around them.
+
+static Value *codegenVarCall(SymbolId Name, TOKEN Tok)
+{
+  // check the local scope for the variable
+  if (LocalVar *Var = VariableStack.lookup(Name))
+    return readLocal(Var);
+  // if not found in local scope, check if a global variable exists
+  if (auto *G = lookupGlobal(Name))
+    return Builder->CreateLoad(G->getValueType(), G, Symbols.str(Name));
+  return LogErrorV("Unknown variable name called", Tok);
+}
+
+Value *VarCallASTnode::codegen()
+{
+  return codegenVarCall(Name, Tok);
+}
+
+static Value *codegenVarDecl(SymbolId Name, StringRef Type, TOKEN Tok)
+{
+  // check if variable is already declared in the current scope
+  if (VariableStack.lookup(Name))
+    return LogErrorV("Variable already declared in the local scope", Tok);
+
+  // Create type and value for the alloca
+  llvm::Type *type = nullptr;
+  Constant *v = nullptr;
+  if (Type == "int")
+  {
+    type = Type::getInt32Ty(*TheContext);
+    v = Constant::getNullValue(Type::getInt32Ty(*TheContext));
+  }
+  else if (Type == "float")
+  {
+    type = Type::getFloatTy(*TheContext);
+    v = Constant::getNullValue(Type::getFloatTy(*TheContext));
+  }
+  else if (Type == "bool")
+  {
+    type = Type::getInt1Ty(*TheContext);
+    v = Constant::getNullValue(Type::getInt1Ty(*TheContext));
+  }
+  else
+  {
+    return LogErrorV("Unknown type", Tok);
+  }
+
+  // Create the alloca
+  if (Builder->GetInsertBlock())
+  {
+    // local case
+    LocalVar *Var = newLocal(Symbols.str(Name), type);
+    VariableStack.bind(Name, Var);
+    return Var->Alloca;
+  }
+  else
+  {
+    // global case
+    GlobalVariable *g = new GlobalVariable(*TheModule, type, false, GlobalValue::CommonLinkage, v);
+    g->setAlignment(MaybeAlign(4));
+    g->setName(Symbols.str(Name));
+    return g;
+  }
+};
+
+Value *VarDeclASTnode::codegen()
+{
+  return codegenVarDecl(Name, Type, Tok);
+}
+
+// A global variable is defined in the main module and only declared in the
+// modules of --lazy functions.
+Value *VarDeclASTnode::declare()
+{
+  StringRef Str = Symbols.str(Name);
+  if (TheModule->getNamedValue(Str))
+    return nullptr;
+  if (TheModule == MainModule.get())
+    return codegenVarDecl(Name, Type, Tok);
+  llvm::Type *type = Type == "int" ? Type::getInt32Ty(*TheContext) : Type == "float" ? Type::getFloatTy(*TheContext) : Type::getInt1Ty(*TheContext);
+  GlobalVariable *g = new GlobalVariable(*TheModule, type, false, GlobalValue::ExternalLinkage, nullptr, Str);
+  g->setAlignment(MaybeAlign(4));
+  return g;
+}
+
+static Value *codegenUnary(char Op, Value *R, TOKEN Tok)
+{
+  if (!R)
+    return nullptr;
+
+  switch (Op)
+  { // check the types and operands
+  case '-':
+    if (R->getType()->isIntegerTy(32))
+    {
+      return Builder->CreateNeg(R, "negtmp");
+    }
+    else if (R->getType()->isFloatingPointTy())
+    {
+      return Builder->CreateFNeg(R, "negtmp");
+    }
+    else
+    {
+      return LogErrorV("Unknown type", Tok);
+    }
+  case '!':
+    if (R->getType()->isIntegerTy(1))
+    {
+      return Builder->CreateNot(R, "nottmp");
+    }
+    else
+    {
+      return LogErrorV("Unknown type", Tok);
+    }
+  default:
+    return LogErrorV("Invalid unary operator", Tok);
+  }
+}
+
+Value *UnaryASTnode::codegen()
+{
+  return codegenUnary(Op, RHS->codegen(), Tok);
+}
+
+// BinaryEmitter - Emits one operator for one class of operand types; the
+// operands are already of that class
+typedef Value *(*BinaryEmitter)(Value *L, Value *R);
+
+// the operand type classes of BinaryEmitters; int/float mixes are promoted to float
+enum OperandClass
+{
+  IntOperands,
+  FloatOperands,
+  BoolOperands,
+  NumOperandClasses,
+};
+
+// BinaryEmitters - Emitter of each operator for each operand class, by
+// OperandClass and BinaryOp; null where the operator does not apply
+static const BinaryEmitter BinaryEmitters[NumOperandClasses][NumBinaryOps] = {
+    // IntOperands
+    {
+        [](Value *L, Value *R) { return Builder->CreateAdd(L, R, "addtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateSub(L, R, "subtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateMul(L, R, "multmp"); },
+        [](Value *L, Value *R) { return Builder->CreateSDiv(L, R, "divtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateSRem(L, R, "remtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpSLT(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpSGT(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpSLE(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpSGE(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpEQ(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpNE(L, R, "cmptmp"); },
+        nullptr,
+        nullptr,
+    },
+    // FloatOperands
+    {
+        [](Value *L, Value *R) { return Builder->CreateFAdd(L, R, "addtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFSub(L, R, "subtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFMul(L, R, "multmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFDiv(L, R, "divtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFRem(L, R, "remtmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpULT(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpUGT(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpULE(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpUGE(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpUEQ(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateFCmpUNE(L, R, "cmptmp"); },
+        nullptr,
+        nullptr,
+    },
+    // BoolOperands
+    {
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        nullptr,
+        [](Value *L, Value *R) { return Builder->CreateICmpEQ(L, R, "cmptmp"); },
+        [](Value *L, Value *R) { return Builder->CreateICmpNE(L, R, "cmptmp"); },
+        nullptr, // && and || are generated by codegenLogical
+        nullptr,
+    },
+};
+
+// error for an operator that does not apply to its operands, by OperandClass
+static const char *const InvalidBinaryOpErrors[NumOperandClasses] = {"invalid binary operator", "invalid binary operator", "Invalid binary operator"};
+
+static Value *codegenBinary(BinaryOp Op, Value *left, Value *right, TOKEN Tok)
+{
+  if (!left || !right)
+  {
+    return nullptr;
+  }
+
+  Type *leftType = left->getType();
+  Type *rightType = right->getType();
+
+  // find the class of the operands, casting an int to a float if one side is a float
+  OperandClass Class;
+  if (leftType == rightType && leftType->isIntegerTy(32))
+    Class = IntOperands;
+  else if (leftType == rightType && leftType->isFloatTy())
+    Class = FloatOperands;
+  else if (leftType == rightType && leftType->isIntegerTy(1))
+    Class = BoolOperands;
+  else if (leftType->isIntegerTy(32) && rightType->isFloatTy())
+  {
+    left = Builder->CreateSIToFP(left, rightType, "casttmp");
+    Class = FloatOperands;
+  }
+  else if (leftType->isFloatTy() && rightType->isIntegerTy(32))
+  {
+    right = Builder->CreateSIToFP(right, leftType, "casttmp");
+    Class = FloatOperands;
+  }
+  else
+  {
+    return LogErrorV("Type of the left and right side of the binary expression does not match", Tok);
+  }
+
+  if (BinaryEmitter Emit = BinaryEmitters[Class][unsigned(Op)])
+    return Emit(left, right);
+  return LogErrorV(InvalidBinaryOpErrors[Class], Tok);
+}
+
+// codegenLogical - && and ||, which only evaluate their right operand when
+// the left one does not decide the result: the left operand branches around
+// the right one, and a phi merges the results. A cheap right operand
+// (CheapRight) is evaluated whatever the left one is and the result selected,
+// sparing the branch.
+static Value *codegenLogical(BinaryOp Op, function_ref<Value *()> GenLeft, function_ref<Value *()> GenRight, bool CheapRight, TOKEN Tok)
+{
+  bool IsAnd = Op == BinaryOp::And;
+  Value *left = GenLeft();
+  // report operands that are not both bools as any other operator does
+  if (!left || !left->getType()->isIntegerTy(1))
+    return codegenBinary(Op, left, GenRight(), Tok);
+
+  if (CheapRight)
+  {
+    Value *right = GenRight();
+    if (!right || !right->getType()->isIntegerTy(1))
+      return codegenBinary(Op, left, right, Tok);
+    if (IsAnd)
+      return Builder->CreateSelect(left, right, Builder->getFalse(), "andtmp");
+    return Builder->CreateSelect(left, Builder->getTrue(), right, "ortmp");
+  }
+
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  BasicBlock *LeftEnd = Builder->GetInsertBlock();
+  // create the blocks for the right operand and for the result
+  BasicBlock *rhs = BasicBlock::Create(*TheContext, IsAnd ? "andrhs" : "orrhs", TheFunction);
+  BasicBlock *end_ = BasicBlock::Create(*TheContext, IsAnd ? "andend" : "orend");
+  if (IsAnd)
+    Builder->CreateCondBr(left, rhs, end_);
+  else
+    Builder->CreateCondBr(left, end_, rhs);
+
+  Builder->SetInsertPoint(rhs);
+  sealBlock(rhs);
+  Value *right = GenRight();
+  if (!right || !right->getType()->isIntegerTy(1))
+    return codegenBinary(Op, left, right, Tok);
+  BasicBlock *RightEnd = Builder->GetInsertBlock();
+  Builder->CreateBr(end_);
+
+  TheFunction->getBasicBlockList().push_back(end_);
+  Builder->SetInsertPoint(end_);
+  sealBlock(end_);
+  PHINode *Result = Builder->CreatePHI(left->getType(), 2, IsAnd ? "andtmp" : "ortmp");
+  Result->addIncoming(IsAnd ? Builder->getFalse() : Builder->getTrue(), LeftEnd);
+  Result->addIncoming(right, RightEnd);
+  return Result;
+}
+
+Value *BinaryASTnode::codegen()
+{
+  if (Op == BinaryOp::And || Op == BinaryOp::Or)
+  {
+    unsigned Budget = CheapOperandNodes;
+    return codegenLogical(Op, [&]() { return LHS->codegen(); }, [&]() { return RHS->codegen(); }, RHS->isCheap(Budget), Tok);
+  }
+  Value *left = LHS->codegen();
+  Value *right = RHS->codegen();
+  return codegenBinary(Op, left, right, Tok);
+}
+
+// codegenCall - GenArg(i) generates the i-th argument; it is only called once
+// the callee and the argument count have been checked.
+static Value *codegenCall(SymbolId Name, unsigned NumArgs, function_ref<Value *(unsigned)> GenArg, TOKEN Tok)
+{
+  // Look up the name in the global module table.
+  Function *CalleeF = lookupFunction(Name);
+  if (!CalleeF)
+  {
+    return LogErrorV("Unknown function referenced", Tok);
+  }
+  // If there is an argument mismatch error.
+  if (CalleeF->arg_size() != NumArgs)
+  {
+    return LogErrorV("Incorrect number of arguments passed", Tok);
+  }
+
+  // generate the arguments and push onto the stack
+  std::vector<Value *> ArgsV;
+  for (unsigned i = 0, e = NumArgs; i != e; ++i)
+  {
+    ArgsV.push_back(GenArg(i));
+    if (!ArgsV.back())
+      return nullptr;
+  }
+
+  // check argument value types are the same as in the call
+  for (unsigned i = 0, e = NumArgs; i != e; ++i)
+  {
+    if (ArgsV[i]->getType() != CalleeF->getFunctionType()->getParamType(i))
+    {
+      if (ArgsV[i]->getType() == Type::getInt32Ty(*TheContext) && CalleeF->getFunctionType()->getParamType(i) == Type::getFloatTy(*TheContext))
+      {
+        ArgsV[i] = Builder->CreateSIToFP(ArgsV[i], Type::getFloatTy(*TheContext), "casttmp");
+        codegenWarning("Implicit assignment of function argument from int to float"); // parameter name
+      }
+      else if (ArgsV[i]->getType() == Type::getFloatTy(*TheContext) && CalleeF->getFunctionType()->getParamType(i) == Type::getInt32Ty(*TheContext))
+      {
+        ArgsV[i] = Builder->CreateFPToSI(ArgsV[i], Type::getInt32Ty(*TheContext), "casttmp");
+        codegenWarning("Explicit assignment of function argument from int to float"); // parameter name
+      }
+      else
+      {
+        return LogErrorV("Incorrect function argument type", Tok); // name and parameter
+      }
+    }
+  }
+  return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+}
+
+Value *FunctionCallASTnode::codegen()
+{
+  return codegenCall(Name, Args.size(), [&](unsigned i) { return Args[i]->codegen(); }, Tok);
+}
+
+// codegenBlock - GenBody generates the local declarations and the statements
+static Value *codegenBlock(function_ref<void()> GenBody)
+{
+  // open a new scope
+  VariableStack.pushScope();
+  // generate the code for the local declarations and the statements
+  GenBody();
+
+  // pop the variables off of the stack
+  VariableStack.popScope();
+  return nullptr;
+}
+
+Value *BlockASTnode::codegen()
+{
+  return codegenBlock([&]() {
+    for (auto &i : local_decls)
+    {
+      i->codegen();
+    }
+
+    for (auto &i : statements)
+    {
+      if (i != nullptr)
+      {
+        i->codegen();
+      }
+    }
+  });
+}
+
+static Value *codegenWhile(function_ref<Value *()> GenCond, function_ref<void()> GenBody)
+{
+  // open a new scope
+  VariableStack.pushScope();
+
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+  // create the basic blocks for the condition, loop block and the end of the loop
+  BasicBlock *cond = BasicBlock::Create(*TheContext, "cond", TheFunction);
+  BasicBlock *loop = BasicBlock::Create(*TheContext, "loop");
+  BasicBlock *end_ = BasicBlock::Create(*TheContext, "afterloop");
+
+  // create the branch to the loop condition
+  Builder->CreateBr(cond);
+  Builder->SetInsertPoint(cond);
+  Value *condV = GenCond(); // generate the condition
+  if (!condV)
+    return nullptr;
+  Value *comp = Builder->CreateICmpNE(condV, ConstantInt::get(*TheContext, APInt(1, 0, false)), "ifcond");
+  Builder->CreateCondBr(comp, loop, end_); // create the branch to the loop or the end of the loop
+
+  // create the loop block
+  TheFunction->getBasicBlockList().push_back(loop);
+  Builder->SetInsertPoint(loop);
+  sealBlock(loop);
+  GenBody();              // generate the loop body
+  Builder->CreateBr(cond); // create the branch to the condition
+  sealBlock(cond);
+
+  TheFunction->getBasicBlockList().push_back(end_);
+  Builder->SetInsertPoint(end_);
+  sealBlock(end_);
+
+  // pop the variables off of the stack
+  VariableStack.popScope();
+
+  return Constant::getNullValue(Type::getInt32Ty(*TheContext));
+}
+
+Value *WhileASTnode::codegen()
+{
+  return codegenWhile([&]() { return Condition->codegen(); }, [&]() {
+    if (Stmt != nullptr)
+      Stmt->codegen();
+  });
+}
+
+// codegenIf - GenElse is null when there is no else block
+static Value *codegenIf(function_ref<Value *()> GenCond, function_ref<void()> GenThen, function_ref<void()> GenElse, TOKEN Tok)
+{
+  if (!GenElse)
+  { // if no else block
+
+    Value *cond = GenCond();
+    Value *comp = Builder->CreateICmpNE(cond, ConstantInt::get(*TheContext, APInt(1, 0, false)), "ifcond");
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    // create blocks for if the condition is true and the end of the if statement
+    BasicBlock *true_ =
+        BasicBlock::Create(*TheContext, "ifthen", TheFunction);
+    BasicBlock *end_ = BasicBlock::Create(*TheContext, "end");
+
+    // create conditional branch between the true block and the end block
+    Builder->CreateCondBr(comp, true_, end_);
+    // set the insertion point to the true block
+    Builder->SetInsertPoint(true_);
+    sealBlock(true_);
+    GenThen();
+
+    Builder->CreateBr(end_);
+    TheFunction->getBasicBlockList().push_back(end_);
+    Builder->SetInsertPoint(end_);
+    sealBlock(end_);
+    return Constant::getNullValue(Type::getInt32Ty(*TheContext));
+    ;
+  }
+  else
+  { // if else block
+    // create conditional branch between the true block and the false block
+    Value *cond = GenCond();
+    if (!cond)
+      return nullptr;
+    if (cond->getType() != Type::getInt1Ty(*TheContext))
+    {
+      return LogErrorV("If statement condition must be a 'bool'", Tok);
+    }
+    Value *comp = Builder->CreateICmpNE(cond, ConstantInt::get(*TheContext, APInt(1, 0, false)), "ifcond");
+
+    Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    // create blocks for if the condition is true, false and when they merge
+    BasicBlock *true_ =
+        BasicBlock::Create(*TheContext, "ifthen", TheFunction);
+    BasicBlock *false_ =
+        BasicBlock::Create(*TheContext, "elsethen");
+    BasicBlock *merge = BasicBlock::Create(*TheContext, "cont");
+
+    Builder->CreateCondBr(comp, true_, false_);
+
+    // set the insertion point to the true block and branch to the merge block
+    Builder->SetInsertPoint(true_);
+    sealBlock(true_);
+
+    GenThen();
+    Builder->CreateBr(merge);
+    // set the insertion point to the false block and branch to the merge block
+    TheFunction->getBasicBlockList().push_back(false_);
+    Builder->SetInsertPoint(false_);
+    sealBlock(false_);
+
+    GenElse();
+    Builder->CreateBr(merge);
+
+    TheFunction->getBasicBlockList().push_back(merge);
+    // set the insertion point to the merge block
+    Builder->SetInsertPoint(merge);
+    sealBlock(merge);
+    return Constant::getNullValue(Type::getInt32Ty(*TheContext)); // dont know why this is here tbh
+  }
+};
+
+Value *IfASTnode::codegen()
+{
+  auto GenElse = [&]() { ElseBlock->codegen(); };
+  return codegenIf([&]() { return IfCondition->codegen(); }, [&]() { IfBlock->codegen(); },
+                   ElseBlock ? function_ref<void()>(GenElse) : nullptr, Tok);
+}
+
+static Value *codegenAssign(SymbolId Name, Value *V, TOKEN Tok)
+{
+  if (!V)
+    return nullptr;
+  // look up the value in the local symbol table
+  bool found = false;
+  // update the variables in the stack in all the levels of the local declarations
+  for (LocalVar *Local : VariableStack.bindings(Name))
+  {
+    // allow for implicit AND explicict assignment
+    if (V->getType() != Local->Ty)
+    {
+      if ((V->getType() == Type::getInt32Ty(*TheContext)) && (Local->Ty == Type::getFloatTy(*TheContext)))
+      {
+        codegenWarning("Implicit assignment of local variable from int to float");
+        V = Builder->CreateSIToFP(V, Type::getFloatTy(*TheContext), "tmp");
+      }
+      else if ((V->getType() == Type::getFloatTy(*TheContext)) && (Local->Ty == Type::getInt32Ty(*TheContext)))
+      {
+        codegenWarning("Implicit assignment of local variable from int to float");
+        V = Builder->CreateFPToSI(V, Type::getInt32Ty(*TheContext), "tmp");
+      }
+      else
+      {
+        return LogErrorV("Type of local variable and expression do not match", Tok);
+      }
+    }
+    writeLocal(Local, V);
+    found = true;
+  }
+  // if the variable is global
+  if (!found)
+  {
+    if (GlobalVariable *g = lookupGlobal(Name))
+    {
+      //attempt to cast the value to the global variable type
+      
+      // if(V->getType() != g->getType()->getPointerElementType()){
+      //   fprintf(stderr, "global - implicit assignment from int to float\n");
+      //   V = Builder->CreateSIToFP(V, Type::getFloatTy(*TheContext), "tmp");
+      // }else if((V->getType() == Type::getFloatTy(*TheContext)) && (g->getType() == Type::getInt32PtrTy(*TheContext))){
+      //   fprintf(stderr, "global - explicit assignment from float to int\n");
+      //   V = Builder->CreateFPToSI(V, Type::getInt32Ty(*TheContext), "tmp");
+      // }else{
+      //   return LogErrorV("assignment type mismatch", Tok);
+      // }
+      Builder->CreateStore(V, g);
+      found = true;
+    }
+  }
+
+  if (!found)
+  {
+    return LogErrorV("Unknown variable name called", Tok);
+  }
+
+  return V;
+}
+
+Value *AssignASTnode::codegen()
+{
+  // evaluate the rhs
+  return codegenAssign(Name, RHS->codegen(), Tok);
+}
+
+static Function *codegenPrototype(SymbolId Name, ArrayRef<ParamInfo> Params, StringRef Type_spec, TOKEN Tok)
+{
+  // create a vector of the types of the parameters
+  std::vector<Type *> types;
+  for (auto &i : Params)
+  {
+    if (i.Type == "float")
+    {
+      types.push_back(Type::getFloatTy(*TheContext));
+    }
+    else if (i.Type == "int")
+    {
+      types.push_back(Type::getInt32Ty(*TheContext));
+    }
+    else if (i.Type == "bool")
+    {
+      types.push_back(Type::getInt1Ty(*TheContext));
+    }
+  }
+
+  Function *F = nullptr;
+  // create the function type and add it to the module
+  if (Type_spec == "float")
+  {
+    FunctionType *FT = FunctionType::get(Type::getFloatTy(*TheContext), types, false);
+    F = Function::Create(FT, Function::ExternalLinkage, Symbols.str(Name), TheModule);
+  }
+  else if (Type_spec == "int")
+  {
+    FunctionType *FT = FunctionType::get(Type::getInt32Ty(*TheContext), types, false);
+    F = Function::Create(FT, Function::ExternalLinkage, Symbols.str(Name), TheModule);
+  }
+  else if (Type_spec == "bool")
+  {
+    FunctionType *FT = FunctionType::get(Type::getInt1Ty(*TheContext), types, false);
+    F = Function::Create(FT, Function::ExternalLinkage, Symbols.str(Name), TheModule);
+  }
+  else if (Type_spec == "void")
+  {
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(*TheContext), types, false);
+    F = Function::Create(FT, Function::ExternalLinkage, Symbols.str(Name), TheModule);
+  }
+  else
+  {
+    return LogErrorF("Unknown function return type", Tok);
+  }
+
+  // set the names of the parameters
+  unsigned i = 0;
+  for (auto &arg : F->args())
+    arg.setName(Symbols.str(Params[i++].Name));
+  setTargetAttributes(*F);
+
+  return F;
+};
+
+// paramInfo - The names and types of a tree node's parameters
+static SmallVector<ParamInfo, 4> paramInfo(ArrayRef<VarDeclASTnode *> Params)
+{
+  SmallVector<ParamInfo, 4> Infos;
+  for (auto &i : Params)
+    Infos.push_back({i->getName(), i->getType()});
+  return Infos;
+}
+
+Function *PrototypeASTnode::codegen()
+{
+  return codegenPrototype(Name, paramInfo(Params), Type_spec, Tok);
+}
+
+static Function *codegenExtern(SymbolId Name, ArrayRef<ParamInfo> Params, StringRef Type, TOKEN Tok)
+{
+  // check the function doesnt already exist
+  if (lookupFunction(Name))
+    return LogErrorF("Function has already been defined", Tok);
+  // generate code for the extern prototype
+  return codegenPrototype(Name, Params, Type, Tok);
+};
+
+Function *ExternASTnode::codegen()
+{
+  return codegenExtern(Name, paramInfo(Params), Type, Tok);
+}
+
+Value *ExternASTnode::declare()
+{
+  if (TheModule->getNamedValue(Symbols.str(Name)))
+    return nullptr;
+  return codegenPrototype(Name, paramInfo(Params), Type, Tok);
+}
+
+// TailCallAnalyses - What LLVM's tail recursion elimination asks for, set up
+// once per code generation thread and emptied after each function.
+struct TailCallAnalyses
+{
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB;
+
+  TailCallAnalyses()
+  {
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+  }
+};
+
+// forwardReturnedLocals - Without --ssa, "x = e * f(...); ... return x;"
+// stores to x's slot and loads it back in a block that only returns it, so
+// the store, not a return, follows the call and tailcallelim leaves it alone.
+// Give each block that ends by storing to x and branching there its own
+// "return e * f(...);" instead, and drop the store, which nothing reads after
+// it any more (locals never escape their function).
+static void forwardReturnedLocals(Function &F)
+{
+  SmallVector<ReturnInst *, 4> Returns;
+  for (BasicBlock &BB : F)
+    if (auto *Ret = dyn_cast<ReturnInst>(BB.getTerminator()))
+      Returns.push_back(Ret);
+  for (ReturnInst *Ret : Returns)
+  {
+    BasicBlock *RetBB = Ret->getParent();
+    auto *Load = dyn_cast_or_null<LoadInst>(Ret->getReturnValue());
+    if (!Load || &RetBB->front() != Load || Load->getNextNode() != Ret ||
+        !isa<AllocaInst>(Load->getPointerOperand()))
+      continue;
+    SmallVector<BasicBlock *, 4> Preds(predecessors(RetBB));
+    for (BasicBlock *Pred : Preds)
+    {
+      auto *Br = dyn_cast<BranchInst>(Pred->getTerminator());
+      if (!Br || Br->isConditional())
+        continue;
+      // the last store to the slot, if nothing after it touches memory
+      StoreInst *Store = nullptr;
+      for (Instruction *I = Br->getPrevNode(); I && !Store; I = I->getPrevNode())
+      {
+        auto *S = dyn_cast<StoreInst>(I);
+        if (S && S->getPointerOperand() == Load->getPointerOperand())
+          Store = S;
+        else if (I->mayReadOrWriteMemory())
+          break;
+      }
+      if (!Store)
+        continue;
+      ReturnInst::Create(*TheContext, Store->getValueOperand(), Pred);
+      Br->eraseFromParent();
+      Store->eraseFromParent();
+    }
+    if (pred_empty(RetBB))
+      RetBB->eraseFromParent();
+  }
+}
+
+// eliminateTailRecursion - Turn the calls F makes to itself in tail position
+// into a loop, as tailcallelim does at -O1 and up: "return f(a, b);" assigns
+// a and b to the parameters and goes back to the start, and an int
+// "return e * f(...);" or "return e + f(...);" also keeps e in an accumulator
+// that every other return multiplies or adds in. Done on every function, so
+// that deep recursion runs in constant stack at -O0 too.
+static void eliminateTailRecursion(Function &F)
+{
+  if (!EliminateTailCalls || none_of(F.users(), [&](User *U) {
+        auto *Call = dyn_cast<CallInst>(U);
+        return Call && Call->getFunction() == &F;
+      }))
+    return;
+  forwardReturnedLocals(F);
+  static thread_local std::unique_ptr<TailCallAnalyses> Analyses;
+  if (!Analyses)
+    Analyses = std::make_unique<TailCallAnalyses>();
+  TailCallElimPass().run(F, Analyses->FAM);
+  Analyses->FAM.clear();
+  Analyses->MAM.clear();
+}
+
+// codegenFunDecl - GenBody generates the function's block, which ends at
+// EndTok
+static Function *codegenFunDecl(SymbolId Name, ArrayRef<ParamInfo> Params, StringRef Type_spec, function_ref<Value *()> GenBody, TOKEN Tok, TOKEN EndTok)
+{
+  Function *TheFunction = lookupFunction(Name);
+  // if the function doesnt exist, create it
+  if (!TheFunction)
+    TheFunction = codegenPrototype(Name, Params, Type_spec, Tok);
+  // check the function creaition was successful
+  if (!TheFunction)
+  {
+    return nullptr;
+  }
+  // create a new basic block to start insertion into
+  BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
+  Builder->SetInsertPoint(BB);
+  FunctionLocals.clear();
+  SSA.clear();
+  sealBlock(BB);
+
+  // create a new scope to add the parameters to
+  VariableStack.pushScope();
+
+  // create the arguments
+  if (TheFunction->arg_size() > Params.size())
+    return LogErrorF("Function definition does not match its declaration", Tok);
+  for (auto &Arg : TheFunction->args())
+  {
+    // create a local for the argument and store the argument in it
+    LocalVar *Var = newLocal(Arg.getName(), Arg.getType());
+    writeLocal(Var, &Arg);
+    // add the argument to the symbol table
+    VariableStack.bind(Params[Arg.getArgNo()].Name, Var);
+  }
+
+  // generate the body of the function
+  if (Value *RetVal = GenBody())
+  {
+    // finish off the function
+    Builder->CreateRet(RetVal);
+  }
+  // drop the block started after a final return
+  BasicBlock *Last = Builder->GetInsertBlock();
+  if (Last->empty() && Last != BB && pred_empty(Last))
+    Last->eraseFromParent();
+  else if (!Last->getTerminator())
+  {
+    // the code runs off the closing brace: a void function returns there,
+    // any other must have returned before if the end can be reached at all
+    if (TheFunction->getReturnType()->isVoidTy())
+      Builder->CreateRetVoid();
+    else if (is_contained(depth_first(BB), Last))
+      return LogErrorF("Missing return at the end of a non-void function", EndTok);
+    else
+      Builder->CreateUnreachable();
+  }
+  // validate the generated code, checking for consistency, and turn its tail
+  // recursion into a loop if it is well formed
+  if (verifyFunction(*TheFunction))
+    MalformedCode = true;
+  else
+    eliminateTailRecursion(*TheFunction);
+  // leave the function, so that a variable declared after it is a global
+  Builder->ClearInsertionPoint();
+  // return the function
+  VariableStack.popScope();
+  return TheFunction;
+};
+
+Function *FunDeclASTnode::codegen()
+{
+  return codegenFunDecl(Prototype->getName(), paramInfo(Prototype->getParams()), Prototype->getType(),
+                        [&]() { return Block->codegen(); }, Tok, EndTok);
+}
+
+// The prototype, or that of an extern before it
+Value *FunDeclASTnode::declare()
+{
+  StringRef Str = Symbols.str(getName());
+  if (Function *F = TheModule->getFunction(Str))
+    return F;
+  if (TheModule->getNamedValue(Str))
+    return nullptr;
+  return Prototype->codegen();
+}
+
+// startUnreachableBlock - Continue after a return in a new block, so that the
+// statements after it (which are still checked) do not follow a terminator
+static void startUnreachableBlock()
+{
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  Builder->SetInsertPoint(BasicBlock::Create(*TheContext, "afterret", TheFunction));
+  sealBlock(Builder->GetInsertBlock());
+}
+
+// codegenReturn - GenExpr is null for a bare "return;"
+static Value *codegenReturn(function_ref<Value *()> GenExpr, TOKEN Tok)
+{
+  // get the function
+  if (Function *TheFunction = Builder->GetInsertBlock()->getParent())
+  {
+    // get the return type of the function
+    Type *RetType = TheFunction->getReturnType();
+    if (GenExpr)
+    {
+      Value *v = GenExpr();
+      if (v->getType() != RetType)
+      { // check the actual return type matches the expected return type
+        if (v->getType() == Type::getInt32Ty(*TheContext) && RetType == Type::getFloatTy(*TheContext))
+        {
+          codegenWarning("Implicit return from int to float");
+          v = Builder->CreateSIToFP(v, Type::getFloatTy(*TheContext), "tmp");
+        }
+        else if (v->getType() == Type::getFloatTy(*TheContext) && RetType == Type::getInt32Ty(*TheContext))
+        {
+          codegenWarning("Explicit return from float to int");
+          v = Builder->CreateFPToSI(v, Type::getInt32Ty(*TheContext), "tmp");
+        }
+        else
+        {
+          return LogErrorV("Return type does not match the function definition", Tok);
+        }
+      }
+      Builder->CreateRet(v);
+      startUnreachableBlock();
+      return v;
+    }
+    else
+    { // if there is no return expression, return void
+      if (RetType == Type::getVoidTy(*TheContext))
+      {
+        Builder->CreateRetVoid();
+        startUnreachableBlock();
+        return nullptr;
+      }
+      else
+      {
+        return LogErrorV("Return type does not match the function definition", Tok);
+      }
+    }
+  }
+  else
+  {
+    return LogErrorV("Return statement outside of a function", Tok);
+  }
+};
+
+Value *ReturnASTnode::codegen()
+{
+  auto GenExpr = [&]() { return ReturnExpression->codegen(); };
+  return codegenReturn(ReturnExpression ? function_ref<Value *()>(GenExpr) : nullptr, Tok);
+}
+
+Value *ProgramASTnode::codegen()
+{
+  for (auto &i : Extern_list)
+  { // generate code for the externs
+    i->codegen();
+  }
+
+  for (auto &i : Decl_list)
+  { // generate code for the declarations
+    i->codegen();
+  }
+
+  return nullptr;
+};
+
+// Code generation for the flat layout: the same helpers as the tree nodes,
+// with children found by index: the first is First[I], the last I - 1.
+Value *FlatProgramASTnode::codegenNode(uint32_t I)
+{
+  TOKEN Tok = Toks[I];
+
+  switch (Kind[I])
+  {
+  case FlatKind::Int:
+    return ConstantInt::get(*TheContext, APInt(32, (int)Data[I], true));
+  case FlatKind::Float:
+    return ConstantFP::get(*TheContext, APFloat(BitsToFloat(Data[I])));
+  case FlatKind::Bool:
+    return ConstantInt::get(*TheContext, APInt(1, Data[I] ? 1 : 0, true));
+  case FlatKind::VarCall:
+    return codegenVarCall(Data[I], Tok);
+  case FlatKind::VarDecl:
+    return codegenVarDecl(Data[I], typeOf(I), Tok);
+  case FlatKind::Unary:
+    return codegenUnary((char)Data[I], codegenNode(First[I]), Tok);
+  case FlatKind::Binary:
+  {
+    if (BinaryOp(Data[I]) == BinaryOp::And || BinaryOp(Data[I]) == BinaryOp::Or)
+    {
+      unsigned Budget = CheapOperandNodes;
+      return codegenLogical(BinaryOp(Data[I]), [&]() { return codegenNode(First[I]); }, [&]() { return codegenNode(I - 1); },
+                            isCheapNode(I - 1, Budget), Tok);
+    }
+    Value *left = codegenNode(First[I]);
+    Value *right = codegenNode(I - 1);
+    return codegenBinary(BinaryOp(Data[I]), left, right, Tok);
+  }
+  case FlatKind::Call:
+    return codegenCall(Data[I], Count[I], [&](unsigned i) { return codegenNode(child(I, i)); }, Tok);
+  case FlatKind::Block:
+    return codegenBlock([&]() {
+      for (uint32_t Kid : children(I))
+        codegenNode(Kid);
+    });
+  case FlatKind::While:
+    return codegenWhile([&]() { return codegenNode(First[I]); }, [&]() {
+      if (Count[I] > 1)
+        codegenNode(I - 1);
+    });
+  case FlatKind::If:
+  {
+    auto GenElse = [&]() { codegenNode(I - 1); };
+    return codegenIf([&]() { return codegenNode(First[I]); }, [&]() { codegenNode(Next[First[I]]); },
+                     Count[I] > 2 ? function_ref<void()>(GenElse) : nullptr, Tok);
+  }
+  case FlatKind::Assign:
+    return codegenAssign(Data[I], codegenNode(First[I]), Tok);
+  case FlatKind::Return:
+  {
+    auto GenExpr = [&]() { return codegenNode(First[I]); };
+    return codegenReturn(Count[I] == 0 ? nullptr : function_ref<Value *()>(GenExpr), Tok);
+  }
+  case FlatKind::Extern:
+  case FlatKind::FunDecl:
+  {
+    SmallVector<ParamInfo, 4> Params;
+    for (uint32_t Kid : children(I))
+      if (Kind[Kid] == FlatKind::VarDecl)
+        Params.push_back({Data[Kid], typeOf(Kid)});
+    if (Kind[I] == FlatKind::Extern)
+      return codegenExtern(Data[I], Params, typeOf(I), Tok);
+    return codegenFunDecl(Data[I], Params, typeOf(I), [&]() { return codegenNode(I - 1); }, Tok, endOf(I));
+  }
+  case FlatKind::Program:
+    for (uint32_t Kid : children(I))
+      codegenNode(Kid);
+    return nullptr;
+  }
+  llvm_unreachable("unknown flat AST node");
+}
+
+Value *FlatProgramASTnode::codegen()
+{
+  return codegenNode(Kind.size() - 1);
+}
+
+//===----------------------------------------------------------------------===//
+// Constant folding (--fold) and dead code elimination (--dce)
+//===----------------------------------------------------------------------===//
+// One pass over the AST between parsing and code generation, linear in its
+// size. An operator whose operands are all literals is replaced by the literal
+// code generation would compute, and an operator with a literal operand is
+// simplified:
+//   x+0, x-0, x*1, x/1  b&&true, b||false, b==true, b!=false  ->  x, b
+//   true&&b, false||b  ->  b        !!b, -(-x)  ->  b, x
+//   int (x+c1)+c2, (x*c1)*c2  ->  x+(c1+c2), x*(c1*c2)
+// before which a literal on the left of + * == != or a comparison is moved to
+// the right (flipping the comparison), and an int x-c becomes x+(-c). Only
+// literals are ever dropped or moved, so every name, call and assignment is
+// still generated, checked and evaluated in order.
+//
+// Whether x+0 is x depends on the type of x, so the pass follows the types of
+// the variables and functions in scope as code generation will see them. An
+// operand of unknown type, as when its name is undeclared, is left alone.
+//
+// The same pass drops the code that can never run or that does nothing:
+//   the statements after a return, in the same block or one around it (not
+//   after an if whose branches both return, or a while (true): code
+//   generation would then leave the block after them without a terminator)
+//   the branch an if with a literal condition never takes, and the condition
+//   a while (false) loop, and a loop with an empty body whose condition is
+//   not a literal and has no effect but its value (which, as in C, may be
+//   assumed to terminate)
+//   the local declarations of names that nothing in the function refers to,
+//   and that are declared once in it
+// Code generation checks every statement, reachable or not, and stops at the
+// first error, so a statement is only dropped if folding it has found none of
+// what code generation may reject or warn about (a doubt), such as an
+// undeclared name or a mismatched type: a program that did not compile still
+// does not, and with the same message. The number of AST nodes dropped is
+// reported by --ast-stats.
+
+// FoldType - The type of an expression, as far as folding can tell
+enum class FoldType : uint8_t
+{
+  Unknown,
+  Int,
+  Float,
+  Bool,
+};
+
+static FoldType foldType(StringRef Type)
+{
+  if (Type == "int")
+    return FoldType::Int;
+  if (Type == "float")
+    return FoldType::Float;
+  if (Type == "bool")
+    return FoldType::Bool;
+  return FoldType::Unknown;
+}
+
+// Folded - An expression or statement after folding, with what folding its
+// parent needs to know about it
+template <typename NodeT>
+struct Folded
+{
+  NodeT Node;
+  FoldType Type;
+  // a literal, and its value
+  bool IsLiteral = false;
+  int IntVal = 0;
+  float FloatVal = 0;
+  bool BoolVal = false;
+  // Node is the unary operator UnaryOp applied to Operand, or the binary
+  // operator BinOp applied to Operand and the int literal RHSVal
+  char UnaryOp = 0;
+  bool HasLiteralRHS = false;
+  BinaryOp BinOp = BinaryOp::Add;
+  int RHSVal = 0;
+  NodeT Operand = NodeT();
+  FoldType OperandType = FoldType::Unknown;
+  // a return, or a block with one, after which control never reaches the
+  // next statement; a block that neither declares nor does anything
+  bool Exits = false;
+  bool Empty = false;
+
+  Folded(NodeT Node = NodeT(), FoldType Type = FoldType::Unknown) : Node(Node), Type(Type) {}
+};
+
+Folded<ASTnode *> ASTnode::fold(ASTFolder &F) { return this; }
+
+template <typename NodeT>
+static Folded<NodeT> intLiteral(int V)
+{
+  Folded<NodeT> L(NodeT(), FoldType::Int);
+  L.IsLiteral = true;
+  L.IntVal = V;
+  return L;
+}
+
+template <typename NodeT>
+static Folded<NodeT> floatLiteral(float V)
+{
+  Folded<NodeT> L(NodeT(), FoldType::Float);
+  L.IsLiteral = true;
+  L.FloatVal = V;
+  return L;
+}
+
+template <typename NodeT>
+static Folded<NodeT> boolLiteral(bool V)
+{
+  Folded<NodeT> L(NodeT(), FoldType::Bool);
+  L.IsLiteral = true;
+  L.BoolVal = V;
+  return L;
+}
+
+// the operator that gives the same result with the operands swapped, by
+// BinaryOp; the operator itself where it cannot be swapped
+static const BinaryOp SwappedBinaryOps[NumBinaryOps] = {
+    BinaryOp::Add, BinaryOp::Sub, BinaryOp::Mul, BinaryOp::Div, BinaryOp::Rem,
+    BinaryOp::Gt, BinaryOp::Lt, BinaryOp::Ge, BinaryOp::Le, BinaryOp::Eq, BinaryOp::Ne,
+    BinaryOp::And, BinaryOp::Or};
+
+static bool isSwappable(BinaryOp Op)
+{
+  return Op != BinaryOp::Sub && Op != BinaryOp::Div && Op != BinaryOp::Rem && Op != BinaryOp::And && Op != BinaryOp::Or;
+}
+
+// binaryType - The type of L Op R, as codegenBinary gives it
+static FoldType binaryType(BinaryOp Op, FoldType L, FoldType R)
+{
+  bool Compare = Op >= BinaryOp::Lt && Op <= BinaryOp::Ne;
+  bool Logical = Op == BinaryOp::And || Op == BinaryOp::Or;
+  if (L == FoldType::Bool && R == FoldType::Bool)
+    return Op == BinaryOp::Eq || Op == BinaryOp::Ne || Logical ? FoldType::Bool : FoldType::Unknown;
+  if (L == FoldType::Unknown || R == FoldType::Unknown || L == FoldType::Bool || R == FoldType::Bool || Logical)
+    return FoldType::Unknown;
+  if (Compare)
+    return FoldType::Bool;
+  return L == FoldType::Int && R == FoldType::Int ? FoldType::Int : FoldType::Float;
+}
+
+// evalBinary - The literal L Op R, as code generation would compute it;
+// false if it does not apply to L and R or is not defined for them
+template <typename NodeT>
+static bool evalBinary(BinaryOp Op, const Folded<NodeT> &L, const Folded<NodeT> &R, Folded<NodeT> &Result)
+{
+  FoldType T = binaryType(Op, L.Type, R.Type);
+  if (T == FoldType::Unknown)
+    return false;
+
+  if (L.Type == FoldType::Bool)
+  {
+    bool V = Op == BinaryOp::Eq ? L.BoolVal == R.BoolVal : Op == BinaryOp::Ne ? L.BoolVal != R.BoolVal
+                                                     : Op == BinaryOp::And  ? L.BoolVal && R.BoolVal
+                                                                            : L.BoolVal || R.BoolVal;
+    Result = boolLiteral<NodeT>(V);
+    return true;
+  }
+
+  if (L.Type == FoldType::Int && R.Type == FoldType::Int)
+  {
+    // wrapping arithmetic, as add, sub and mul; sdiv and srem are undefined
+    // when dividing by 0 and INT_MIN by -1
+    uint32_t A = L.IntVal, B = R.IntVal;
+    if ((Op == BinaryOp::Div || Op == BinaryOp::Rem) && (B == 0 || (L.IntVal == INT32_MIN && R.IntVal == -1)))
+      return false;
+    switch (Op)
+    {
+    case BinaryOp::Add: Result = intLiteral<NodeT>(int32_t(A + B)); return true;
+    case BinaryOp::Sub: Result = intLiteral<NodeT>(int32_t(A - B)); return true;
+    case BinaryOp::Mul: Result = intLiteral<NodeT>(int32_t(A * B)); return true;
+    case BinaryOp::Div: Result = intLiteral<NodeT>(L.IntVal / R.IntVal); return true;
+    case BinaryOp::Rem: Result = intLiteral<NodeT>(L.IntVal % R.IntVal); return true;
+    case BinaryOp::Lt: Result = boolLiteral<NodeT>(L.IntVal < R.IntVal); return true;
+    case BinaryOp::Gt: Result = boolLiteral<NodeT>(L.IntVal > R.IntVal); return true;
+    case BinaryOp::Le: Result = boolLiteral<NodeT>(L.IntVal <= R.IntVal); return true;
+    case BinaryOp::Ge: Result = boolLiteral<NodeT>(L.IntVal >= R.IntVal); return true;
+    case BinaryOp::Eq: Result = boolLiteral<NodeT>(L.IntVal == R.IntVal); return true;
+    case BinaryOp::Ne: Result = boolLiteral<NodeT>(L.IntVal != R.IntVal); return true;
+    default: return false;
+    }
+  }
+
+  // an int is converted to float first; the comparisons are unordered
+  auto ToAPFloat = [](const Folded<NodeT> &V) {
+    if (V.Type == FoldType::Float)
+      return APFloat(V.FloatVal);
+    APFloat F(APFloat::IEEEsingle());
+    F.convertFromAPInt(APInt(32, V.IntVal, true), true, APFloat::rmNearestTiesToEven);
+    return F;
+  };
+  APFloat A = ToAPFloat(L), B = ToAPFloat(R);
+  APFloat::cmpResult Cmp = A.compare(B);
+  bool Unordered = Cmp == APFloat::cmpUnordered;
+  switch (Op)
+  {
+  case BinaryOp::Add: A.add(B, APFloat::rmNearestTiesToEven); break;
+  case BinaryOp::Sub: A.subtract(B, APFloat::rmNearestTiesToEven); break;
+  case BinaryOp::Mul: A.multiply(B, APFloat::rmNearestTiesToEven); break;
+  case BinaryOp::Div: A.divide(B, APFloat::rmNearestTiesToEven); break;
+  case BinaryOp::Rem: A.mod(B); break;
+  case BinaryOp::Lt: Result = boolLiteral<NodeT>(Unordered || Cmp == APFloat::cmpLessThan); return true;
+  case BinaryOp::Gt: Result = boolLiteral<NodeT>(Unordered || Cmp == APFloat::cmpGreaterThan); return true;
+  case BinaryOp::Le: Result = boolLiteral<NodeT>(Cmp != APFloat::cmpGreaterThan); return true;
+  case BinaryOp::Ge: Result = boolLiteral<NodeT>(Cmp != APFloat::cmpLessThan); return true;
+  case BinaryOp::Eq: Result = boolLiteral<NodeT>(Unordered || Cmp == APFloat::cmpEqual); return true;
+  case BinaryOp::Ne: Result = boolLiteral<NodeT>(Cmp != APFloat::cmpEqual); return true;
+  default: return false;
+  }
+  Result = floatLiteral<NodeT>(A.convertToFloat());
+  return true;
+}
+
+// isRightIdentity - Whether L Op R is L, for the literal R
+template <typename NodeT>
+static bool isRightIdentity(BinaryOp Op, FoldType L, const Folded<NodeT> &R)
+{
+  if (L == FoldType::Bool && R.Type == FoldType::Bool)
+    return (Op == BinaryOp::And || Op == BinaryOp::Eq) ? R.BoolVal : (Op == BinaryOp::Or || Op == BinaryOp::Ne) && !R.BoolVal;
+  // an int operand would make the result a float
+  if (!(L == FoldType::Int && R.Type == FoldType::Int) && !(L == FoldType::Float && R.Type != FoldType::Bool))
+    return false;
+  bool IsZero = R.Type == FoldType::Int ? R.IntVal == 0 : R.FloatVal == 0 && !std::signbit(R.FloatVal);
+  bool IsOne = R.Type == FoldType::Int ? R.IntVal == 1 : R.FloatVal == 1;
+  switch (Op)
+  {
+  case BinaryOp::Add:
+    return L == FoldType::Int && IsZero; // -0.0 + 0.0 is 0.0
+  case BinaryOp::Sub:
+    return IsZero;
+  case BinaryOp::Mul:
+  case BinaryOp::Div:
+    return IsOne;
+  default:
+    return false;
+  }
+}
+
+// ASTFolder - State of the folding pass: the types of the globals, functions
+// and locals in scope, which it follows in program order as code generation
+// does
+class ASTFolder
+{
+  struct Signature
+  {
+    FoldType Result;
+    bool Void;
+    SmallVector<FoldType, 4> Params;
+  };
+  DenseMap<SymbolId, FoldType> Globals;
+  DenseMap<SymbolId, Signature> Functions;
+  // the types of each local's bindings, innermost last, and the names bound in
+  // each open scope
+  DenseMap<SymbolId, SmallVector<FoldType, 1>> Locals;
+  std::vector<SymbolId> Bound;
+  std::vector<unsigned> ScopeStarts;
+  // the function being folded: its signature, how often each name is
+  // referred to and declared in it, and its tree blocks with declarations
+  const Signature *Current = nullptr;
+  DenseMap<SymbolId, unsigned> Uses, Decls;
+  std::vector<BlockASTnode *> DeclBlocks;
+
+  bool Folding = true, Pruning = true;
+  // how many doubts have been found, and AST nodes dropped
+  unsigned Doubts = 0;
+  uint64_t Removed = 0;
+
+  void doubt() { Doubts++; }
+
+  // remove - Drop N, the last subtree built
+  template <typename Builder>
+  void remove(Builder &B, typename Builder::Node N)
+  {
+    Removed += B.size(N);
+    B.truncate(N);
+  }
+
+  // literal - Make the node of the literal V
+  template <typename Builder>
+  static typename Builder::Node literal(Builder &B, TOKEN Tok, const Folded<typename Builder::Node> &V)
+  {
+    if (V.Type == FoldType::Int)
+      return B.makeInt(Tok, V.IntVal);
+    if (V.Type == FoldType::Float)
+      return B.makeFloat(Tok, V.FloatVal);
+    return B.makeBool(Tok, V.BoolVal);
+  }
+
+  template <typename Builder>
+  static Folded<typename Builder::Node> withNode(Builder &B, TOKEN Tok, Folded<typename Builder::Node> V)
+  {
+    V.Node = literal(B, Tok, V);
+    return V;
+  }
+
+public:
+  // setPasses - Whether to fold constants and to eliminate dead code; the
+  // types are followed either way
+  void setPasses(bool Fold, bool Prune)
+  {
+    Folding = Fold;
+    Pruning = Prune;
+  }
+
+  uint64_t removedNodes() const { return Removed; }
+
+  void pushScope() { ScopeStarts.push_back(Bound.size()); }
+
+  void popScope()
+  {
+    for (; Bound.size() > ScopeStarts.back(); Bound.pop_back())
+      Locals[Bound.back()].pop_back();
+    ScopeStarts.pop_back();
+  }
+
+  // declareVar - Declare a local variable inside a function, else a global one
+  void declareVar(SymbolId Name, StringRef Type)
+  {
+    if (ScopeStarts.empty())
+    {
+      Globals.insert({Name, foldType(Type)});
+      return;
+    }
+    Locals[Name].push_back(foldType(Type));
+    Bound.push_back(Name);
+  }
+
+  // declareFunction - Declare an extern or function; as in code generation,
+  // the first declaration of a name gives its type
+  void declareFunction(SymbolId Name, StringRef Type, ArrayRef<ParamInfo> Params)
+  {
+    Signature Sig{foldType(Type), Type == "void", {}};
+    for (const ParamInfo &P : Params)
+      Sig.Params.push_back(foldType(P.Type));
+    Functions.insert({Name, Sig});
+  }
+
+  // beginFunction - Declare a function and open its scope, with its
+  // parameters typed as its first declaration has them
+  void beginFunction(SymbolId Name, StringRef Type, ArrayRef<ParamInfo> Params)
+  {
+    declareFunction(Name, Type, Params);
+    Current = &Functions.find(Name)->second;
+    Uses.clear();
+    Decls.clear();
+    DeclBlocks.clear();
+    pushScope();
+    for (unsigned i = 0; i < Params.size(); i++)
+    {
+      Decls[Params[i].Name]++;
+      if (i >= Current->Params.size())
+        continue;
+      Locals[Params[i].Name].push_back(Current->Params[i]);
+      Bound.push_back(Params[i].Name);
+    }
+  }
+
+  void endFunction()
+  {
+    popScope();
+    Current = nullptr;
+  }
+
+  // countUse, countDecl - Count a reference to Name, or a local declaration
+  // of it, in the function: as the tree nodes are folded, or all at once
+  // before a flat function body is
+  void countUse(SymbolId Name) { Uses[Name]++; }
+  void countDecl(SymbolId Name)
+  {
+    if (Current)
+      Decls[Name]++;
+  }
+
+  // dropDecl - Whether to drop a local declaration of Name (counting it as
+  // dropped): one that nothing in the function refers to, and that is its
+  // only declaration there, so that it does not clash with another
+  bool dropDecl(SymbolId Name)
+  {
+    if (!Pruning || Uses.count(Name) || Decls.lookup(Name) != 1)
+      return false;
+    Removed++;
+    return true;
+  }
+
+  // addDeclBlock - Note a tree block with declarations, whose unused ones are
+  // dropped once the whole function has been counted; takeDeclBlocks - The
+  // blocks of the function noted
+  void addDeclBlock(BlockASTnode *Block)
+  {
+    if (Pruning)
+      DeclBlocks.push_back(Block);
+  }
+  std::vector<BlockASTnode *> takeDeclBlocks() { return std::move(DeclBlocks); }
+
+  // typeOfVar - The type of the variable Name in scope; an undeclared name is
+  // a doubt
+  FoldType typeOfVar(SymbolId Name)
+  {
+    auto Local = Locals.find(Name);
+    if (Local != Locals.end() && !Local->second.empty())
+      return Local->second.back();
+    auto Global = Globals.find(Name);
+    if (Global != Globals.end())
+      return Global->second;
+    doubt();
+    return FoldType::Unknown;
+  }
+
+  // typeOfCall - The type of a call of the function Name with arguments of
+  // the types Args; an undeclared function, or arguments that do not match
+  // its parameters exactly, are a doubt
+  FoldType typeOfCall(SymbolId Name, ArrayRef<FoldType> Args)
+  {
+    auto Function = Functions.find(Name);
+    if (Function == Functions.end())
+    {
+      doubt();
+      return FoldType::Unknown;
+    }
+    if (Args != makeArrayRef(Function->second.Params) || is_contained(Args, FoldType::Unknown))
+      doubt();
+    return Function->second.Result;
+  }
+
+  // checkAssign - Doubt an assignment to Name of a value of type T that code
+  // generation would reject or convert
+  void checkAssign(SymbolId Name, FoldType T)
+  {
+    if (typeOfVar(Name) != T)
+      doubt();
+  }
+
+  // checkReturn - Doubt a return (of a value of type T, unless Bare) that
+  // code generation would reject or convert
+  void checkReturn(FoldType T, bool Bare)
+  {
+    if (!Current || (Bare ? !Current->Void : Current->Void || T == FoldType::Unknown || T != Current->Result))
+      doubt();
+  }
+
+  // foldStatement - Fold the statement GenStmt folds, and drop it if control
+  // cannot reach it and it raises no doubt
+  template <typename Builder>
+  Folded<typename Builder::Node> foldStatement(Builder &B, bool Reachable,
+                                               function_ref<Folded<typename Builder::Node>()> GenStmt)
+  {
+    unsigned Before = Doubts;
+    Folded<typename Builder::Node> S = GenStmt();
+    if (Reachable || !Pruning || !S.Node || Doubts != Before)
+      return S;
+    remove(B, S.Node);
+    return Folded<typename Builder::Node>();
+  }
+
+  // foldIf - Fold an if statement whose condition, then and else blocks are
+  // folded by GenCond, GenThen and GenElse (null if there is none) in that
+  // order; Rebuild makes the node for an if with the given parts. An if with
+  // a literal condition becomes the block it takes, if any, provided the
+  // other raises no doubt.
+  template <typename Builder>
+  Folded<typename Builder::Node> foldIf(Builder &B, function_ref<Folded<typename Builder::Node>()> GenCond,
+                                        function_ref<Folded<typename Builder::Node>()> GenThen,
+                                        function_ref<Folded<typename Builder::Node>()> GenElse,
+                                        function_ref<typename Builder::Node(typename Builder::Node, typename Builder::Node, typename Builder::Node)> Rebuild)
+  {
+    typedef Folded<typename Builder::Node> FoldedT;
+    FoldedT Cond = GenCond();
+    if (Cond.Type != FoldType::Bool)
+      doubt();
+    unsigned BeforeThen = Doubts;
+    FoldedT Then = GenThen();
+    unsigned BeforeElse = Doubts;
+    FoldedT Else = GenElse ? GenElse() : FoldedT();
+    bool Known = Pruning && Cond.IsLiteral && Cond.Type == FoldType::Bool;
+
+    // the if node itself goes as well
+    if (Known && Cond.BoolVal && Doubts == BeforeElse)
+    {
+      Removed++;
+      if (Else.Node)
+        remove(B, Else.Node);
+      Removed += B.size(Cond.Node);
+      Then.Node = B.keepOnly(Cond.Node, Then.Node);
+      return Then;
+    }
+    if (Known && !Cond.BoolVal && BeforeElse == BeforeThen)
+    {
+      Removed += 1 + B.size(Cond.Node) + B.size(Then.Node);
+      if (!Else.Node)
+      {
+        B.truncate(Cond.Node);
+        return FoldedT();
+      }
+      Else.Node = B.keepOnly(Cond.Node, Else.Node);
+      return Else;
+    }
+
+    return Rebuild(Cond.Node, Then.Node, Else.Node);
+  }
+
+  // foldWhile - Fold a while loop whose condition and body (null if there is
+  // none) are folded by GenCond and GenBody in that order; Rebuild makes the
+  // node for a while loop with the given parts
+  template <typename Builder>
+  Folded<typename Builder::Node> foldWhile(Builder &B, function_ref<Folded<typename Builder::Node>()> GenCond,
+                                           function_ref<Folded<typename Builder::Node>()> GenBody,
+                                           function_ref<typename Builder::Node(typename Builder::Node, typename Builder::Node)> Rebuild)
+  {
+    typedef Folded<typename Builder::Node> FoldedT;
+    unsigned Before = Doubts;
+    FoldedT Cond = GenCond();
+    if (Cond.Type != FoldType::Bool)
+      doubt();
+    FoldedT Body = GenBody ? GenBody() : FoldedT();
+    bool Known = Cond.IsLiteral && Cond.Type == FoldType::Bool;
+    bool Never = Known && !Cond.BoolVal;
+    bool Idle = !Known && (!Body.Node || Body.Empty) && B.isPure(Cond.Node);
+    if (Pruning && (Never || Idle) && Doubts == Before)
+    {
+      Removed += 1 + B.size(Cond.Node) + (Body.Node ? B.size(Body.Node) : 0);
+      B.truncate(Cond.Node);
+      return FoldedT();
+    }
+
+    return Rebuild(Cond.Node, Body.Node);
+  }
+
+  // foldUnary - Fold Op applied to the folded Kid; Rebuild makes the node for
+  // Op applied to a given operand
+  template <typename Builder>
+  Folded<typename Builder::Node> foldUnary(Builder &B, TOKEN Tok, char Op, const Folded<typename Builder::Node> &Kid,
+                                           function_ref<typename Builder::Node(typename Builder::Node)> Rebuild)
+  {
+    typedef Folded<typename Builder::Node> FoldedT;
+    if (Folding && Kid.IsLiteral && ((Op == '-' && Kid.Type != FoldType::Bool) || (Op == '!' && Kid.Type == FoldType::Bool)))
+    {
+      B.truncate(Kid.Node);
+      if (Kid.Type == FoldType::Int)
+        return withNode(B, Tok, intLiteral<typename Builder::Node>(int32_t(0u - uint32_t(Kid.IntVal))));
+      if (Kid.Type == FoldType::Float)
+        return withNode(B, Tok, floatLiteral<typename Builder::Node>(-Kid.FloatVal));
+      return withNode(B, Tok, boolLiteral<typename Builder::Node>(!Kid.BoolVal));
+    }
+    FoldType T = Op == '-' && (Kid.Type == FoldType::Int || Kid.Type == FoldType::Float) ? Kid.Type
+                 : Op == '!' && Kid.Type == FoldType::Bool                             ? FoldType::Bool
+                                                                                       : FoldType::Unknown;
+    if (T == FoldType::Unknown)
+      doubt();
+    // --x and !!b: the operand had the type of the result
+    if (Folding && T != FoldType::Unknown && Kid.UnaryOp == Op && Kid.OperandType == T)
+    {
+      B.keepUpTo(Kid.Operand);
+      return FoldedT(Kid.Operand, T);
+    }
+    FoldedT Result(Rebuild(Kid.Node), T);
+    Result.UnaryOp = Op;
+    Result.Operand = Kid.Node;
+    Result.OperandType = Kid.Type;
+    return Result;
+  }
+
+  // foldBinary - Fold Op applied to the operands that GenL and GenR fold, in
+  // that order; Rebuild makes the node for an operator applied to two
+  // given operands
+  template <typename Builder>
+  Folded<typename Builder::Node> foldBinary(Builder &B, TOKEN Tok, BinaryOp Op,
+                                            function_ref<Folded<typename Builder::Node>()> GenL,
+                                            function_ref<Folded<typename Builder::Node>()> GenR,
+                                            function_ref<typename Builder::Node(typename Builder::Node, typename Builder::Node, BinaryOp)> Rebuild)
+  {
+    typedef typename Builder::Node Node;
+    typedef Folded<Node> FoldedT;
+    FoldedT L = GenL();
+    // true && b and false || b evaluate b either way, so they may be b && true
+    // and b || false, which are b if it is a bool
+    bool Identity = (Op == BinaryOp::And || Op == BinaryOp::Or) && L.Type == FoldType::Bool && L.BoolVal == (Op == BinaryOp::And);
+
+    FoldedT R;
+    if (Folding && L.IsLiteral && (isSwappable(Op) || Identity))
+    {
+      // take the literal out, to put it back on the right
+      B.truncate(L.Node);
+      R = GenR();
+      if (!R.IsLiteral)
+      {
+        L.Node = literal(B, Tok, L);
+        std::swap(L, R);
+        Op = SwappedBinaryOps[unsigned(Op)];
+      }
+      else
+      {
+        B.truncate(R.Node);
+        L.Node = literal(B, Tok, L);
+        R.Node = literal(B, Tok, R);
+      }
+    }
+    else
+      R = GenR();
+
+    if (Folding && L.IsLiteral && R.IsLiteral)
+    {
+      FoldedT Result;
+      if (evalBinary(Op, L, R, Result))
+      {
+        B.truncate(L.Node);
+        return withNode(B, Tok, Result);
+      }
+    }
+    else if (Folding && R.IsLiteral)
+    {
+      // an int x-c is x+(-c)
+      if (Op == BinaryOp::Sub && L.Type == FoldType::Int && R.Type == FoldType::Int)
+      {
+        B.truncate(R.Node);
+        R = withNode(B, Tok, intLiteral<Node>(int32_t(0u - uint32_t(R.IntVal))));
+        Op = BinaryOp::Add;
+      }
+      // int (x+c1)+c2 is x+(c1+c2), and (x*c1)*c2 is x*(c1*c2)
+      if ((Op == BinaryOp::Add || Op == BinaryOp::Mul) && R.Type == FoldType::Int && L.HasLiteralRHS && L.BinOp == Op)
+      {
+        uint32_t C1 = L.RHSVal, C2 = R.IntVal;
+        B.keepUpTo(L.Operand);
+        L = FoldedT(L.Operand, FoldType::Int);
+        R = withNode(B, Tok, intLiteral<Node>(int32_t(Op == BinaryOp::Add ? C1 + C2 : C1 * C2)));
+      }
+      if (isRightIdentity(Op, L.Type, R))
+      {
+        B.truncate(R.Node);
+        return L;
+      }
+    }
+
+    FoldedT Result(Rebuild(L.Node, R.Node, Op), binaryType(Op, L.Type, R.Type));
+    if (Result.Type == FoldType::Unknown)
+      doubt();
+    if ((Op == BinaryOp::Add || Op == BinaryOp::Mul) && L.Type == FoldType::Int && R.IsLiteral && R.Type == FoldType::Int)
+    {
+      Result.HasLiteralRHS = true;
+      Result.BinOp = Op;
+      Result.RHSVal = R.IntVal;
+      Result.Operand = L.Node;
+      Result.OperandType = FoldType::Int;
+    }
+    return Result;
+  }
+};
+
+// the state of the folding pass over the program, or over each top-level
+// declaration as it comes (--stream, --pipeline)
+static ASTFolder TheFolder;
+
+// Folding the tree nodes: each node folds its children and puts the results
+// in their place.
+// mutableList - A child list in the AST arena, for the folding pass to update
+template <typename T>
+static MutableArrayRef<T> mutableList(ArrayRef<T> List)
+{
+  return MutableArrayRef<T>(const_cast<T *>(List.data()), List.size());
+}
+
+Folded<ASTnode *> IntASTnode::fold(ASTFolder &F)
+{
+  Folded<ASTnode *> L = intLiteral<ASTnode *>(Val);
+  L.Node = this;
+  return L;
+}
+
+Folded<ASTnode *> FloatASTnode::fold(ASTFolder &F)
+{
+  Folded<ASTnode *> L = floatLiteral<ASTnode *>(Val);
+  L.Node = this;
+  return L;
+}
+
+Folded<ASTnode *> BoolASTnode::fold(ASTFolder &F)
+{
+  Folded<ASTnode *> L = boolLiteral<ASTnode *>(Val);
+  L.Node = this;
+  return L;
+}
+
+Folded<ASTnode *> VarCallASTnode::fold(ASTFolder &F)
+{
+  F.countUse(Name);
+  return Folded<ASTnode *>(this, F.typeOfVar(Name));
+}
+
+Folded<ASTnode *> VarDeclASTnode::fold(ASTFolder &F)
+{
+  F.countDecl(Name);
+  F.declareVar(Name, Type);
+  return this;
+}
+
+Folded<ASTnode *> UnaryASTnode::fold(ASTFolder &F)
+{
+  TreeBuilder B;
+  return F.foldUnary(B, Tok, Op, RHS->fold(F), [&](ASTnode *Kid) -> ASTnode * {
+    RHS = Kid;
+    return this;
+  });
+}
+
+Folded<ASTnode *> BinaryASTnode::fold(ASTFolder &F)
+{
+  TreeBuilder B;
+  return F.foldBinary(
+      B, Tok, Op, [&]() { return LHS->fold(F); }, [&]() { return RHS->fold(F); },
+      [&](ASTnode *L, ASTnode *R, BinaryOp NewOp) -> ASTnode * {
+        LHS = L;
+        RHS = R;
+        Op = NewOp;
+        return this;
+      });
+}
+
+Folded<ASTnode *> FunctionCallASTnode::fold(ASTFolder &F)
+{
+  SmallVector<FoldType, 4> ArgTypes;
+  for (ASTnode *&Arg : mutableList(Args))
+  {
+    Folded<ASTnode *> A = Arg->fold(F);
+    Arg = A.Node;
+    ArgTypes.push_back(A.Type);
+  }
+  return Folded<ASTnode *>(this, F.typeOfCall(Name, ArgTypes));
+}
+
+// A dropped statement is left as a null one.
+Folded<ASTnode *> BlockASTnode::fold(ASTFolder &F)
+{
+  TreeBuilder B;
+  F.pushScope();
+  for (ASTnode *i : local_decls)
+    i->fold(F);
+  Folded<ASTnode *> Result(this);
+  Result.Empty = local_decls.empty();
+  for (ASTnode *&i : mutableList(statements))
+    if (i != nullptr)
+    {
+      Folded<ASTnode *> S = F.foldStatement(B, !Result.Exits, [&]() { return i->fold(F); });
+      i = S.Node;
+      Result.Exits |= S.Exits;
+      Result.Empty &= i == nullptr;
+    }
+  F.popScope();
+  if (!local_decls.empty())
+    F.addDeclBlock(this);
+  return Result;
+}
+
+void BlockASTnode::dropUnusedDecls(ASTFolder &F)
+{
+  MutableArrayRef<ASTnode *> Decls = mutableList(local_decls);
+  auto Kept = std::remove_if(Decls.begin(), Decls.end(), [&](ASTnode *Decl) {
+    return F.dropDecl(static_cast<VarDeclASTnode *>(Decl)->getName());
+  });
+  local_decls = local_decls.take_front(Kept - Decls.begin());
+}
+
+Folded<ASTnode *> WhileASTnode::fold(ASTFolder &F)
+{
+  TreeBuilder B;
+  auto GenBody = [&]() { return Stmt->fold(F); };
+  F.pushScope();
+  Folded<ASTnode *> Result = F.foldWhile(
+      B, [&]() { return Condition->fold(F); }, Stmt ? function_ref<Folded<ASTnode *>()>(GenBody) : nullptr,
+      [&](ASTnode *Cond, ASTnode *Body) -> ASTnode * {
+        Condition = Cond;
+        Stmt = Body;
+        return this;
+      });
+  F.popScope();
+  return Result;
+}
+
+Folded<ASTnode *> IfASTnode::fold(ASTFolder &F)
+{
+  TreeBuilder B;
+  auto GenElse = [&]() { return ElseBlock->fold(F); };
+  return F.foldIf(
+      B, [&]() { return IfCondition->fold(F); }, [&]() { return IfBlock->fold(F); },
+      ElseBlock ? function_ref<Folded<ASTnode *>()>(GenElse) : nullptr,
+      [&](ASTnode *Cond, ASTnode *Then, ASTnode *Else) -> ASTnode * {
+        IfCondition = Cond;
+        IfBlock = Then;
+        ElseBlock = Else;
+        return this;
+      });
+}
+
+Folded<ASTnode *> AssignASTnode::fold(ASTFolder &F)
+{
+  F.countUse(Name);
+  Folded<ASTnode *> Value = RHS->fold(F);
+  RHS = Value.Node;
+  F.checkAssign(Name, Value.Type);
+  return this;
+}
+
+Folded<ASTnode *> ReturnASTnode::fold(ASTFolder &F)
+{
+  Folded<ASTnode *> Value;
+  if (ReturnExpression != nullptr)
+  {
+    Value = ReturnExpression->fold(F);
+    ReturnExpression = Value.Node;
+  }
+  F.checkReturn(Value.Type, ReturnExpression == nullptr);
+  Folded<ASTnode *> Result(this);
+  Result.Exits = true;
+  return Result;
+}
+
+Folded<ASTnode *> ExternASTnode::fold(ASTFolder &F)
+{
+  F.declareFunction(Name, Type, paramInfo(Params));
+  return this;
+}
+
+Folded<ASTnode *> FunDeclASTnode::fold(ASTFolder &F)
+{
+  F.beginFunction(Prototype->getName(), Prototype->getType(), paramInfo(Prototype->getParams()));
+  if (Block != nullptr)
+    Block = Block->fold(F).Node;
+  for (BlockASTnode *B : F.takeDeclBlocks())
+    B->dropUnusedDecls(F);
+  F.endFunction();
+  return this;
+}
+
+Folded<ASTnode *> ProgramASTnode::fold(ASTFolder &F)
+{
+  for (ArrayRef<ASTnode *> List : {Extern_list, Decl_list})
+    for (ASTnode *&i : mutableList(List))
+      i = i->fold(F).Node;
+  return this;
+}
+
+// The flat layout is folded into a new one, built bottom up as the parser
+// builds it: foldNode builds the folded subtree of node I.
+Folded<FlatRef> FlatProgramASTnode::foldNode(uint32_t I, FlatBuilder &B, ASTFolder &F) const
+{
+  SmallVector<uint32_t, 8> Kids(children(I));
+  TOKEN Tok = Toks[I];
+  // the children that are left, in a list to build the node with
+  auto FoldKids = [&](ArrayRef<uint32_t> List) {
+    FlatList Result;
+    for (uint32_t Kid : List)
+      Result.push_back(foldNode(Kid, B, F).Node);
+    return Result;
+  };
+
+  switch (Kind[I])
+  {
+  case FlatKind::Int:
+  {
+    Folded<FlatRef> L = intLiteral<FlatRef>(Data[I]);
+    L.Node = B.makeInt(Tok, Data[I]);
+    return L;
+  }
+  case FlatKind::Float:
+  {
+    Folded<FlatRef> L = floatLiteral<FlatRef>(BitsToFloat(Data[I]));
+    L.Node = B.makeFloat(Tok, L.FloatVal);
+    return L;
+  }
+  case FlatKind::Bool:
+  {
+    Folded<FlatRef> L = boolLiteral<FlatRef>(Data[I]);
+    L.Node = B.makeBool(Tok, L.BoolVal);
+    return L;
+  }
+  case FlatKind::VarCall:
+    return Folded<FlatRef>(B.makeVarCall(Tok, Data[I]), F.typeOfVar(Data[I]));
+  case FlatKind::VarDecl:
+    F.declareVar(Data[I], typeOf(I));
+    return B.makeVarDecl(Tok, Data[I], typeOf(I));
+  case FlatKind::Unary:
+    return F.foldUnary(B, Tok, (char)Data[I], foldNode(Kids[0], B, F),
+                       [&](FlatRef Kid) { return B.makeUnary(Tok, (char)Data[I], Kid); });
+  case FlatKind::Binary:
+    return F.foldBinary(
+        B, Tok, BinaryOp(Data[I]), [&]() { return foldNode(Kids[0], B, F); }, [&]() { return foldNode(Kids[1], B, F); },
+        [&](FlatRef L, FlatRef R, BinaryOp Op) { return B.makeBinary(Tok, L, R, Op); });
+  case FlatKind::Call:
+  {
+    FlatList Args;
+    SmallVector<FoldType, 4> ArgTypes;
+    for (uint32_t Kid : Kids)
+    {
+      Folded<FlatRef> A = foldNode(Kid, B, F);
+      Args.push_back(A.Node);
+      ArgTypes.push_back(A.Type);
+    }
+    return Folded<FlatRef>(B.makeCall(Tok, Data[I], Args), F.typeOfCall(Data[I], ArgTypes));
+  }
+  case FlatKind::Block:
+  {
+    // the names were counted before the function body was folded, so an
+    // unused declaration need not be built at all
+    F.pushScope();
+    FlatList Decls, Stmts;
+    for (uint32_t Kid : makeArrayRef(Kids).take_front(Data[I]))
+    {
+      F.declareVar(Data[Kid], typeOf(Kid));
+      if (!F.dropDecl(Data[Kid]))
+        Decls.push_back(B.makeVarDecl(Toks[Kid], Data[Kid], typeOf(Kid)));
+    }
+    bool Exits = false;
+    for (uint32_t Kid : makeArrayRef(Kids).drop_front(Data[I]))
+    {
+      Folded<FlatRef> S = F.foldStatement(B, !Exits, [&]() { return foldNode(Kid, B, F); });
+      Stmts.push_back(S.Node);
+      Exits |= S.Exits;
+    }
+    F.popScope();
+    Folded<FlatRef> Result = B.makeBlock(Tok, Decls, Stmts, Aux[I]);
+    Result.Exits = Exits;
+    Result.Empty = Data[I] == 0 && Stmts.Count == 0;
+    return Result;
+  }
+  case FlatKind::While:
+  {
+    auto GenBody = [&]() { return foldNode(Kids[1], B, F); };
+    F.pushScope();
+    Folded<FlatRef> Result = F.foldWhile(
+        B, [&]() { return foldNode(Kids[0], B, F); }, Kids.size() > 1 ? function_ref<Folded<FlatRef>()>(GenBody) : nullptr,
+        [&](FlatRef Cond, FlatRef Body) { return B.makeWhile(Tok, Cond, Body); });
+    F.popScope();
+    return Result;
+  }
+  case FlatKind::If:
+  {
+    auto GenElse = [&]() { return foldNode(Kids[2], B, F); };
+    return F.foldIf(
+        B, [&]() { return foldNode(Kids[0], B, F); }, [&]() { return foldNode(Kids[1], B, F); },
+        Kids.size() > 2 ? function_ref<Folded<FlatRef>()>(GenElse) : nullptr,
+        [&](FlatRef Cond, FlatRef Then, FlatRef Else) { return B.makeIf(Tok, Cond, Then, Else, Aux[I]); });
+  }
+  case FlatKind::Assign:
+  {
+    Folded<FlatRef> Value = foldNode(Kids[0], B, F);
+    F.checkAssign(Data[I], Value.Type);
+    return B.makeAssign(Tok, Data[I], Value.Node);
+  }
+  case FlatKind::Return:
+  {
+    Folded<FlatRef> Value;
+    if (!Kids.empty())
+      Value = foldNode(Kids[0], B, F);
+    F.checkReturn(Value.Type, Kids.empty());
+    Folded<FlatRef> Result = B.makeReturn(Tok, Value.Node);
+    Result.Exits = true;
+    return Result;
+  }
+  case FlatKind::Extern:
+  case FlatKind::FunDecl:
+  {
+    SmallVector<ParamInfo, 4> Params;
+    FlatList ParamList;
+    for (uint32_t Kid : Kids)
+      if (Kind[Kid] == FlatKind::VarDecl)
+      {
+        Params.push_back({Data[Kid], typeOf(Kid)});
+        ParamList.push_back(B.makeParam(Toks[Kid], Data[Kid], typeOf(Kid)));
+      }
+    if (Kind[I] == FlatKind::Extern)
+    {
+      F.declareFunction(Data[I], typeOf(I), Params);
+      return B.makeExtern(Tok, typeOf(I), Data[I], ParamList);
+    }
+    F.beginFunction(Data[I], typeOf(I), Params);
+    for (uint32_t N = Start[Kids.back()]; N < Kids.back(); N++)
+      if (Kind[N] == FlatKind::VarCall || Kind[N] == FlatKind::Assign)
+        F.countUse(Data[N]);
+      else if (Kind[N] == FlatKind::VarDecl)
+        F.countDecl(Data[N]);
+    FlatRef Body = foldNode(Kids.back(), B, F).Node;
+    F.endFunction();
+    return B.makeFunDecl(Tok, endOf(I), Data[I], ParamList, typeOf(I), Body);
+  }
+  case FlatKind::Program:
+  {
+    FlatList Externs = FoldKids(makeArrayRef(Kids).take_front(Data[I]));
+    FlatList Decls = FoldKids(makeArrayRef(Kids).drop_front(Data[I]));
+    return B.makeProgram(Tok, Externs, Decls);
+  }
+  }
+  llvm_unreachable("unknown flat AST node");
+}
+
+Folded<ASTnode *> FlatProgramASTnode::fold(ASTFolder &F)
+{
+  FlatBuilder B;
+  foldNode(Kind.size() - 1, B, F);
+  return B.finish();
+}
+
+//===----------------------------------------------------------------------===//
+// AST Printer
+//===----------------------------------------------------------------------===//
+
+inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
+                                     const ASTnode &ast)
+{
+  ast.print(os);
+  return os;
+}
+
+//===----------------------------------------------------------------------===//
+// Main driver code.
+//===----------------------------------------------------------------------===//
+
+static cl::OptionCategory MCCompCategory("mccomp options");
+
+static cl::opt<std::string> InputFilename(cl::Positional, cl::Required,
+                                          cl::desc("<input file>"),
+                                          cl::cat(MCCompCategory));
+
+static cl::opt<ScanMode> LexerScan(
+    "lexer-scan", cl::desc("Scanner used for whitespace, identifier and comment runs"),
+    cl::values(clEnumValN(ScanMode::Auto, "auto", "widest vector unit the host supports (default)"),
+               clEnumValN(ScanMode::Scalar, "scalar", "one byte at a time"),
+               clEnumValN(ScanMode::SSE2, "sse2", "16 bytes at a time"),
+               clEnumValN(ScanMode::AVX2, "avx2", "32 bytes at a time")),
+    cl::init(ScanMode::Auto), cl::cat(MCCompCategory));
+
+static cl::opt<bool> LexOnly("lex-only",
+                             cl::desc("Only run the lexer and report its throughput"),
+                             cl::cat(MCCompCategory));
+
+static cl::opt<bool> PrintStats("ast-stats",
+                                cl::desc("Print AST arena and peak memory statistics to stderr"),
+                                cl::cat(MCCompCategory));
+
+static cl::opt<ASTLayout> Layout(
+    "ast-layout", cl::desc("In-memory layout of the AST"),
+    cl::values(clEnumValN(ASTLayout::Tree, "tree", "linked node objects (default)"),
+               clEnumValN(ASTLayout::Flat, "flat", "index-based structure of arrays")),
+    cl::init(ASTLayout::Tree), cl::cat(MCCompCategory));
+
+// ASTDump - What --dump-ast writes to stdout
+enum class ASTDump
+{
+  None,
+  Text, // the indented tree
+  JSON, // one JSON event per line
+};
+
+static cl::opt<ASTDump> DumpAST(
+    "dump-ast", cl::desc("Print the AST to stdout"), cl::ValueOptional,
+    cl::values(clEnumValN(ASTDump::Text, "", "as an indented tree"),
+               clEnumValN(ASTDump::Text, "text", "as an indented tree"),
+               clEnumValN(ASTDump::JSON, "json", "as a stream of JSON events, one per line")),
+    cl::init(ASTDump::None), cl::cat(MCCompCategory));
+
+static cl::opt<bool> TimePhases("time-phases",
+                                cl::desc("Print the time spent parsing, printing and generating code to stderr"),
+                                cl::cat(MCCompCategory));
+
+// PhaseTimer - Reports the wall time of one compiler phase under --time-phases
+class PhaseTimer
+{
+  const char *Name;
+  std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+
+public:
+  PhaseTimer(const char *Name) : Name(Name) {}
+  ~PhaseTimer()
+  {
+    std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+    if (TimePhases)
+      fprintf(stderr, "%-8s %.3f s\n", Name, Elapsed.count());
+  }
+};
+
+// printStats - Report the AST arena's use and the peak resident set size
+static void printStats()
+{
+  uint64_t Nodes = NumASTNodes + WorkerASTNodes;
+  size_t Bytes = MainASTArena.getBytesAllocated(), Slabs = MainASTArena.GetNumSlabs();
+  for (auto &Arena : WorkerArenas)
+  {
+    Bytes += Arena->getBytesAllocated();
+    Slabs += Arena->GetNumSlabs();
+  }
+  fprintf(stderr, "AST: %llu nodes, %zu bytes in %zu arena slabs\n", (unsigned long long)Nodes, Bytes, Slabs);
+  struct rusage Usage;
+  if (getrusage(RUSAGE_SELF, &Usage) == 0)
+    fprintf(stderr, "peak RSS: %ld KB\n", Usage.ru_maxrss);
+}
+
+static cl::opt<bool> Pipeline("pipeline",
+                              cl::desc("Lex, parse and generate code on three threads, writing out each\n"
+                                       "top-level declaration as soon as its code is generated"),
+                              cl::cat(MCCompCategory));
+
+static cl::opt<bool> ParallelParse("parallel-parse",
+                                   cl::desc("Parse the top-level declarations on a pool of threads"),
+                                   cl::cat(MCCompCategory));
+
+static cl::opt<unsigned> Jobs("jobs",
+                              cl::desc("Number of threads for --parallel-parse and the speculation of --lazy\n"
+                                       "(default: one per core)"),
+                              cl::init(0), cl::cat(MCCompCategory));
+
+static cl::opt<bool> Stream("stream",
+                            cl::desc("Generate and write out the code of each top-level declaration as\n"
+                                     "soon as it is parsed, then free its AST and function body"),
+                            cl::cat(MCCompCategory));
+
+static cl::opt<bool> FoldAST("fold", cl::init(true),
+                             cl::desc("Fold constants and simplify expressions in the AST before generating\n"
+                                      "code (default; --fold=false to turn off)"),
+                             cl::cat(MCCompCategory));
+
+static cl::opt<bool> EliminateDead("dce", cl::init(true),
+                                   cl::desc("Drop unreachable statements, dead branches and loops and unused local\n"
+                                            "declarations from the AST before generating code (default; --dce=false\n"
+                                            "to turn off)"),
+                                   cl::cat(MCCompCategory));
+
+// printDeadCodeStats - Report how much of the AST dead code elimination dropped
+static void printDeadCodeStats()
+{
+  if (EliminateDead)
+    fprintf(stderr, "dead code: %llu AST nodes removed\n", (unsigned long long)TheFolder.removedNodes());
+}
+
+static cl::opt<bool, true> SSAOpt("ssa", cl::location(DirectSSA),
+                                 cl::desc("Build SSA form for the local variables while generating code,\n"
+                                          "instead of giving each one a stack slot"),
+                                 cl::cat(MCCompCategory));
+
+static cl::opt<bool, true> TailCallOpt("tre", cl::location(EliminateTailCalls), cl::init(true),
+                                      cl::desc("Turn calls a function makes to itself in tail position, and int\n"
+                                               "returns of e * f(...) or e + f(...), into loops while generating\n"
+                                               "code (default; --tre=false to turn off)"),
+                                      cl::cat(MCCompCategory));
+
+static cl::opt<unsigned> OptLevel("O", cl::Prefix, cl::init(0),
+                                  cl::desc("Optimization level: -O0 (default), -O1, -O2 or -O3"),
+                                  cl::cat(MCCompCategory));
+
+static cl::opt<std::string> PassPipeline("passes",
+                                         cl::desc("Optimize with this pipeline, in the syntax of opt -passes=,\n"
+                                                  "instead of that of an -O level"),
+                                         cl::cat(MCCompCategory));
+
+static cl::opt<std::string> TargetTriple("target",
+                                         cl::desc("Generate code for this target triple (default: the host's)"),
+                                         cl::value_desc("triple"), cl::cat(MCCompCategory));
+
+static cl::opt<std::string> TargetCPU("mcpu",
+                                      cl::desc("Generate code for this CPU of the target, or the host's CPU\n"
+                                               "with --mcpu=native (default: a generic one)"),
+                                      cl::value_desc("cpu"), cl::cat(MCCompCategory));
+
+static cl::list<std::string> TargetAttrs("mattr", cl::CommaSeparated,
+                                         cl::desc("Turn features of the CPU on (+feature) or off (-feature),\n"
+                                                  "e.g. --mattr=+avx2,-fma"),
+                                         cl::value_desc("+a1,-a2,..."), cl::cat(MCCompCategory));
+
+// createTargetMachine - Set up TheTargetMachine for --target, --mcpu and
+// --mattr, or report why it cannot be and return false
+static bool createTargetMachine()
+{
+  InitializeAllTargetInfos();
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+
+  std::string TripleName = TargetTriple.empty() ? sys::getDefaultTargetTriple() : Triple::normalize(TargetTriple);
+  std::string Error;
+  const Target *TheTarget = TargetRegistry::lookupTarget(TripleName, Error);
+  if (!TheTarget)
+  {
+    errs() << "--target=" << TripleName << ": " << Error << "\n";
+    return false;
+  }
+
+  // --mcpu=native is the host's CPU, with the features the host has
+  std::string CPU = TargetCPU;
+  SubtargetFeatures Features;
+  if (CPU == "native")
+  {
+    CPU = sys::getHostCPUName().str();
+    StringMap<bool> HostFeatures;
+    if (sys::getHostCPUFeatures(HostFeatures))
+    {
+      std::vector<std::string> Names;
+      for (auto &Feature : HostFeatures)
+        Names.push_back((Feature.second ? "+" : "-") + Feature.first().str());
+      llvm::sort(Names);
+      for (const std::string &Name : Names)
+        Features.AddFeature(Name);
+    }
+  }
+  for (const std::string &Attr : TargetAttrs)
+    Features.AddFeature(Attr);
+  if (!CPU.empty())
+  {
+    std::unique_ptr<MCSubtargetInfo> STI(TheTarget->createMCSubtargetInfo(TripleName, "", ""));
+    if (!STI->isCPUStringValid(CPU))
+    {
+      errs() << "--mcpu=" << TargetCPU << ": " << CPU << " is not a CPU of " << TripleName << "\n";
+      return false;
+    }
+  }
+
+  static const CodeGenOpt::Level Levels[] = {CodeGenOpt::None, CodeGenOpt::Less, CodeGenOpt::Default,
+                                             CodeGenOpt::Aggressive};
+  TheTargetMachine.reset(TheTarget->createTargetMachine(TripleName, CPU, Features.getString(), TargetOptions(),
+                                                        Reloc::PIC_, None, Levels[std::min(3u, (unsigned)OptLevel)]));
+  return true;
+}
+
+// EmitKind - What --emit writes out
+enum class EmitKind
+{
+  LL,  // textual IR
+  BC,  // bitcode, with a summary index
+  Asm, // the target's assembly
+  Obj, // a relocatable object file
+};
+
+static cl::opt<EmitKind> Emit(
+    "emit", cl::desc("What to write out"),
+    cl::values(clEnumValN(EmitKind::LL, "ll", "LLVM IR as text (default)"),
+               clEnumValN(EmitKind::BC, "bc", "LLVM bitcode, with a module summary index for ThinLTO"),
+               clEnumValN(EmitKind::Asm, "asm", "assembly for the target machine"),
+               clEnumValN(EmitKind::Obj, "obj", "an object file for the target machine")),
+    cl::init(EmitKind::LL), cl::cat(MCCompCategory));
+
+static cl::opt<std::string> OutputFilename("o",
+                                           cl::desc("Write the output to this file (default: output.ll, output.bc,\n"
+                                                    "output.s or output.o, as --emit asks)"),
+                                           cl::value_desc("file"), cl::cat(MCCompCategory));
+
+// emitExtension - The extension of the file --emit writes
+static const char *emitExtension()
+{
+  switch (Emit)
+  {
+  case EmitKind::LL:
+    return "ll";
+  case EmitKind::BC:
+    return "bc";
+  case EmitKind::Asm:
+    return "s";
+  case EmitKind::Obj:
+    return "o";
+  }
+  llvm_unreachable("unknown --emit kind");
+}
+
+// outputFilename - -o, or the default file for --emit
+static std::string outputFilename()
+{
+  if (!OutputFilename.empty())
+    return OutputFilename;
+  return std::string("output.") + emitExtension();
+}
+
+// buildPipeline - Parse --passes, or build the -O level's default pipeline
+static Error buildPipeline(PassBuilder &PB, ModulePassManager &MPM)
+{
+  if (!PassPipeline.empty())
+    return PB.parsePassPipeline(MPM, PassPipeline);
+  static const OptimizationLevel Levels[] = {OptimizationLevel::O0, OptimizationLevel::O1,
+                                             OptimizationLevel::O2, OptimizationLevel::O3};
+  MPM = PB.buildPerModuleDefaultPipeline(Levels[OptLevel]);
+  return Error::success();
+}
+
+// checkGenerated - Fail if code generation left a function that does not
+// verify, whether the code is then optimized, run or written out in any form;
+// M, when the bodies are still at hand, says what is wrong with it
+static bool checkGenerated(Module *M)
+{
+  if (!MalformedCode)
+    return true;
+  if (M)
+    verifyModule(*M, &errs());
+  errs() << "Could not compile: the generated code is malformed\n";
+  return false;
+}
+
+// optimizeModule - Run the pipeline of -O or --passes over the whole module
+static bool optimizeModule(Module &M, TargetMachine &TM)
+{
+  if (OptLevel == 0 && PassPipeline.empty())
+    return true;
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(&TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  cantFail(buildPipeline(PB, MPM));
+  MPM.run(M, MAM);
+  return true;
+}
+
+// emitCode - Generate TM's object code or assembly for a well-formed module
+// into OS
+static bool emitCode(Module &M, TargetMachine &TM, raw_pwrite_stream &OS, CodeGenFileType Type)
+{
+  legacy::PassManager PM;
+  if (TM.addPassesToEmitFile(PM, OS, nullptr, Type))
+  {
+    errs() << "Could not emit code: " << TM.getTargetTriple().str() << " cannot write "
+           << (Type == CGFT_ObjectFile ? "object files" : "assembly") << "\n";
+    return false;
+  }
+  PM.run(M);
+  return true;
+}
+
+// emitModule - Write the module out as --emit asks: its IR as text or as
+// bitcode, or the target machine's assembly or object code for it, straight
+// from memory
+static bool emitModule(Module &M)
+{
+  std::error_code EC;
+  raw_fd_ostream Dest(outputFilename(), EC, sys::fs::OF_None);
+  if (EC)
+  {
+    errs() << "Could not open file: " << EC.message();
+    return false;
+  }
+  if (Emit == EmitKind::LL)
+  {
+    M.print(Dest, nullptr);
+    return true;
+  }
+  if (Emit == EmitKind::BC)
+  {
+    // The summary lets a ThinLTO link import and drop functions without
+    // reading the bodies; and as the bitcode records where each body starts,
+    // a reader can load the module lazily and materialize one function.
+    ProfileSummaryInfo PSI(M);
+    ModuleSummaryIndex Index = buildModuleSummaryIndex(M, nullptr, &PSI);
+    WriteBitcodeToFile(M, Dest, /*ShouldPreserveUseListOrder=*/false, &Index, /*GenerateHash=*/true);
+    return true;
+  }
+  return emitCode(M, *TheTargetMachine, Dest, Emit == EmitKind::Obj ? CGFT_ObjectFile : CGFT_AssemblyFile);
+}
+
+//===----------------------------------------------------------------------===//
+// Compilation cache (--cache-dir)
+//===----------------------------------------------------------------------===//
+// The cache keeps what whole compilations write out (object code, assembly,
+// bitcode or text IR, and for --run the object code and the functions' types)
+// in files named after a key, a hash of everything the output depends on: the
+// source, this build of mccomp and the LLVM it uses, the target machine and
+// the options that change the code. A compilation whose output is in the cache
+// neither parses nor generates code, but copies it out, or for --run links it
+// into the JIT. One that reports warnings is not cached, so that they are
+// reported every time.
+//
+// Any number of mccomp processes can share a cache. An entry is written to a
+// temporary file and renamed into place, so it appears whole or not at all,
+// and an entry that is read has its modification time set to now. Once a store
+// takes the cache over --cache-size, the least recently used entries are
+// removed, under the lock on the cache's lock file, which also guards the hit,
+// miss and eviction counts in its stats file. A process that has opened an
+// entry still reads it whole if another one removes it.
+
+static cl::opt<std::string> CacheDir("cache-dir",
+                                     cl::desc("Keep the output of compilations in this directory, and reuse it for\n"
+                                              "the same source, options and target"),
+                                     cl::value_desc("directory"), cl::cat(MCCompCategory));
+
+static cl::opt<unsigned> CacheSize("cache-size", cl::init(1024),
+                                   cl::desc("Largest size of the --cache-dir cache in MB (default: 1024)"),
+                                   cl::cat(MCCompCategory));
+
+static cl::opt<bool> CacheStats("cache-stats",
+                                cl::desc("Print whether the --cache-dir cache had the output, and its size and\n"
+                                         "hit, miss and eviction counts, to stderr"),
+                                cl::cat(MCCompCategory));
+
+// MCCOMP_VERSION - The version of mccomp that the cache keys its entries on,
+// which the Makefile sets to the hash of mccomp.cpp; without it the entries
+// of one mccomp could be taken for another's, so --cache-dir needs it
+#ifndef MCCOMP_VERSION
+#define MCCOMP_VERSION ""
+#endif
+
+// CompileCache - The --cache-dir cache, for this compilation's key; the
+// ObjectCache of --run's compiler
+class CompileCache : public ObjectCache
+{
+  struct Entry
+  {
+    sys::TimePoint<> Used;
+    uint64_t Size;
+    std::string Path;
+  };
+  struct Counts
+  {
+    unsigned long long Hits = 0, Misses = 0, Evictions = 0;
+  };
+
+  std::string Dir, Key;
+  const char *Outcome = "not used"; // for --cache-stats
+
+  std::string path(const Twine &Name) const { return (Dir + "/" + Name).str(); }
+
+  // locked - Run Fn with the cache's lock held; if the lock file cannot be
+  // had, the cache goes without the counts and eviction
+  void locked(function_ref<void()> Fn) const
+  {
+    int FD;
+    if (sys::fs::openFileForWrite(path("lock"), FD, sys::fs::CD_OpenAlways, sys::fs::OF_None))
+      return;
+    if (!sys::fs::lockFile(FD))
+    {
+      Fn();
+      sys::fs::unlockFile(FD);
+    }
+    sys::Process::SafelyCloseFileDescriptor(FD);
+  }
+
+  // addCounts - Add to the counts in the stats file and return them; under
+  // the lock
+  Counts addCounts(unsigned Hits, unsigned Misses, unsigned Evictions) const
+  {
+    Counts C;
+    if (auto Stats = MemoryBuffer::getFile(path("stats")))
+      sscanf((*Stats)->getBufferStart(), "%llu %llu %llu", &C.Hits, &C.Misses, &C.Evictions);
+    if (!Hits && !Misses && !Evictions)
+      return C;
+    C.Hits += Hits;
+    C.Misses += Misses;
+    C.Evictions += Evictions;
+    std::error_code EC;
+    raw_fd_ostream OS(path("stats"), EC, sys::fs::OF_None);
+    if (!EC)
+      OS << C.Hits << " " << C.Misses << " " << C.Evictions << "\n";
+    return C;
+  }
+
+  // entries - The entries and their total size; under the lock. Temporary
+  // files an hour old are those of processes that died, and are removed.
+  std::vector<Entry> entries(uint64_t &Total) const
+  {
+    std::vector<Entry> Entries;
+    Total = 0;
+    sys::TimePoint<> Stale = std::chrono::system_clock::now() - std::chrono::hours(1);
+    std::error_code EC;
+    for (sys::fs::directory_iterator I(Dir, EC), End; I != End && !EC; I.increment(EC))
+    {
+      StringRef Name = sys::path::filename(I->path());
+      auto Status = I->status();
+      if (Name == "lock" || Name == "stats" || !Status)
+        continue;
+      if (Name.startswith("tmp-"))
+      {
+        if (Status->getLastModificationTime() < Stale)
+          sys::fs::remove(I->path());
+        continue;
+      }
+      Entries.push_back({Status->getLastModificationTime(), Status->getSize(), I->path()});
+      Total += Status->getSize();
+    }
+    return Entries;
+  }
+
+  // evict - Remove the least recently used entries, other than this
+  // compilation's, until the cache is within --cache-size; under the lock
+  unsigned evict() const
+  {
+    uint64_t Total, Limit = (uint64_t)CacheSize << 20;
+    std::vector<Entry> Entries = entries(Total);
+    if (Total <= Limit)
+      return 0;
+    llvm::sort(Entries, [](const Entry &A, const Entry &B) { return A.Used < B.Used; });
+    unsigned Evicted = 0;
+    for (const Entry &E : Entries)
+    {
+      if (Total <= Limit)
+        break;
+      if (sys::path::filename(E.Path).startswith(Key) || sys::fs::remove(E.Path))
+        continue;
+      Total -= E.Size;
+      Evicted++;
+    }
+    return Evicted;
+  }
+
+public:
+  CompileCache(StringRef Dir, StringRef Key) : Dir(Dir), Key(Key) {}
+  ~CompileCache() override
+  {
+    if (!CacheStats)
+      return;
+    Counts C;
+    uint64_t Total = 0;
+    size_t Entries = 0;
+    locked([&]()
+           {
+             C = addCounts(0, 0, 0);
+             Entries = entries(Total).size();
+           });
+    fprintf(stderr, "cache: %s; %zu entries, %.1f of %u MB; %llu hits, %llu misses, %llu evictions\n", Outcome,
+            Entries, Total / 1048576.0, (unsigned)CacheSize, C.Hits, C.Misses, C.Evictions);
+  }
+
+  // lookup - This compilation's Ext file, or null if the cache does not have
+  // it
+  std::unique_ptr<MemoryBuffer> lookup(StringRef Ext)
+  {
+    std::string Path = path(Key + "." + Ext);
+    int FD;
+    std::unique_ptr<MemoryBuffer> Data;
+    if (!sys::fs::openFileForRead(Path, FD))
+    {
+      auto Buf = MemoryBuffer::getOpenFile(sys::fs::convertFDToNativeFile(FD), Path, -1, false);
+      if (Buf)
+      {
+        Data = std::move(*Buf);
+        sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+      }
+      sys::Process::SafelyCloseFileDescriptor(FD);
+    }
+    return Data;
+  }
+
+  // countLookup - Count this compilation as a hit or a miss
+  void countLookup(bool Hit)
+  {
+    Outcome = Hit ? "hit" : "miss";
+    locked([&]() { addCounts(Hit, !Hit, 0); });
+  }
+
+  // store - Keep Data as this compilation's Ext file. A cache that cannot be
+  // written to is only a cache that misses.
+  void store(StringRef Ext, StringRef Data)
+  {
+    if (NumWarnings)
+      return;
+    int FD;
+    SmallString<128> Temp;
+    if (sys::fs::createUniqueFile(path("tmp-%%%%%%%%"), FD, Temp))
+      return;
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Data;
+    OS.close();
+    if (OS.has_error() || sys::fs::rename(Temp, path(Key + "." + Ext)))
+    {
+      OS.clear_error();
+      sys::fs::remove(Temp);
+      return;
+    }
+    if (!strcmp(Outcome, "miss"))
+      Outcome = "miss, stored";
+    locked([&]() { addCounts(0, 0, evict()); });
+  }
+
+  void notifyObjectCompiled(const Module *M, MemoryBufferRef Object) override { store("o", Object.getBuffer()); }
+  std::unique_ptr<MemoryBuffer> getObject(const Module *M) override { return lookup("o"); }
+};
+
+static std::unique_ptr<CompileCache> TheCache;
+
+// openCache - Make the --cache-dir cache, for the key of this compilation
+static bool openCache()
+{
+  if (!*MCCOMP_VERSION)
+  {
+    errs() << "--cache-dir needs mccomp built with a version to key its entries on (-DMCCOMP_VERSION=...,\n"
+              "which make sets)\n";
+    return false;
+  }
+  if (std::error_code EC = sys::fs::create_directories(CacheDir))
+  {
+    errs() << "--cache-dir=" << CacheDir << ": " << EC.message() << "\n";
+    return false;
+  }
+  std::string Config;
+  raw_string_ostream(Config) << MCCOMP_VERSION << '\0' << LLVM_VERSION_STRING << '\0'
+                             << TheTargetMachine->getTargetTriple().str() << '\0' << TheTargetMachine->getTargetCPU()
+                             << '\0' << TheTargetMachine->getTargetFeatureString() << '\0' << "-O" << OptLevel
+                             << " --passes=" << PassPipeline << " --ssa=" << DirectSSA << " --fold=" << FoldAST
+                             << " --dce=" << EliminateDead << " --tre=" << EliminateTailCalls << '\0';
+  SHA1 Hasher;
+  Hasher.update(Config);
+  Hasher.update(SourceBuf->getBuffer());
+#if LLVM_VERSION_MAJOR >= 15
+  std::array<uint8_t, 20> Hash = Hasher.final();
+  TheCache = std::make_unique<CompileCache>(CacheDir, toHex(Hash, /*LowerCase=*/true));
+#else
+  TheCache = std::make_unique<CompileCache>(CacheDir, toHex(Hasher.final(), /*LowerCase=*/true));
+#endif
+  return true;
+}
+
+// writeCached - Write the output the cache had out, as emitModule would have
+static bool writeCached(MemoryBuffer &Output)
+{
+  std::error_code EC;
+  raw_fd_ostream Dest(outputFilename(), EC, sys::fs::OF_None);
+  if (EC)
+  {
+    errs() << "Could not open file: " << EC.message();
+    return false;
+  }
+  Dest << Output.getBuffer();
+  return true;
+}
+
+// lexOnly - Drain the lexer and report tokens per second (lexer benchmark).
+static int lexOnly()
+{
+  auto Start = std::chrono::steady_clock::now();
+  uint64_t NumTokens = 0;
+  while (gettok().type != EOF_TOK)
+    NumTokens++;
+  std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+
+  fprintf(stderr, "Lexed %llu tokens (%zu bytes, %s scanner) in %.3f s: %.0f tokens/s\n",
+          (unsigned long long)NumTokens, SourceBuf->getBufferSize(), Scanners->Name,
+          Elapsed.count(), NumTokens / Elapsed.count());
+  return 0;
+}
+
+//===----------------------------------------------------------------------===//
+// JIT driver (--run)
+//===----------------------------------------------------------------------===//
+// The module is compiled for the host into an object file in memory, which an
+// ORC LLJIT loads; then one of its functions is called with the arguments that
+// follow the input file, and its result printed, with no driver to build and
+// link. print_int and print_float are those of the tests' drivers, below; any
+// other extern is looked up in the C library and whatever else mccomp itself
+// is linked with.
+
+static cl::opt<std::string> RunEntry("run",
+                                     cl::desc("Compile the program in memory and call this function with the\n"
+                                              "arguments after the input file (after a -- if any is negative),\n"
+                                              "then print what it returns"),
+                                     cl::value_desc("function"), cl::cat(MCCompCategory));
+
+static cl::list<std::string> RunArgs(cl::Positional, cl::desc("[arguments for --run...]"), cl::cat(MCCompCategory));
+
+static int runtimePrintInt(int X)
+{
+  fprintf(stderr, "%d\n", X);
+  return 0;
+}
+
+static float runtimePrintFloat(float X)
+{
+  fprintf(stderr, "%f\n", X);
+  return 0;
+}
+
+// runArgument - The constant a --run argument gives a parameter of type Ty,
+// or null if it is not one; ints are decimal, as MiniC's literals are, so
+// that 010 is ten
+static Constant *runArgument(StringRef Arg, Type *Ty)
+{
+  if (Ty->isIntegerTy(1))
+  {
+    if (Arg == "true" || Arg == "1")
+      return ConstantInt::getTrue(Ty);
+    if (Arg == "false" || Arg == "0")
+      return ConstantInt::getFalse(Ty);
+    return nullptr;
+  }
+  if (Ty->isIntegerTy(32))
+  {
+    int V;
+    if (Arg.getAsInteger(10, V))
+      return nullptr;
+    return ConstantInt::get(Ty, V, true);
+  }
+  double V;
+  if (Arg.getAsDouble(V))
+    return nullptr;
+  return ConstantFP::get(Ty, V);
+}
+
+// findRunEntry - The --run function in M, if IsDefined says that the program
+// defines it; or report that it does not and return null
+static Function *findRunEntry(Module &M, function_ref<bool(const Function &)> IsDefined)
+{
+  Function *Entry = M.getFunction(RunEntry);
+  if (!Entry || !IsDefined(*Entry))
+  {
+    errs() << "--run: the program defines no function " << RunEntry << "\n";
+    return nullptr;
+  }
+  return Entry;
+}
+
+// buildRunWrapper - A module with mccomp.run, which calls Entry with the --run
+// arguments and returns what it does, a bool widened to an int (C++ cannot
+// rely on the upper bits of an i1); or report why it cannot and return null
+static std::unique_ptr<Module> buildRunWrapper(Function *Entry)
+{
+  if (Entry->arg_size() != RunArgs.size())
+  {
+    errs() << "--run: " << RunEntry << " takes " << Entry->arg_size() << " arguments, not " << RunArgs.size()
+           << "\n";
+    return nullptr;
+  }
+  SmallVector<Value *, 4> Args;
+  for (Argument &Param : Entry->args())
+  {
+    StringRef Arg = RunArgs[Param.getArgNo()];
+    Constant *C = runArgument(Arg, Param.getType());
+    if (!C)
+    {
+      errs() << "--run: " << Arg << " is not a value for " << Param.getName() << "\n";
+      return nullptr;
+    }
+    Args.push_back(C);
+  }
+
+  LLVMContext &Context = Entry->getContext();
+  auto M = std::make_unique<Module>("mccomp.run", Context);
+  setTarget(*M);
+  Function *Callee = Function::Create(Entry->getFunctionType(), Function::ExternalLinkage, Entry->getName(), *M);
+  Type *RetTy = Entry->getReturnType();
+  Type *WrapperTy = RetTy->isIntegerTy(1) ? Type::getInt32Ty(Context) : RetTy;
+  Function *Wrapper = Function::Create(FunctionType::get(WrapperTy, false), Function::ExternalLinkage, "mccomp.run", *M);
+  setTargetAttributes(*Wrapper);
+  IRBuilder<> B(BasicBlock::Create(Context, "entry", Wrapper));
+  Value *Result = B.CreateCall(Callee, Args);
+  if (RetTy->isVoidTy())
+    B.CreateRetVoid();
+  else
+    B.CreateRet(RetTy->isIntegerTy(1) ? B.CreateZExt(Result, WrapperTy) : Result);
+  return M;
+}
+
+// runTypes - Bitcode declaring the functions that M defines, with the names
+// of their parameters: what --run needs of a cached program besides its code
+static std::string runTypes(Module &M)
+{
+  Module Types("mini-c", M.getContext());
+  for (Function &F : M)
+  {
+    if (F.isDeclaration())
+      continue;
+    Function *D = Function::Create(F.getFunctionType(), Function::ExternalLinkage, F.getName(), Types);
+    for (Argument &Arg : F.args())
+      D->getArg(Arg.getArgNo())->setName(Arg.getName());
+  }
+  std::string Bitcode;
+  raw_string_ostream OS(Bitcode);
+  WriteBitcodeToFile(Types, OS);
+  return OS.str();
+}
+
+// RunningJIT - The JIT that --run calls the program in, and the lazy
+// call-through and stubs managers that --lazy adds its stubs with. Never
+// destroyed: the program's code, and under --lazy the speculation threads
+// compiling into the JIT, may still be running when mccomp exits, and tearing
+// the JIT down would only hold up the exit.
+struct RunningJIT
+{
+  std::unique_ptr<orc::LLJIT> JIT;
+  std::unique_ptr<orc::LazyCallThroughManager> CallThrough;
+  std::unique_ptr<orc::IndirectStubsManager> Stubs;
+};
+static RunningJIT &Running = *new RunningJIT;
+
+// startJIT - An LLJIT for the host, with the runtime and the symbols of the
+// host process in its main JITDylib
+static Expected<std::unique_ptr<orc::LLJIT>> startJIT()
+{
+  auto JIT = orc::LLJITBuilder()
+                 .setJITTargetMachineBuilder(orc::JITTargetMachineBuilder(TheTargetMachine->getTargetTriple()))
+                 .create();
+  if (!JIT)
+    return JIT.takeError();
+  orc::JITDylib &Main = (*JIT)->getMainJITDylib();
+  JITSymbolFlags Flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+  if (Error E = Main.define(orc::absoluteSymbols(
+          {{(*JIT)->mangleAndIntern("print_int"), JITEvaluatedSymbol(pointerToJITTargetAddress(&runtimePrintInt), Flags)},
+           {(*JIT)->mangleAndIntern("print_float"),
+            JITEvaluatedSymbol(pointerToJITTargetAddress(&runtimePrintFloat), Flags)}})))
+    return E;
+  auto Process = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*JIT)->getDataLayout().getGlobalPrefix());
+  if (!Process)
+    return Process.takeError();
+  Main.addGenerator(std::move(*Process));
+  return JIT;
+}
+
+// addModuleObject - Compile M into an object file in memory, or take it from
+// Cache if that has it (and store it there if not), and add it to JD
+static bool addModuleObject(orc::LLJIT &JIT, orc::JITDylib &JD, Module &M, ObjectCache *Cache = nullptr)
+{
+  orc::SimpleCompiler Compile(*TheTargetMachine, Cache);
+  auto Object = Compile(M);
+  if (!Object)
+  {
+    errs() << "Could not emit code: " << toString(Object.takeError()) << "\n";
+    return false;
+  }
+  if (Error E = JIT.addObjectFile(JD, std::move(*Object)))
+  {
+    errs() << "Could not run: " << toString(std::move(E)) << "\n";
+    return false;
+  }
+  return true;
+}
+
+// lookupRunWrapper - Set Address to that of mccomp.run. Linking resolves the
+// externs, and reports those that are nowhere.
+static bool lookupRunWrapper(orc::LLJIT &JIT, uint64_t &Address)
+{
+  auto Symbol = JIT.lookup("mccomp.run");
+  if (!Symbol)
+  {
+    errs() << "Could not run: " << toString(Symbol.takeError()) << "\n";
+    return false;
+  }
+#if LLVM_VERSION_MAJOR >= 15
+  Address = Symbol->getValue();
+#else
+  Address = Symbol->getAddress();
+#endif
+  return true;
+}
+
+// printRunResult - Call mccomp.run at Address and print what the --run
+// function, which returns RetTy, returned
+static void printRunResult(uint64_t Address, Type *RetTy)
+{
+  if (RetTy->isVoidTy())
+    reinterpret_cast<void (*)()>(Address)();
+  else if (RetTy->isFloatTy())
+    printf("%f\n", reinterpret_cast<float (*)()>(Address)());
+  else if (RetTy->isIntegerTy(1))
+    printf("%s\n", reinterpret_cast<int (*)()>(Address)() ? "true" : "false");
+  else
+    printf("%d\n", reinterpret_cast<int (*)()>(Address)());
+}
+
+// runWrapper - Start the JIT and add the program's code to it, as AddCode
+// does, and Wrapper's (buildRunWrapper); then call mccomp.run, print the
+// result of the --run function, which returns RetTy, and return the exit code
+static int runWrapper(function_ref<bool(orc::LLJIT &)> AddCode, Module &Wrapper, Type *RetTy)
+{
+  uint64_t Address;
+  {
+    PhaseTimer T("jit");
+    auto JIT = startJIT();
+    if (!JIT)
+    {
+      errs() << "Could not start the JIT: " << toString(JIT.takeError()) << "\n";
+      return 1;
+    }
+    if (!AddCode(**JIT) || !addModuleObject(**JIT, (*JIT)->getMainJITDylib(), Wrapper) ||
+        !lookupRunWrapper(**JIT, Address))
+      return 1;
+    Running.JIT = std::move(*JIT);
+  }
+
+  PhaseTimer T("run");
+  printRunResult(Address, RetTy);
+  return 0;
+}
+
+// runJIT - Call the --run function of the program in the main module, print
+// its result and return the exit code; Cache, if any, gets its code
+static int runJIT(CompileCache *Cache = TheCache.get())
+{
+  Function *Entry = findRunEntry(*TheModule, [](const Function &F) { return !F.isDeclaration(); });
+  std::unique_ptr<Module> Wrapper = Entry ? buildRunWrapper(Entry) : nullptr;
+  if (!Wrapper)
+    return 1;
+  return runWrapper([&](orc::LLJIT &JIT)
+                    {
+                      if (!addModuleObject(JIT, JIT.getMainJITDylib(), *TheModule, Cache))
+                        return false;
+                      if (Cache)
+                        Cache->store("sig", runTypes(*TheModule));
+                      return true;
+                    },
+                    *Wrapper, Entry->getReturnType());
+}
+
+// runCachedJIT - Call the --run function of a program that the cache has the
+// Object code and Types (runTypes) of, print its result and return the exit
+// code
+static int runCachedJIT(std::unique_ptr<MemoryBuffer> Object, MemoryBuffer &Types)
+{
+  Expected<std::unique_ptr<Module>> Declarations = parseBitcodeFile(Types.getMemBufferRef(), MainContext);
+  if (!Declarations)
+  {
+    errs() << "Could not run: the cache is corrupt: " << toString(Declarations.takeError()) << "\n";
+    return 1;
   }
+  Function *Entry = findRunEntry(**Declarations, [](const Function &) { return true; });
+  std::unique_ptr<Module> Wrapper = Entry ? buildRunWrapper(Entry) : nullptr;
+  if (!Wrapper)
+    return 1;
+  return runWrapper([&](orc::LLJIT &JIT)
+                    {
+                      if (Error E = JIT.addObjectFile(std::move(Object)))
+                      {
+                        errs() << "Could not run: " << toString(std::move(E)) << "\n";
+                        return false;
+                      }
+                      return true;
+                    },
+                    *Wrapper, Entry->getReturnType());
+}
+
+// With --lazy, the main module only declares the functions (and defines the
+// global variables and mccomp.run). Each function in the main JITDylib is a
+// lazy reexport, whose stub calls into the JIT the first time it is called to
+// materialize the function from a JITDylib of LazyFunctionUnits: its code is
+// generated from the AST, in a context and module of its own, compiled, and
+// linked in. Once a function has been
+// called, those it calls are generated and compiled ahead on the speculation
+// threads, so that they are usually ready when they are called; they are
+// linked in only then. A function's warnings and semantic errors are reported
+// when it is first called, and not at all if it never is.
+
+static cl::opt<bool> Lazy("lazy",
+                          cl::desc("With --run, generate and compile the code of each function only when\n"
+                                   "it is first called"),
+                          cl::cat(MCCompCategory));
+
+static cl::opt<bool> Speculate("speculate", cl::init(true),
+                               cl::desc("With --lazy, generate and compile the functions that a function calls\n"
+                                        "on --jobs threads once it has been called (default if there is more\n"
+                                        "than one core or --jobs is given; --speculate=false to turn off)"),
+                               cl::cat(MCCompCategory));
+
+// declareTopLevel - Declare every top-level extern, function and global
+// variable of Program in the main module, in program order, and list those
+// with a body in Bodies; or, if two of them declare one name (other than an
+// extern and then its definition), start the main module again and return
+// false.
+static bool declareTopLevel(ProgramASTnode *Program, std::vector<unsigned> &Bodies)
+{
+  TopLevelDecls.assign(Program->getExterns().begin(), Program->getExterns().end());
+  TopLevelDecls.insert(TopLevelDecls.end(), Program->getDecls().begin(), Program->getDecls().end());
+
+  SmallPtrSet<Value *, 16> Defined;
+  for (unsigned I = 0; I < TopLevelDecls.size(); I++)
+  {
+    Value *V = TopLevelDecls[I]->declare();
+    if (!V || (TopLevelDecls[I]->hasBody() && !Defined.insert(V).second))
+    {
+      MainModule = std::make_unique<Module>("mini-c", MainContext);
+      TheModule = MainModule.get();
+      setTarget(*TheModule);
+      return false;
+    }
+    FirstDeclaredAt.try_emplace(V->getName(), I);
+    if (TopLevelDecls[I]->hasBody())
+      Bodies.push_back(I);
+  }
+  return true;
+}
+
+// LazyFunction - The code of a function under --lazy
+struct LazyFunction
+{
+  unsigned Decl; // in TopLevelDecls
+  enum
+  {
+    Pending,
+    Compiling,
+    Compiled,
+    Failed,
+  } State = Pending;                    // under Lock
+  std::unique_ptr<MemoryBuffer> Object; // once Compiled, until linked in
+  std::vector<LazyFunction *> Callees;  // once Compiled
+  std::string Diags;                    // its warnings, and error if it Failed
+  std::mutex Lock;
+  std::condition_variable Done; // notified when it is Compiled or Failed
+};
+
+// the functions the program defines, under --lazy
+static StringMap<LazyFunction> LazyFunctions;
+
+static std::unique_ptr<ThreadPool> SpeculationPool;
+static thread_local bool OnSpeculationThread = false;
+static thread_local LazyFunction *CurrentLazy = nullptr;
+
+// what --lazy compiled, for --time-phases
+static std::atomic<unsigned> LazyCompiled{0}, LazySpeculated{0};
+static std::atomic<uint64_t> LazyCompileMicros{0};
 
-  // set the names of the parameters
-  unsigned i = 0;
-  for (auto &arg : F->args())
-    arg.setName(Params[i++]->getName());
+// threadTargetMachine - This thread's copy of the target machine, as threads
+// cannot share one to generate code
+static TargetMachine &threadTargetMachine()
+{
+  static thread_local std::unique_ptr<TargetMachine> TM;
+  if (!TM)
+    TM.reset(TheTargetMachine->getTarget().createTargetMachine(
+        TheTargetMachine->getTargetTriple().str(), TheTargetMachine->getTargetCPU(),
+        TheTargetMachine->getTargetFeatureString(), TheTargetMachine->Options, TheTargetMachine->getRelocationModel(),
+        TheTargetMachine->getCodeModel(), TheTargetMachine->getOptLevel()));
+  return *TM;
+}
 
-  return F;
-};
+// compileLazy - Generate and compile the code of L on this thread; or, if
+// another thread has started to, wait for it to finish (but not on a
+// speculation thread, which has better things to do)
+static void compileLazy(LazyFunction &L)
+{
+  {
+    std::unique_lock<std::mutex> Guard(L.Lock);
+    if (L.State != LazyFunction::Pending)
+    {
+      if (!OnSpeculationThread)
+        L.Done.wait(Guard, [&]() { return L.State == LazyFunction::Compiled || L.State == LazyFunction::Failed; });
+      return;
+    }
+    L.State = LazyFunction::Compiling;
+  }
+
+  std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now();
+  LLVMContext Context;
+  IRBuilder<> LazyBuilder(Context);
+  Module M("mini-c", Context);
+  setTarget(M);
+  LLVMContext *SavedContext = TheContext;
+  IRBuilder<> *SavedBuilder = Builder;
+  Module *SavedModule = TheModule;
+  TheContext = &Context;
+  Builder = &LazyBuilder;
+  TheModule = &M;
+  CurrentLazy = &L;
+  CodegenDiags = &L.Diags;
+  CurrentDecl = L.Decl;
+
+  Function *F = cast<Function>(TopLevelDecls[L.Decl]->codegen());
+  raw_string_ostream Diags(L.Diags);
+  bool Compiled = !verifyFunction(*F, &Diags);
+  if (!Compiled)
+    Diags << "Could not run: the generated code of " << F->getName() << " is malformed\n";
+  // the main module has all the declarations; only keep those used here
+  for (Function &G : make_early_inc_range(M.functions()))
+    if (G.isDeclaration() && G.use_empty())
+      G.eraseFromParent();
+  for (GlobalVariable &G : make_early_inc_range(M.globals()))
+    if (G.use_empty())
+      G.eraseFromParent();
+  for (Function &Callee : M.functions())
+  {
+    auto It = LazyFunctions.find(Callee.getName());
+    if (Callee.isDeclaration() && It != LazyFunctions.end())
+      L.Callees.push_back(&It->second);
+  }
+  SmallVector<char, 0> Object;
+  if (Compiled)
+  {
+    raw_svector_ostream OS(Object);
+    TargetMachine &TM = threadTargetMachine();
+    Compiled = optimizeModule(M, TM) && emitCode(M, TM, OS, CGFT_ObjectFile);
+  }
+
+  CodegenDiags = nullptr;
+  CurrentLazy = nullptr;
+  TheModule = SavedModule;
+  Builder = SavedBuilder;
+  TheContext = SavedContext;
+  LazyCompiled++;
+  if (OnSpeculationThread)
+    LazySpeculated++;
+  LazyCompileMicros += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - Start).count();
+  {
+    std::lock_guard<std::mutex> Guard(L.Lock);
+    L.Object = MemoryBuffer::getMemBufferCopy(StringRef(Object.data(), Object.size()), F->getName());
+    L.State = Compiled ? LazyFunction::Compiled : LazyFunction::Failed;
+  }
+  L.Done.notify_all();
+}
 
-Function *ExternASTnode::codegen()
+// abandonLazyCodegen - A semantic error has been reported into the
+// diagnostics of the function being generated for --lazy. If the function has
+// been called, that stops the run; a speculation thread cannot unwind out of
+// the code generator, so it leaves the error for a call to report and parks
+// for good.
+[[noreturn]] static void abandonLazyCodegen()
 {
-  // create the prototype
-  std::unique_ptr<PrototypeASTnode> Prototype = std::make_unique<PrototypeASTnode>(Tok, Name, std::move(Params), Type);
-  auto &P = *Prototype;
-  // check the function doesnt already exist
-  if (TheModule->getFunction(Prototype->getName()))
-    return LogErrorF("Function has already been defined", Tok);
-  // generate code for the extern prototype
-  return Prototype->codegen();
-};
+  LazyFunction &L = *CurrentLazy;
+  if (!OnSpeculationThread)
+  {
+    fputs(L.Diags.c_str(), stderr);
+    exitOnError();
+  }
+  {
+    std::lock_guard<std::mutex> Guard(L.Lock);
+    L.State = LazyFunction::Failed;
+  }
+  L.Done.notify_all();
+  parkThread();
+}
 
-Function *FunDeclASTnode::codegen()
+// speculate - Start generating and compiling the functions L calls on the
+// speculation threads
+static void speculate(LazyFunction &L)
 {
-  auto &P = *Prototype;
-  Function *TheFunction = TheModule->getFunction(Prototype->getName());
-  // if the function doesnt exist, create it
-  if (!TheFunction)
-    TheFunction = Prototype->codegen();
-  // check the function creaition was successful
-  if (!TheFunction)
+  if (!SpeculationPool)
+    return;
+  for (LazyFunction *Callee : L.Callees)
+    SpeculationPool->async([Callee]()
+                           {
+                             OnSpeculationThread = true;
+                             compileLazy(*Callee);
+                           });
+}
+
+// LazyFunctionUnit - Materializes a function for --lazy when it is first
+// called
+class LazyFunctionUnit : public orc::MaterializationUnit
+{
+  LazyFunction &L;
+  orc::ObjectLayer &Layer;
+
+public:
+  LazyFunctionUnit(orc::SymbolStringPtr Name, LazyFunction &L, orc::ObjectLayer &Layer)
+      : MaterializationUnit(
+            Interface(orc::SymbolFlagsMap{{std::move(Name), JITSymbolFlags::Exported | JITSymbolFlags::Callable}}, nullptr)),
+        L(L), Layer(Layer)
   {
-    return nullptr;
   }
-  // create a new basic block to start insertion into
-  BasicBlock *BB = BasicBlock::Create(TheContext, "entry", TheFunction);
-  Builder.SetInsertPoint(BB);
+  StringRef getName() const override { return "LazyFunctionUnit"; }
 
-  // create a new scope to add the parameters to
-  level++;
-  VariableStack[level] = std::map<std::string, AllocaInst *>(); 
+private:
+  void materialize(std::unique_ptr<orc::MaterializationResponsibility> R) override
+  {
+    compileLazy(L);
+    fputs(L.Diags.c_str(), stderr);
+    if (L.State == LazyFunction::Failed)
+      exitOnError();
+    speculate(L);
+    Layer.emit(std::move(R), std::move(L.Object));
+  }
+  void discard(const orc::JITDylib &JD, const orc::SymbolStringPtr &Name) override {}
+};
 
-  // create the arguments
-  for (auto &Arg : TheFunction->args())
+// lazyCallFailed - Where a stub goes if the function it is for could not be
+// materialized, which the JIT has reported
+static void lazyCallFailed()
+{
+  fprintf(stderr, "Could not run: a function called could not be linked\n");
+  exitOnError();
+}
+
+// runLazyJIT - Call the --run function of Program with --lazy, print its
+// result and return the exit code
+static int runLazyJIT(ProgramASTnode *Program)
+{
+  std::vector<unsigned> Bodies;
+  bool Declared;
+  {
+    PhaseTimer T("codegen");
+    Declared = declareTopLevel(Program, Bodies);
+    // two declarations of a name are left to sequential code generation
+    if (!Declared)
+      Program->codegen();
+  }
+  if (!Declared)
+    return checkGenerated(TheModule) && optimizeModule(*TheModule, *TheTargetMachine) ? runJIT(/*Cache=*/nullptr) : 1;
+  for (unsigned I : Bodies)
+    LazyFunctions[TopLevelDecls[I]->declare()->getName()].Decl = I;
+  Function *Entry =
+      findRunEntry(*TheModule, [](const Function &F) { return LazyFunctions.count(F.getName()) != 0; });
+  std::unique_ptr<Module> Wrapper = Entry ? buildRunWrapper(Entry) : nullptr;
+  if (!Wrapper)
+    return 1;
+
+  ThreadsRunning = true;
+  // on a single core, speculation would only hold up the program
+  if (Speculate && (Jobs || hardware_concurrency().compute_thread_count() > 1))
+    SpeculationPool = std::make_unique<ThreadPool>(hardware_concurrency(Jobs));
+  auto AddCode = [](orc::LLJIT &JIT)
+  {
+    const Triple &TT = TheTargetMachine->getTargetTriple();
+    orc::JITDylib &Main = JIT.getMainJITDylib();
+    auto Impl = JIT.createJITDylib("mini-c functions");
+    auto CallThrough = orc::createLocalLazyCallThroughManager(TT, JIT.getExecutionSession(),
+                                                              pointerToJITTargetAddress(&lazyCallFailed));
+    if (!Impl || !CallThrough)
+    {
+      errs() << "Could not start the JIT: " << toString(Impl ? CallThrough.takeError() : Impl.takeError()) << "\n";
+      return false;
+    }
+    // the code of the functions calls the others through their stubs
+    Impl->setLinkOrder({{&Main, orc::JITDylibLookupFlags::MatchAllSymbols}}, false);
+    // A reexport unit of its own for each function: the first call into a
+    // unit of several takes the stub it needs and defines the rest again.
+    std::unique_ptr<orc::IndirectStubsManager> Stubs = orc::createLocalIndirectStubsManagerBuilder(TT)();
+    JITSymbolFlags Flags = JITSymbolFlags::Exported | JITSymbolFlags::Callable;
+    for (auto &Entry : LazyFunctions)
+    {
+      orc::SymbolStringPtr Name = JIT.mangleAndIntern(Entry.getKey());
+      cantFail(Impl->define(std::make_unique<LazyFunctionUnit>(Name, Entry.second, JIT.getObjLinkingLayer())));
+      cantFail(Main.define(orc::lazyReexports(**CallThrough, *Stubs, *Impl, {{Name, {Name, Flags}}})));
+    }
+    Running.CallThrough = std::move(*CallThrough);
+    Running.Stubs = std::move(Stubs);
+    // the global variables, which the main module defines
+    return addModuleObject(JIT, Main, *TheModule);
+  };
+  if (int Status = runWrapper(AddCode, *Wrapper, Entry->getReturnType()))
+    return Status;
+  if (TimePhases)
+    fprintf(stderr, "lazy: %u of %u functions compiled (%u on speculation threads) in %.3f s\n",
+            LazyCompiled.load(), LazyFunctions.size(), LazySpeculated.load(), LazyCompileMicros / 1e6);
+  // The speculation threads may still be compiling functions that are never
+  // called, or be parked; leave without them, as exitOnError does.
+  TheCache.reset();
+  fflush(stdout);
+  fflush(stderr);
+  _Exit(0);
+}
+
+//===----------------------------------------------------------------------===//
+// Pipelined driver (--pipeline)
+//===----------------------------------------------------------------------===//
+// The lexer thread fills LexerRing, the main thread parses from it and hands
+// each finished top-level declaration to the code generator thread, which
+// prints its AST and IR straight away. The output is the same as in the
+// sequential mode.
+
+// DeclQueue - Top-level declarations on their way from the parser to the code
+// generator; nullptr marks the end of the program.
+class DeclQueue
+{
+  std::mutex Lock;
+  std::condition_variable NotEmpty;
+  std::deque<ASTnode *> Decls;
+
+public:
+  void push(ASTnode *Decl)
   {
-    // create an alloca for the argument
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName(), Arg.getType());
-    // store the argument in the alloca
-    Builder.CreateStore(&Arg, Alloca);
-    // add the argument to the symbol table
-    VariableStack[level][std::string(Arg.getName())] = Alloca;
+    {
+      std::lock_guard<std::mutex> Guard(Lock);
+      Decls.push_back(Decl);
+    }
+    NotEmpty.notify_one();
   }
 
-  // generate the body of the function
-  if (Value *RetVal = Block->codegen())
+  ASTnode *pop()
   {
-    // finish off the function
-    Builder.CreateRet(RetVal);
+    std::unique_lock<std::mutex> Guard(Lock);
+    NotEmpty.wait(Guard, [this]() { return !Decls.empty(); });
+    ASTnode *Decl = Decls.front();
+    Decls.pop_front();
+    return Decl;
   }
-  // validate the generated code, checking for consistency
-  verifyFunction(*TheFunction);
-  // return the function
-  VariableStack[level].clear();
-  level--;
-  return TheFunction;
 };
 
-Value *ReturnASTnode::codegen()
+// IRStreamer - Writes the module to a .ll file one global or function at a
+// time, in the same format as Module::print. With DropBodies (--stream) each
+// function is removed from the module once it has been written out (see
+// RetiredFunctions), so the module only keeps globals and externs.
+class IRStreamer
 {
-  // get the function
-  if (Function *TheFunction = Builder.GetInsertBlock()->getParent())
+  std::string Filename;
+  bool DropBodies;
+  std::unique_ptr<raw_fd_ostream> OS;
+  // GlobalValue::print looks through the whole module for types and comdats
+  // first, which would make writing one declaration at a time quadratic; so
+  // each one is printed while it sits alone in this module.
+  std::unique_ptr<Module> Alone;
+  bool InGlobals = false;
+  bool SeenFunction = false;
+  // Module::print puts globals before functions, so externs are held back
+  // until the first function body and globals declared after them still go
+  // first. A global after a body, or a body for a function already written out
+  // as a declaration, means the file has to be rewritten at the end - or,
+  // without the bodies to rewrite it from, that the global goes where it is
+  // and the old declaration is commented out.
+  std::vector<Function *> PendingExterns;
+  DenseMap<const Function *, uint64_t> DeclaredAt; // file offsets
+  bool Stale = false;
+  // A function printed alone refers to its attributes as group #0, which only
+  // Module::print writes out; every function has the same ones (the target
+  // CPU and features), so the group is written once at the end.
+  AttributeSet FnAttrs;
+
+public:
+  IRStreamer(StringRef Filename, bool DropBodies) : Filename(Filename.str()), DropBodies(DropBodies) {}
+
+  // open - Start the file with the header of the (still empty) module
+  bool open(std::error_code &EC)
   {
-    // get the return type of the function
-    Type *RetType = TheFunction->getReturnType();
-    if (ReturnExpression != nullptr)
+    OS = std::make_unique<raw_fd_ostream>(Filename, EC, sys::fs::OF_None);
+    if (EC)
+      return false;
+    TheModule->print(*OS, nullptr);
+    Alone = std::make_unique<Module>("mini-c", *TheContext);
+    return true;
+  }
+
+  template <typename T> void printAlone(T &GV, SymbolTableList<T> &From, SymbolTableList<T> &To)
+  {
+    auto Next = std::next(GV.getIterator());
+    To.splice(To.end(), From, GV.getIterator());
+    GV.print(*OS);
+    From.splice(Next, To, GV.getIterator());
+  }
+
+  // emit - Write out what the code generation of a top-level declaration made
+  void emit(Value *V)
+  {
+    if (auto *G = dyn_cast_or_null<GlobalVariable>(V))
     {
-      Value *v = ReturnExpression->codegen();
-      if (v->getType() != RetType)
-      { // check the actual return type matches the expected return type
-        if (v->getType() == Type::getInt32Ty(TheContext) && RetType == Type::getFloatTy(TheContext))
-        {
-          fprintf(stderr, "WARNING: Implicit return from int to float\n");
-          v = Builder.CreateSIToFP(v, Type::getFloatTy(TheContext), "tmp");
-        }
-        else if (v->getType() == Type::getFloatTy(TheContext) && RetType == Type::getInt32Ty(TheContext))
-        {
-          fprintf(stderr, "WARNING: Explicit return from float to int\n");
-          v = Builder.CreateFPToSI(v, Type::getInt32Ty(TheContext), "tmp");
-        }
-        else
-        {
-          return LogErrorV("Return type does not match the function definition", Tok);
-        }
-      }
-      Builder.CreateRet(v);
-      return v;
+      if (SeenFunction && !DropBodies)
+        Stale = true;
+      if (!InGlobals)
+        *OS << "\n";
+      InGlobals = true;
+      printAlone(*G, TheModule->getGlobalList(), Alone->getGlobalList());
+      *OS << "\n";
     }
-    else
-    { // if there is no return expression, return void
-      if (RetType == Type::getVoidTy(TheContext))
+    else if (auto *F = dyn_cast_or_null<Function>(V))
+    {
+      if (F->isDeclaration())
       {
-        Builder.CreateRetVoid();
-        return nullptr;
+        PendingExterns.push_back(F);
+        return;
       }
-      else
+      // a body for a held back extern is written in the extern's place
+      bool WasPending = is_contained(PendingExterns, F);
+      flushExterns();
+      if (WasPending)
+        return;
+      auto Declared = DeclaredAt.find(F);
+      if (Declared != DeclaredAt.end())
       {
-        return LogErrorV("Return type does not match the function definition", Tok);
+        if (DropBodies)
+          commentOut(Declared->second);
+        else
+          Stale = true;
       }
+      writeFunction(*F);
     }
   }
-  else
+
+  void writeFunction(Function &F)
   {
-    return LogErrorV("Return statement outside of a function", Tok);
+    InGlobals = false;
+    SeenFunction = true;
+    if (F.isDeclaration())
+      DeclaredAt[&F] = OS->tell();
+    FnAttrs = F.getAttributes().getFnAttrs();
+    *OS << "\n";
+    printAlone(F, TheModule->getFunctionList(), Alone->getFunctionList());
+    if (DropBodies && !F.isDeclaration())
+      retire(F);
   }
-};
 
-Value *ProgramASTnode::codegen()
-{
-  VariableStack[0] = std::map<std::string, AllocaInst *>(); // create the first level of the variable map
-  for (auto &i : Extern_list)
-  { // generate code for the externs
-    i->codegen();
+  // retire - Remove a function that has been written out from the module,
+  // along with the declarations its body called that were retired before.
+  void retire(Function &F)
+  {
+    RetiredFunctions[F.getName()] = F.getFunctionType();
+    DeclaredAt.erase(&F);
+    F.deleteBody();
+    for (Function &G : make_early_inc_range(TheModule->functions()))
+      if (G.isDeclaration() && G.use_empty() && RetiredFunctions.count(G.getName()))
+        G.eraseFromParent();
   }
 
-  for (auto &i : Decl_list)
-  { // generate code for the declarations
-    i->codegen();
+  void flushExterns()
+  {
+    for (Function *F : PendingExterns)
+      writeFunction(*F);
+    PendingExterns.clear();
   }
 
-  return nullptr;
+  // commentOut - Turn the blank line in front of a declaration written at
+  // Offset into a ';', making the declaration a comment.
+  void commentOut(uint64_t Offset)
+  {
+    uint64_t End = OS->tell();
+    OS->seek(Offset);
+    *OS << ";";
+    OS->seek(End);
+  }
+
+  // finish - Rewrite the file from the module if something written earlier
+  // has changed since.
+  void finish()
+  {
+    flushExterns();
+    if (FnAttrs.hasAttributes())
+      *OS << "\nattributes #0 = { " << FnAttrs.getAsString(true) << " }\n";
+    OS->close();
+    if (!Stale)
+      return;
+    std::error_code EC;
+    OS = std::make_unique<raw_fd_ostream>(Filename, EC, sys::fs::OF_None);
+    TheModule->print(*OS, nullptr);
+    OS->close();
+  }
 };
 
-//===----------------------------------------------------------------------===//
-// AST Printer
-//===----------------------------------------------------------------------===//
+// dumpAST - Print a whole program as --dump-ast asks
+static void dumpAST(const ASTnode &Program)
+{
+  if (DumpAST == ASTDump::JSON)
+    Program.printJSON(llvm::outs());
+  else
+    llvm::outs() << Program << "\n";
+}
 
-inline llvm::raw_ostream &operator<<(llvm::raw_ostream &os,
-                                     const ASTnode &ast)
+// beginProgram, compileTopLevelDecl, endProgram - Print the AST and generate
+// and write out the code of a program one top-level declaration at a time.
+static void beginProgram()
 {
-  os << ast.to_string();
-  return os;
+  if (DumpAST == ASTDump::Text)
+    llvm::outs() << "Program: ";
+  else if (DumpAST == ASTDump::JSON)
+    ASTEvent(llvm::outs(), "begin", "Program");
+}
+
+static void compileTopLevelDecl(ASTnode *Decl, IRStreamer &IR)
+{
+  if (DumpAST == ASTDump::Text)
+    llvm::outs() << "\n|____" << *Decl << " ";
+  else if (DumpAST == ASTDump::JSON)
+    Decl->printJSON(llvm::outs());
+  if (FoldAST || EliminateDead)
+    Decl = Decl->fold(TheFolder).Node;
+  IR.emit(Decl->codegen());
+}
+
+static void endProgram(IRStreamer &IR)
+{
+  if (DumpAST == ASTDump::Text)
+    llvm::outs() << "\n|EOF\n";
+  else if (DumpAST == ASTDump::JSON)
+    ASTEvent(llvm::outs(), "end", "Program");
+  IR.finish();
+}
+
+// codegenThread - Print and generate code for each top-level declaration
+static void codegenThread(DeclQueue &Decls, IRStreamer &IR)
+{
+  TheModule = MainModule.get();
+  beginProgram();
+  while (ASTnode *Decl = Decls.pop())
+    compileTopLevelDecl(Decl, IR);
+  endProgram(IR);
+}
+
+static int runPipeline()
+{
+  IRStreamer IR(outputFilename(), /*DropBodies=*/false);
+  std::error_code EC;
+  if (!IR.open(EC))
+  {
+    errs() << "Could not open file: " << EC.message();
+    return 1;
+  }
+
+  fprintf(stderr, DumpAST != ASTDump::None ? "BEGIN PIPELINED PARSING, PRINTING AND CODE GENERATION\n"
+                                            : "BEGIN PIPELINED PARSING AND CODE GENERATION\n");
+  {
+    PhaseTimer T("pipeline");
+    auto Ring = std::make_unique<TokenRing>();
+    DeclQueue Decls;
+    LexerRing = Ring.get();
+    ThreadsRunning = true;
+    std::thread Lexer(lexerThread, saveLexer());
+    std::thread Codegen(codegenThread, std::ref(Decls), std::ref(IR));
+
+    getNextToken();
+    parser(ASTLayout::Tree, [&](ASTnode *Decl) { Decls.push(Decl); });
+    Decls.push(nullptr);
+
+    Lexer.join();
+    Codegen.join();
+    ThreadsRunning = false;
+    LexerRing = nullptr;
+  }
+  fprintf(stderr, "PIPELINE FINISHED\n");
+  if (PrintStats)
+  {
+    printStats();
+    printDeadCodeStats();
+  }
+  printf("\n");
+  return checkGenerated(nullptr) ? 0 : 1;
 }
 
 //===----------------------------------------------------------------------===//
-// Main driver code.
+// Streaming driver (--stream)
 //===----------------------------------------------------------------------===//
+// Each top-level declaration is printed, code-generated and written out as
+// soon as it is parsed, then its AST (the whole arena), its function and the
+// source it came from are freed. Memory then stays bounded by the largest
+// single declaration rather than by the whole program.
 
-int main(int argc, char **argv)
+static int runStreaming()
 {
-  if (argc == 2)
+  IRStreamer IR(outputFilename(), /*DropBodies=*/true);
+  std::error_code EC;
+  if (!IR.open(EC))
   {
-    pFile = fopen(argv[1], "r");
-    if (pFile == NULL)
-      perror("Error opening file");
+    errs() << "Could not open file: " << EC.message();
+    return 1;
   }
-  else
+
+  Symbols.copyStrings();
+  fprintf(stderr, DumpAST != ASTDump::None ? "BEGIN STREAMING PARSING, PRINTING AND CODE GENERATION\n"
+                                            : "BEGIN STREAMING PARSING AND CODE GENERATION\n");
   {
-    std::cout << "Usage: ./code InputFile\n";
-    return 1;
+    PhaseTimer T("stream");
+    beginProgram();
+    getNextToken();
+    parser(ASTLayout::Tree, [&](ASTnode *Decl)
+           {
+             compileTopLevelDecl(Decl, IR);
+             // nothing else the parser holds points into the arena
+             ASTArena->Reset();
+             releaseSource(CurPtr);
+           });
+    endProgram(IR);
+  }
+  fprintf(stderr, "STREAMING FINISHED\n");
+  if (PrintStats)
+  {
+    printStats();
+    printDeadCodeStats();
   }
+  printf("\n");
+  return checkGenerated(nullptr) ? 0 : 1;
+}
 
-  // initialize line number and column numbers to zero
-  lineNo = 1;
-  columnNo = 1;
+int main(int argc, char **argv)
+{
+  cl::HideUnrelatedOptions(MCCompCategory);
+  cl::ParseCommandLineOptions(argc, argv, "MiniC compiler\n");
+  TheFolder.setPasses(FoldAST, EliminateDead);
+
+  if (!openSource(InputFilename))
+    return 1;
+
+  // intern the fixed spellings and start at line 1, column 1
+  initLexer(LexerScan);
+
+  if (LexOnly)
+    return lexOnly();
+
+  // Make the module, which holds all the code, for the target machine.
+  if (!createTargetMachine())
+    return 1;
+  MainModule = std::make_unique<Module>("mini-c", MainContext);
+  TheModule = MainModule.get();
+  setTarget(*TheModule);
 
-  // Make the module, which holds all the code.
-  TheModule = std::make_unique<Module>("mini-c", TheContext);
+  if (Pipeline + Stream + ParallelParse > 1)
+  {
+    errs() << "only one of --pipeline, --stream and --parallel-parse can be used\n";
+    return 1;
+  }
+  if (ParallelParse && Layout == ASTLayout::Flat)
+  {
+    errs() << "--parallel-parse needs --ast-layout=tree\n";
+    return 1;
+  }
+  if (OptLevel > 3)
+  {
+    errs() << "-O" << OptLevel << " is not an optimization level: use -O0 to -O3\n";
+    return 1;
+  }
+  if (!PassPipeline.empty())
+  {
+    if (OptLevel != 0)
+    {
+      errs() << "--passes cannot be used with -O1, -O2 or -O3\n";
+      return 1;
+    }
+    PassBuilder PB;
+    ModulePassManager MPM;
+    if (Error E = buildPipeline(PB, MPM))
+    {
+      errs() << "invalid --passes pipeline: " << toString(std::move(E)) << "\n";
+      return 1;
+    }
+  }
+  if ((OptLevel != 0 || !PassPipeline.empty()) && (Pipeline || Stream))
+  {
+    errs() << "-O and --passes optimize the whole module, so cannot be used with --pipeline or --stream\n";
+    return 1;
+  }
+  if (!RunEntry.empty() && (Pipeline || Stream))
+  {
+    errs() << "--run needs the whole module, so cannot be used with --pipeline or --stream\n";
+    return 1;
+  }
+  if (!RunEntry.empty() && (Emit.getNumOccurrences() || !OutputFilename.empty()))
+  {
+    errs() << "--run writes no file, so cannot be used with -o or --emit\n";
+    return 1;
+  }
+  if (!RunEntry.empty())
+  {
+    const Triple &TT = TheTargetMachine->getTargetTriple();
+    Triple Host(sys::getProcessTriple());
+    if (TT.getArch() != Host.getArch() || TT.getOS() != Host.getOS())
+    {
+      errs() << "--run runs the code on this machine, so cannot be used with --target=" << TT.str() << "\n";
+      return 1;
+    }
+  }
+  if (Lazy && RunEntry.empty())
+  {
+    errs() << "--lazy needs --run\n";
+    return 1;
+  }
+  if (Lazy && Layout == ASTLayout::Flat)
+  {
+    errs() << "--lazy generates the code of each function when it is called, so needs --ast-layout=tree\n";
+    return 1;
+  }
+  if (RunEntry.empty() && !RunArgs.empty())
+  {
+    errs() << "only --run takes arguments after the input file\n";
+    return 1;
+  }
+  if (!CacheDir.empty() && (Pipeline || Stream))
+  {
+    errs() << "--cache-dir caches whole modules, so cannot be used with --pipeline or --stream\n";
+    return 1;
+  }
+  if (Emit != EmitKind::LL && (Pipeline || Stream))
+  {
+    errs() << "--emit=bc, --emit=asm and --emit=obj write the whole module at once, so cannot be used with\n"
+              "--pipeline or --stream\n";
+    return 1;
+  }
+  // Output from the cache needs neither parsing nor code generation; the
+  // AST dump and statistics do. --lazy compiles one function at a time, so
+  // neither looks up nor stores a whole module.
+  if (!CacheDir.empty())
+  {
+    if (!openCache())
+      return 1;
+    std::unique_ptr<MemoryBuffer> Output, Types;
+    if (DumpAST == ASTDump::None && !PrintStats && !Lazy)
+    {
+      if (RunEntry.empty())
+        Output = TheCache->lookup(emitExtension());
+      else if ((Types = TheCache->lookup("sig")))
+        Output = TheCache->lookup("o");
+    }
+    if (!Lazy)
+      TheCache->countLookup(Output != nullptr);
+    if (Output && !RunEntry.empty())
+      return runCachedJIT(std::move(Output), *Types);
+    if (Output)
+    {
+      printf("\n");
+      return writeCached(*Output) ? 0 : 1;
+    }
+  }
+  if (Pipeline)
+  {
+    if (Layout == ASTLayout::Flat)
+    {
+      errs() << "--pipeline needs --ast-layout=tree\n";
+      return 1;
+    }
+    return runPipeline();
+  }
+  if (Stream)
+  {
+    if (Layout == ASTLayout::Flat)
+    {
+      errs() << "--stream needs --ast-layout=tree\n";
+      return 1;
+    }
+    return runStreaming();
+  }
 
   // Run the parser now.
   getNextToken();
   fprintf(stderr, "BEGIN PARSING\n");
-  std::unique_ptr<ASTnode> program = parser();
-  fprintf(stderr, "PARSING FINISHED\nBEGIN PRINTING\n\n");
-  llvm::outs() << *program << "\n";
-  fprintf(stderr, "\nPRINTING FINISHED\nBEGIN CODE GENERATION\n");
-  Value *v = program->codegen();
-  fprintf(stderr, "CODE GENERATION FINISHED\n");
-
-  //********************* Start printing final IR **************************
-  // Print out all of the generated code into a file called output.ll
-  auto Filename = "output.ll";
-  std::error_code EC;
-  raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
-
-  if (EC)
+  ASTnode *program;
   {
-    errs() << "Could not open file: " << EC.message();
+    PhaseTimer T("parse");
+    program = ParallelParse ? parseParallel(Jobs) : nullptr;
+    if (!program)
+      program = parser(Layout);
+  }
+  fprintf(stderr, "PARSING FINISHED\n");
+  if (PrintStats)
+    printStats();
+  if (DumpAST != ASTDump::None)
+  {
+    fprintf(stderr, "BEGIN PRINTING\n\n");
+    {
+      PhaseTimer T("print");
+      dumpAST(*program);
+      llvm::outs().flush();
+    }
+    fprintf(stderr, "\nPRINTING FINISHED\n");
+  }
+  if (FoldAST || EliminateDead)
+  {
+    PhaseTimer T("fold");
+    program = program->fold(TheFolder).Node;
+  }
+  if (PrintStats)
+    printDeadCodeStats();
+  if (Lazy)
+    return runLazyJIT(static_cast<ProgramASTnode *>(program));
+  fprintf(stderr, "BEGIN CODE GENERATION\n");
+  {
+    PhaseTimer T("codegen");
+    program->codegen();
+  }
+  fprintf(stderr, "CODE GENERATION FINISHED\n");
+  if (!checkGenerated(TheModule))
     return 1;
+  {
+    PhaseTimer T("optimize");
+    if (!optimizeModule(*TheModule, *TheTargetMachine))
+      return 1;
   }
+  if (!RunEntry.empty())
+    return runJIT();
+
+  //********************* Start printing final IR **************************
+  // Write out all of the generated code into output.ll, or as -o and --emit
+  // ask
   printf("\n");
   // TheModule->print(errs(), nullptr); // print IR to terminal
-  TheModule->print(dest, nullptr);
+  {
+    PhaseTimer T("emit");
+    if (!emitModule(*TheModule))
+      return 1;
+  }
+  if (TheCache)
+    if (auto Output = MemoryBuffer::getFile(outputFilename()))
+      TheCache->store(emitExtension(), (*Output)->getBuffer());
   //********************* End printing final IR ****************************
-
-  fclose(pFile); // close the file that contains the code that was parsed
   return 0;
 }
@@ -0,0 +1,24 @@
+#!/bin/bash
+# AST layout benchmark: compiles a large generated MiniC file with each
+# --ast-layout and reports the time spent parsing, printing and generating
+# code.
+#
+# Usage: ./tests/bench/ast.sh [path/to/mccomp] [number of functions] [mccomp flags...]
+#   e.g. ./tests/bench/ast.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_astbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+for layout in tree flat; do
+  echo "--ast-layout=$layout"
+  for run in 1 2 3; do
+    "$COMP" --ast-layout=$layout --dump-ast --time-phases "${@:3}" input.c 2>&1 >/dev/null | grep -E "^(parse|print|codegen) " | tr '\n' ' '
+    echo
+  done
+done
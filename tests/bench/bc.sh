@@ -0,0 +1,35 @@
+#!/bin/bash
+# Bitcode benchmark: writes a large generated MiniC program as text IR and as
+# bitcode, and reports the time mccomp takes to write each out, the file size,
+# the time opt takes to read and verify the whole module, and the time
+# llvm-extract takes to pull one function out of it (which, from bitcode,
+# loads the module lazily and materializes that function alone).
+#
+# Usage: ./tests/bench/bc.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/bc.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_bcbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+TIMEFORMAT='%R s'
+for emit in ll bc; do
+  echo "--emit=$emit"
+  for run in 1 2 3; do
+    "$COMP" --time-phases --emit=$emit input.c 2>&1 >/dev/null | grep -E '^emit'
+  done
+  echo "size $(wc -c < output.$emit) bytes"
+  echo "read whole module"
+  for run in 1 2 3; do
+    time opt -passes=verify -disable-output output.$emit
+  done
+  echo "extract one function"
+  for run in 1 2 3; do
+    time llvm-extract --func=function_number_$((FUNCS / 2)) -o /dev/null output.$emit
+  done
+done
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Compilation cache benchmark: compiles a generated MiniC file to an object
+# file with --emit=obj, and runs one of its functions with --run, first into
+# an empty --cache-dir (a miss, which compiles and stores) and then again from
+# it (a hit, which reads the object back without parsing or code generation),
+# against compiling without a cache. Reports the median wall time of three
+# runs of each and the size of the cache afterwards.
+#
+# Usage: ./tests/bench/cache.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/cache.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_cachebench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    printf "int function_number_%d(int first_argument, int second_argument)\n{\n", i
+    print "  int local_counter;"
+    print "  local_counter = first_argument;"
+    print "  while (local_counter < second_argument) {"
+    print "    local_counter = local_counter + 1;"
+    print "  }"
+    if (i > 0)
+      printf "  return local_counter + function_number_%d(0, 0);\n", i - 1
+    else
+      print "  return local_counter;"
+    print "}"
+  }
+}' > "$WORK/input.c"
+
+# median of three wall times in ms of $2, after running $1 before each
+function median {
+  local times=()
+  for run in 1 2 3; do
+    eval "$1"
+    local start=$(date +%s%N)
+    eval "$2" > /dev/null 2>&1
+    times+=($(( ($(date +%s%N) - start) / 1000000 )))
+  done
+  printf '%s\n' "${times[@]}" | sort -n | sed -n 2p
+}
+
+cd "$WORK"
+ENTRY="function_number_$((FUNCS - 1)) input.c 1 10"
+printf '%-12s %10s %10s %10s\n' "" "no cache" miss hit
+for mode in "--emit=obj -o input.o input.c" "--run $ENTRY"; do
+  printf '%-12s %8sms %8sms %8sms\n' "${mode%% *}" \
+    "$(median : "\"$COMP\" $mode")" \
+    "$(median "rm -rf cache" "\"$COMP\" --cache-dir=cache $mode")" \
+    "$(median : "\"$COMP\" --cache-dir=cache $mode")"
+done
+"$COMP" --cache-dir=cache --emit=obj -o input.o input.c > /dev/null 2>&1
+"$COMP" --cache-dir=cache --cache-stats --emit=obj -o input.o input.c 2>&1 >/dev/null | grep '^cache:'
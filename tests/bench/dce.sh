@@ -0,0 +1,52 @@
+#!/bin/bash
+# Dead code elimination benchmark: compiles a generated MiniC file whose
+# functions carry unused locals, untaken branches, empty loops and code after
+# a return with and without --dce, and reports the folding and code generation
+# times of each run and the number of instructions in the code generated.
+#
+# Usage: ./tests/bench/dce.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/dce.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_dcebench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+  print "extern int print_int(int x);"
+  for (i = 0; i < n; i++) {
+    printf "int clamp_%d(int x, int lo, int hi)\n{\n", i
+    print "  int spare;"
+    print "  int scratch;"
+    print "  if (1 > 2) {"
+    print "    print_int(x);"
+    print "    x = x * 2;"
+    print "  }"
+    print "  while (false) {"
+    print "    x = x - 1;"
+    print "  }"
+    print "  while (lo > hi + 1000) { }"
+    print "  if (x < lo) {"
+    print "    return lo;"
+    print "  }"
+    print "  if (x > hi) {"
+    print "    return hi;"
+    print "  }"
+    print "  return x;"
+    print "  print_int(lo);"
+    print "  print_int(hi);"
+    print "  return 0;"
+    print "}"
+  }
+}' > "$WORK/input.c"
+
+cd "$WORK"
+for mode in "--dce=false" "--dce"; do
+  echo "$mode"
+  for run in 1 2 3; do
+    "$COMP" --time-phases $mode input.c 2>&1 >/dev/null | grep -E '^(fold|codegen)' | tr '\n' ' '
+    echo
+  done
+  echo "instructions $(grep -c '^  [%a-z]' output.ll || true)"
+done
@@ -0,0 +1,22 @@
+#!/bin/bash
+# AST dump benchmark: compiles a large generated MiniC file with --dump-ast and
+# --dump-ast=json and reports the time spent printing the AST.
+#
+# Usage: ./tests/bench/dump.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/dump.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_dumpbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+for dump in --dump-ast --dump-ast=json; do
+  echo "$dump"
+  for run in 1 2 3; do
+    "$COMP" $dump --time-phases input.c 2>&1 >/dev/null | grep '^print'
+  done
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Object emission benchmark: builds an object file from a generated MiniC
+# file by writing output.ll and compiling it with llc (the text IR round trip
+# the tests make through clang), and with --emit=obj straight from memory,
+# unoptimized and at -O2, and reports the wall time of each run.
+#
+# Usage: ./tests/bench/emit.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/emit.sh ./mccomp 2000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-2000}
+WORK=$(mktemp -d /tmp/mccomp_emitbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+TIMEFORMAT='%R s'
+for opt in -O0 -O2; do
+  echo "$opt output.ll + llc"
+  for run in 1 2 3; do
+    time ("$COMP" $opt input.c > /dev/null 2>&1 && llc $opt -filetype=obj -relocation-model=pic output.ll -o llc.o)
+  done
+  echo "$opt --emit=obj"
+  for run in 1 2 3; do
+    time "$COMP" $opt --emit=obj -o direct.o input.c > /dev/null 2>&1
+  done
+done
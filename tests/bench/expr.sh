@@ -0,0 +1,45 @@
+#!/bin/bash
+# Binary expression benchmark: compiles generated MiniC functions made of long
+# int, float, mixed and bool expressions using every binary operator, and
+# reports the code generation time of each run.
+#
+# Usage: ./tests/bench/expr.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/expr.sh ./mccomp 5000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-5000}
+WORK=$(mktemp -d /tmp/mccomp_exprbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+  split("+ - * / %", arith, " ")
+  split("< > <= >= == !=", cmp, " ")
+  for (f = 0; f < n; f++) {
+    printf "bool expressions_%d(int i, int j, float x, float y, bool p, bool q)\n{\n", f
+    print "  int k;"
+    print "  float z;"
+    print "  bool r;"
+    for (s = 0; s < 8; s++) {
+      printf "  k = i"
+      for (t = 0; t < 12; t++)
+        printf " %s %s", arith[(s + t) % 5 + 1], (t % 2 ? "j" : "i")
+      print ";"
+      printf "  z = x"
+      for (t = 0; t < 12; t++)
+        printf " %s %s", arith[(s + t) % 5 + 1], (t % 3 ? "y" : "k")
+      print ";"
+      printf "  r = p"
+      for (t = 0; t < 6; t++)
+        printf " %s (z %s %s) %s q", (t % 2 ? "&&" : "||"), cmp[(s + t) % 6 + 1], (t % 2 ? "k" : "y"), (t % 3 ? "==" : "!=")
+      print ";"
+    }
+    print "  return r;"
+    print "}"
+  }
+}' > "$WORK/input.c"
+
+cd "$WORK"
+for run in 1 2 3; do
+  "$COMP" --time-phases input.c 2>&1 >/dev/null | grep '^codegen'
+done
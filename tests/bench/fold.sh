@@ -0,0 +1,43 @@
+#!/bin/bash
+# Constant folding benchmark: compiles a generated MiniC file full of literal
+# subexpressions and identity operations with and without --fold, and reports
+# the folding and code generation times of each run and the number of
+# instructions in the code generated.
+#
+# Usage: ./tests/bench/fold.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/fold.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_foldbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+  for (i = 0; i < n; i++) {
+    printf "float series_%d(int terms, float scale)\n{\n", i
+    print "  float sum;"
+    print "  int i;"
+    print "  bool odd;"
+    print "  sum = 0.0 * scale + (1.0 - 1.0);"
+    print "  i = 2 * 1 - 1;"
+    print "  odd = !!true;"
+    print "  while (i < terms * 1 + 0 && (true || odd)) {"
+    print "    sum = sum + scale * 1.0 * (4.0 / (i * (i + 1) * (i + 2)));"
+    print "    i = i + (3 - 2) * (60 * 60 / 3600);"
+    print "    odd = !odd && !false;"
+    print "  }"
+    print "  return -(-sum) + 0.0 * (2.0 * 3.5 - 7.0);"
+    print "}"
+  }
+}' > "$WORK/input.c"
+
+cd "$WORK"
+for mode in "--fold=false" "--fold"; do
+  echo "$mode"
+  for run in 1 2 3; do
+    "$COMP" --time-phases $mode input.c 2>&1 >/dev/null | grep -E '^(fold|codegen)' | tr '\n' ' '
+    echo
+  done
+  echo "instructions $(grep -c '^  [%a-z]' output.ll || true)"
+done
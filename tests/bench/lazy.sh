@@ -0,0 +1,53 @@
+#!/bin/bash
+# Lazy JIT benchmark: runs a generated MiniC program of which only one
+# function in a hundred is ever called (each runs a loop, then calls the one
+# called before it, and has a call to another that it never reaches) with
+# --run, which compiles all of it before the call, and with --lazy, without
+# and with speculation. Reports the startup time (the jit phase, up to the
+# first call), the time of the call, which under --lazy includes compiling the
+# functions it reaches, the wall time to the result, and how much --lazy
+# compiled. Speculation needs a second core to gain anything: pass --jobs=N
+# in MCCOMP_FLAGS to force it on a single one.
+#
+# Usage: ./tests/bench/lazy.sh [path/to/mccomp] [number of functions]
+#                             [loop iterations per call]
+#   e.g. ./tests/bench/lazy.sh ./mccomp 20000 200000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK_PER_CALL=${3:-200000}
+WORK=$(mktemp -d /tmp/mccomp_lazybench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" 'BEGIN {
+  print "extern int print_int(int value);"
+  for (i = 0; i < n; i++) {
+    printf "int function_number_%d(int first_argument, int second_argument)\n{\n", i
+    print "  int local_counter;"
+    print "  local_counter = first_argument;"
+    print "  while (local_counter < second_argument) {"
+    print "    local_counter = local_counter + 1;"
+    print "  }"
+    if (i % 100 == 0 && i > 0) {
+      print "  if (local_counter > 1000000000) {"
+      printf "    local_counter = function_number_%d(local_counter, second_argument);\n", i - 1
+      print "  }"
+      printf "  local_counter = local_counter + function_number_%d(first_argument, second_argument);\n", i - 100
+    }
+    print "  return local_counter;"
+    print "}"
+  }
+  printf "int entry(int work)\n{\n  return function_number_%d(0, work);\n}\n", int((n - 1) / 100) * 100
+}' > "$WORK/input.c"
+
+cd "$WORK"
+for mode in "" "--lazy --speculate=false" "--lazy"; do
+  echo "--run $mode"
+  for run in 1 2 3; do
+    TIMEFORMAT='wall %R s'
+    { time "$COMP" --time-phases $MCCOMP_FLAGS $mode --run entry input.c "$WORK_PER_CALL" 2>&1 >/dev/null |
+        grep -E '^(jit|run|lazy)' | tr '\n' ' '; } 2>&1 | tr '\n' ' '
+    echo
+  done
+done
@@ -0,0 +1,18 @@
+#!/bin/bash
+# Lexer microbenchmark: generates a large identifier-heavy MiniC file and
+# reports the tokens/second of `mccomp --lex-only` on it.
+#
+# Usage: ./tests/bench/lexer.sh [path/to/mccomp] [number of functions] [mccomp flags...]
+#   e.g. ./tests/bench/lexer.sh ./mccomp 100000 --lexer-scan=scalar
+set -e
+
+COMP=${1:-./mccomp}
+FUNCS=${2:-100000}
+INPUT=$(mktemp /tmp/mccomp_lexbench.XXXXXX.c)
+trap 'rm -f "$INPUT"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$INPUT"
+
+for run in 1 2 3; do
+  "$COMP" --lex-only "${@:3}" "$INPUT"
+done
@@ -0,0 +1,67 @@
+#!/bin/bash
+# Short-circuit evaluation benchmark: compiles a MiniC loop whose && and ||
+# conditions guard a costly call that they rarely need, links it with a small
+# driver, and reports the run time of each run and how many calls were made.
+# The object file is built with llc and linked with $CXX (default clang++).
+#
+# Usage: ./tests/bench/logic.sh [path/to/mccomp] [loop iterations]
+#   e.g. ./tests/bench/logic.sh ./mccomp 1000000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+ITERS=${2:-1000000}
+WORK=$(mktemp -d /tmp/mccomp_logicbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/logic.c" <<'EOF'
+int calls;
+
+bool costly(int i) {
+  int j;
+  int s;
+  calls = calls + 1;
+  j = 0;
+  s = 0;
+  while (j < 1000) {
+    s = s + j % 7;
+    j = j + 1;
+  }
+  return s > i % 3;
+}
+
+int guarded(int n) {
+  int i;
+  int hits;
+  i = 0;
+  hits = 0;
+  while (i < n && (i % 1000 != 999 || costly(i))) {
+    if (i % 100 == 0 && costly(i)) {
+      hits = hits + 1;
+    }
+    if (i % 2 == 0 || i % 3 == 0 || costly(i)) {
+      hits = hits + 1;
+    }
+    i = i + 1;
+  }
+  return hits;
+}
+EOF
+cat > "$WORK/driver.cpp" <<'EOF'
+#include <cstdio>
+#include <cstdlib>
+extern "C" int calls;
+extern "C" int guarded(int n);
+int main(int argc, char **argv) {
+  int hits = guarded(atoi(argv[1]));
+  printf("%d hits, %d calls\n", hits, calls);
+}
+EOF
+
+cd "$WORK"
+"$COMP" logic.c > /dev/null 2>&1
+llc -filetype=obj -relocation-model=pic output.ll -o logic.o
+${CXX:-clang++} driver.cpp logic.o -o logic
+TIMEFORMAT='run %R s'
+for run in 1 2 3; do
+  time ./logic "$ITERS"
+done
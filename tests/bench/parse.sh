@@ -0,0 +1,27 @@
+#!/bin/bash
+# Parallel parsing benchmark: parses a large generated MiniC file sequentially
+# and with --parallel-parse on 1, 2, 4, ... threads (up to the number of
+# cores) and reports the parse time of each run.
+#
+# Usage: ./tests/bench/parse.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/parse.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_parsebench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+MODES=("")
+for ((jobs = 1; jobs <= $(nproc); jobs *= 2)); do
+  MODES+=("--parallel-parse --jobs=$jobs")
+done
+for mode in "${MODES[@]}"; do
+  echo "${mode:-sequential}"
+  for run in 1 2 3; do
+    "$COMP" --time-phases $mode input.c 2>&1 >/dev/null | grep '^parse'
+  done
+done
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Pipelined front end benchmark: compiles a large generated MiniC file with
+# and without --pipeline and reports the wall-clock time of each run.
+#
+# Usage: ./tests/bench/pipeline.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/pipeline.sh ./mccomp 20000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20000}
+WORK=$(mktemp -d /tmp/mccomp_pipebench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+TIMEFORMAT="%R s"
+for mode in "" --pipeline; do
+  echo "${mode:-sequential}"
+  for run in 1 2 3; do
+    { time "$COMP" $mode input.c >/dev/null 2>&1; } 2>&1
+  done
+done
@@ -0,0 +1,30 @@
+#!/bin/bash
+# Writes a large identifier-heavy MiniC program to stdout, for the benchmarks
+# in this directory.
+#
+# Usage: ./tests/bench/program.sh [number of functions]
+set -e
+
+FUNCS=${1:-100000}
+
+awk -v n="$FUNCS" 'BEGIN {
+  print "extern int print_int(int value);"
+  for (i = 0; i < n; i++) {
+    printf "int function_number_%d(int first_argument, int second_argument)\n{\n", i
+    print "  int local_counter;"
+    print "  bool keep_going_flag;"
+    print "  local_counter = first_argument + second_argument * first_argument;"
+    print "  keep_going_flag = true;"
+    print "  while (keep_going_flag && local_counter < second_argument) {"
+    print "    if (local_counter != first_argument) {"
+    print "      local_counter = local_counter + print_int(local_counter);"
+    print "    }"
+    print "    else {"
+    print "      keep_going_flag = false;"
+    print "    }"
+    print "  }"
+    print "  // comment that the lexer has to skip over as well"
+    print "  return local_counter;"
+    print "}"
+  }
+}'
@@ -0,0 +1,50 @@
+#!/bin/bash
+# JIT benchmark: for each of the test programs, times getting its result by
+# compiling it to output.ll, building it with llc and the C++ compiler into
+# its driver and running that (the path the tests take); by writing an object
+# file with --emit=obj and linking it into the driver; and with --run, which
+# compiles it in memory and calls it in process. Reports the median wall time
+# to the first result of five runs of each.
+#
+# Usage: ./tests/bench/run.sh [path/to/mccomp]
+#   CXX=g++ ./tests/bench/run.sh ./mccomp
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+CXX=${CXX:-clang++}
+TESTS=$(realpath "$(dirname "$0")/..")
+WORK=$(mktemp -d /tmp/mccomp_runbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+function median {
+  local times=()
+  for run in 1 2 3 4 5; do
+    local start=$(date +%s%N)
+    eval "$1" > /dev/null 2>&1
+    times+=($(( ($(date +%s%N) - start) / 1000000 )))
+  done
+  printf '%s\n' "${times[@]}" | sort -n | sed -n 3p
+}
+
+cd "$WORK"
+printf '%-14s %12s %12s %8s\n' program "ll+llc+link" "obj+link" "--run"
+while read test entry args; do
+  cp "$TESTS/$test/$test.c" "$TESTS/$test/driver.cpp" .
+  LL=$(median "'$COMP' $test.c && llc -filetype=obj -relocation-model=pic output.ll -o ll.o && $CXX driver.cpp ll.o -o ll && ./ll")
+  OBJ=$(median "'$COMP' --emit=obj -o obj.o $test.c && $CXX driver.cpp obj.o -o obj && ./obj")
+  RUN=$(median "'$COMP' --run $entry $test.c -- $args")
+  printf '%-14s %9s ms %9s ms %5s ms\n' $test $LL $OBJ $RUN
+done << 'END'
+addition addition 6 3
+factorial factorial 10
+fibonacci fibonacci 10
+pi pi
+while While 1
+void Void
+cosine cosine 3.14159
+unary unary 2 3.0
+recurse recursion_driver 20
+rfact rfact 10
+palindrome palindrome 12321
+shortcircuit shortcircuit 6 2
+END
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Symbol table benchmark: compiles generated MiniC functions that each declare
+# thousands of locals and nest blocks deeply, every block declaring locals of
+# its own and reading names from the blocks around it, and reports the code
+# generation time of each run.
+#
+# Usage: ./tests/bench/scopes.sh [path/to/mccomp] [number of functions] [locals per function] [nesting depth]
+#   e.g. ./tests/bench/scopes.sh ./mccomp 20 4000 200
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-20}
+LOCALS=${3:-4000}
+DEPTH=${4:-200}
+WORK=$(mktemp -d /tmp/mccomp_scopesbench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+awk -v n="$FUNCS" -v locals="$LOCALS" -v depth="$DEPTH" 'BEGIN {
+  for (f = 0; f < n; f++) {
+    printf "int scopes_%d(int argument)\n{\n", f
+    for (i = 0; i < locals; i++)
+      printf "  int outer_%d;\n", i
+    for (i = 0; i < locals; i++)
+      printf "  outer_%d = argument + %d;\n", i, i
+    for (d = 0; d < depth; d++) {
+      printf "%*s{\n", d + 2, ""
+      for (i = 0; i < 8; i++)
+        printf "%*sint nested_%d_%d;\n", d + 4, "", d, i
+      for (i = 0; i < 8; i++)
+        printf "%*snested_%d_%d = outer_%d + %s;\n", d + 4, "", d, i, (d * 8 + i) % locals, d ? "nested_" d - 1 "_" i : "argument"
+    }
+    for (d = depth - 1; d >= 0; d--)
+      printf "%*sargument = argument + nested_%d_0;\n%*s}\n", d + 4, "", d, d + 2, ""
+    print "  return argument;"
+    print "}"
+  }
+}' > "$WORK/input.c"
+
+cd "$WORK"
+for run in 1 2 3; do
+  "$COMP" --time-phases input.c 2>&1 >/dev/null | grep '^codegen'
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Direct SSA construction benchmark: compiles a generated MiniC file with
+# stack slots for the locals and with --ssa, unoptimized and at -O1, and
+# reports the code generation and optimization times of each run and the
+# number of allocas, loads, stores and phis in the code generated.
+#
+# Usage: ./tests/bench/ssa.sh [path/to/mccomp] [number of functions]
+#   e.g. ./tests/bench/ssa.sh ./mccomp 2000
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+FUNCS=${2:-2000}
+WORK=$(mktemp -d /tmp/mccomp_ssabench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+"$(dirname "$0")/program.sh" "$FUNCS" > "$WORK/input.c"
+
+cd "$WORK"
+for mode in "" "--ssa" "-O1" "--ssa -O1"; do
+  echo "${mode:-allocas}"
+  for run in 1 2 3; do
+    "$COMP" --time-phases $mode input.c 2>&1 >/dev/null | grep -E '^(codegen|optimize)' | tr '\n' ' '
+    echo
+  done
+  for inst in alloca load store phi; do
+    printf '%s %d  ' $inst "$(grep -c " = $inst \|^  $inst " output.ll || true)"
+  done
+  echo
+done
@@ -0,0 +1,85 @@
+#!/bin/bash
+# Tail recursion benchmark: compiles MiniC functions that recurse once per
+# unit of their argument, in tail position, through an accumulator, and
+# through an accumulator kept in a returned local as tests/rfact does, with
+# and without --tre, links them with a driver that measures how deep the stack
+# gets, and reports the stack used and run time for growing arguments. Without
+# --tre the stack grows with the argument until it overflows; with it, it
+# stays the same. The object files are built with llc and linked with $CXX
+# (default clang++).
+#
+# Usage: ./tests/bench/tre.sh [path/to/mccomp]
+set -e
+
+COMP=$(realpath "${1:-./mccomp}")
+WORK=$(mktemp -d /tmp/mccomp_trebench.XXXXXX)
+trap 'rm -rf "$WORK"' EXIT
+
+cat > "$WORK/tre.c" <<'EOF'
+extern int probe(int n);
+
+int sum(int n, int acc) {
+  if (n == 0) {
+    return acc;
+  }
+  return sum(n - 1, acc + probe(n));
+}
+
+int fact(int n) {
+  if (n <= 1) {
+    return 1;
+  }
+  return probe(n) * fact(n - 1);
+}
+
+int rfact(int n) {
+  int result;
+  result = 0;
+  if (n >= 1) {
+    result = probe(n) * rfact(n - 1);
+  }
+  else {
+    result = 1;
+  }
+  return result;
+}
+EOF
+cat > "$WORK/driver.cpp" <<'EOF'
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+static char *Top, *Deepest;
+extern "C" int probe(int n) {
+  char *Here = (char *)__builtin_frame_address(0);
+  if (Here < Deepest)
+    Deepest = Here;
+  return n;
+}
+extern "C" int sum(int n, int acc);
+extern "C" int fact(int n);
+extern "C" int rfact(int n);
+int main(int argc, char **argv) {
+  int n = atoi(argv[2]);
+  Top = Deepest = (char *)__builtin_frame_address(0);
+  auto Start = std::chrono::steady_clock::now();
+  int r = strcmp(argv[1], "sum") == 0 ? sum(n, 0) : strcmp(argv[1], "fact") == 0 ? fact(n) : rfact(n);
+  std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+  printf("%-5s n=%-9d stack %9ld bytes  %.3f s  (result %d)\n", argv[1], n, (long)(Top - Deepest),
+         Elapsed.count(), r);
+}
+EOF
+
+cd "$WORK"
+for mode in "--tre=false" "--tre"; do
+  echo "$mode"
+  "$COMP" $mode tre.c > /dev/null 2>&1
+  llc -filetype=obj -relocation-model=pic output.ll -o tre.o
+  ${CXX:-clang++} -O2 driver.cpp tre.o -o tre
+  for fn in sum fact rfact; do
+    # a stack overflow kills ./tre, and the shell reports that on stderr
+    for n in 1000 100000 10000000; do
+      ./tre $fn $n || printf "%-5s n=%-9d stack overflow\n" $fn $n
+    done 2> /dev/null
+  done
+done
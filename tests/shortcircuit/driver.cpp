@@ -0,0 +1,34 @@
+#include <iostream>
+#include <cstdio>
+
+// clang++ driver.cpp shortcircuit.ll -o shortcircuit
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+extern "C" DLLEXPORT int print_int(int X) {
+  fprintf(stderr, "%d\n", X);
+  return 0;
+}
+
+extern "C" DLLEXPORT float print_float(float X) {
+  fprintf(stderr, "%f\n", X);
+  return 0;
+}
+
+extern "C" {
+    int shortcircuit(int n, int d);
+}
+
+int main() {
+    // 6 iterations: 6 + 3 calls, 200 + 30 hits, and 6 more when d is 2
+    if (shortcircuit(6, 0) == 23009 && shortcircuit(6, 2) == 23609) {
+    	std::cout << "PASSED Result: " << shortcircuit(6, 2) << std::endl;
+    }
+    else {
+    	std::cout << "FAILED Result: " << shortcircuit(6, 0) << " " << shortcircuit(6, 2) << std::endl;
+    }
+}
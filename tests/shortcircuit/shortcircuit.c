@@ -0,0 +1,35 @@
+// MiniC program to check that && and || only evaluate their right operand
+// when the left one does not decide the result
+
+int calls;
+
+bool count(bool result) {
+   calls = calls + 1;
+   return result;
+}
+
+int shortcircuit(int n, int d) {
+   int i;
+   int hits;
+
+   i = 0;
+   hits = 0;
+   calls = 0;
+
+   // the call must not be made once i reaches n
+   while (i < n && count(true)) {
+      // the division must not be made when d is 0
+      if (d != 0 && n / d > 1) {
+         hits = hits + 1;
+      }
+      // the call must not be made when i is even
+      if (i % 2 == 0 || count(false)) {
+         hits = hits + 10;
+      }
+      if (i > 2 && i < 5 || !(i >= 0)) {
+         hits = hits + 100;
+      }
+      i = i + 1;
+   }
+   return hits * 100 + calls;
+}
@@ -115,4 +115,495 @@ rm -rf output.ll palindrome
 $CLANG driver.cpp output.ll -o palindrome
 validate "./palindrome"
 
+cd ../shortcircuit
+pwd
+rm -rf output.ll shortcircuit
+"$COMP" ./shortcircuit.c
+$CLANG driver.cpp output.ll -o shortcircuit
+validate "./shortcircuit"
+
+echo "Optimized code *****"
+# the programs must still pass their drivers when optimized at each -O level
+# and through a custom --passes pipeline
+cd "$DIR/tests"
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  for opt in -O1 -O2 -O3 "--passes=function(mem2reg,instcombine,simplifycfg),globaldce"; do
+    rm -rf output.ll opt
+    "$COMP" "$opt" ./$test.c > /dev/null
+    $CLANG driver.cpp output.ll -o opt
+    validate "./opt"
+  done
+  rm -f opt
+  cd ..
+done
+# a return inside an if or while must leave well-formed code to optimize
+EARLY=$(mktemp -d /tmp/mccomp_early.XXXXXX)
+cat > "$EARLY/early.c" <<'EOF'
+int early(int n) {
+  while (n > 10) {
+    if (n == 42) { return 0; }
+    n = n - 1;
+    return n;
+  }
+  if (n < 2) { return n; } else { n = n - 1; }
+  return early(n);
+}
+EOF
+if ! (cd "$EARLY" && "$COMP" -O2 early.c > /dev/null); then
+  rm -rf "$EARLY"
+  echo "early.c: -O2 failed"; echo "TEST FAILED *****"; exit 1
+fi
+# running off the end of a non-void function is a semantic error at its
+# closing brace; an end that cannot be reached still gives well-formed code
+cat > "$EARLY/noreturn.c" <<'EOF'
+int noreturn(int n) {
+  if (n > 0) { return n; }
+}
+EOF
+cat > "$EARLY/ends.c" <<'EOF'
+int ends(int n) {
+  if (n > 0) { return n; } else { return 0; }
+}
+void tail(int n) {
+  if (n > 0) { return; }
+}
+EOF
+for layout in tree flat; do
+  rm -f "$EARLY/output.ll"
+  if (cd "$EARLY" && "$COMP" --ast-layout=$layout noreturn.c > /dev/null 2> noreturn.err) ||
+    ! grep -q '^Ln: 3, Col:1 - Semantic Error: Missing return' "$EARLY/noreturn.err" ||
+    [ -e "$EARLY/output.ll" ]; then
+    rm -rf "$EARLY"
+    echo "noreturn.c ($layout): missing return not reported"; echo "TEST FAILED *****"; exit 1
+  fi
+  if ! (cd "$EARLY" && "$COMP" --ast-layout=$layout ends.c > /dev/null 2>&1 && $CLANG -c output.ll -o ends.o); then
+    rm -rf "$EARLY"
+    echo "ends.c ($layout): malformed output.ll"; echo "TEST FAILED *****"; exit 1
+  fi
+done
+rm -rf "$EARLY"
+
+echo "Target machine *****"
+# the programs must pass their drivers when optimized for the host's CPU; the
+# module must carry the triple of --target, and every function the CPU and
+# features of --mcpu and --mattr, streamed or not; an unknown target or CPU
+# must be refused
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll native
+  "$COMP" --mcpu=native -O2 ./$test.c > /dev/null
+  $CLANG driver.cpp output.ll -o native
+  validate "./native"
+  rm -f native
+  cd ..
+done
+TARGET=$(mktemp -d /tmp/mccomp_target.XXXXXX)
+cp "$DIR/tests/recurse/recurse.c" "$TARGET"
+TARGETFLAGS="--target=x86_64-unknown-linux-gnu --mcpu=haswell --mattr=-avx2,+fma"
+if ! (cd "$TARGET" && "$COMP" $TARGETFLAGS recurse.c > /dev/null && mv output.ll seq.ll &&
+  "$COMP" $TARGETFLAGS --stream recurse.c > /dev/null) ||
+  ! cmp -s "$TARGET/seq.ll" "$TARGET/output.ll" ||
+  ! grep -q '^target triple = "x86_64-unknown-linux-gnu"$' "$TARGET/output.ll" ||
+  ! grep -q '^attributes #0 = { "target-cpu"="haswell" "target-features"="-avx2,+fma" }$' "$TARGET/output.ll" ||
+  [ "$(grep -c '^declare.*#0$\|^define.*#0 {$' "$TARGET/output.ll")" != 3 ] ||
+  (cd "$TARGET" && "$COMP" --mcpu=no-such-cpu recurse.c > /dev/null 2>&1) ||
+  (cd "$TARGET" && "$COMP" --target=no-such-target recurse.c > /dev/null 2>&1); then
+  rm -rf "$TARGET"
+  echo "recurse.c: the target machine is wrong"; echo "TEST FAILED *****"; exit 1
+fi
+rm -rf "$TARGET"
+
+echo "Object, assembly and bitcode output *****"
+# the programs must pass their drivers linked with the object file, the
+# assembly and the bitcode that --emit writes to -o, and without -o those go
+# to output.o, output.s and output.bc; the bitcode must have a summary index
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll output.o output.s output.bc $test.o $test.s $test.bc obj asm bc
+  "$COMP" --emit=obj -o $test.o ./$test.c > /dev/null
+  "$COMP" -O2 --emit=asm -o $test.s ./$test.c > /dev/null
+  "$COMP" --emit=bc -o $test.bc ./$test.c > /dev/null
+  if [ -e output.ll ]; then
+    echo "$test: -o still wrote output.ll"; echo "TEST FAILED *****"; exit 1
+  fi
+  $CLANG driver.cpp $test.o -o obj
+  validate "./obj"
+  $CLANG driver.cpp $test.s -o asm
+  validate "./asm"
+  $CLANG driver.cpp $test.bc -o bc
+  validate "./bc"
+  if ! llvm-bcanalyzer $test.bc | grep -q GLOBALVAL_SUMMARY_BLOCK; then
+    echo "$test: --emit=bc wrote no summary index"; echo "TEST FAILED *****"; exit 1
+  fi
+  "$COMP" --emit=obj ./$test.c > /dev/null
+  "$COMP" --emit=asm ./$test.c > /dev/null
+  "$COMP" --emit=bc ./$test.c > /dev/null
+  if ! cmp -s output.o $test.o || [ ! -s output.s ] || ! cmp -s output.bc $test.bc; then
+    echo "$test: --emit did not write output.o, output.s and output.bc"; echo "TEST FAILED *****"; exit 1
+  fi
+  rm -f output.o output.s output.bc $test.o $test.s $test.bc obj asm bc
+  cd ..
+done
+
+echo "JIT execution (--run) *****"
+# --run must print what the drivers check each program returns, without
+# writing output.ll, print_int and print_float must write to stderr as the
+# drivers' do, ints with a leading zero must be read as decimal, and a
+# function the program lacks or a bad argument must fail;
+# the same goes for --lazy, with and without speculation
+while read test entry expected args; do
+  cd $test
+  rm -f output.ll
+  for mode in "" --ssa -O2 --lazy "--lazy --jobs=2" "--lazy --speculate=false -O2"; do
+    result=$("$COMP" $mode --run $entry ./$test.c -- $args 2> /dev/null)
+    if [ "$result" != "$expected" ] || [ -e output.ll ]; then
+      echo "$test: $mode --run $entry $args printed '$result', not '$expected'"; echo "TEST FAILED *****"; exit 1
+    fi
+  done
+  cd ..
+done << 'END'
+addition addition 9 6 3
+addition addition 18 010 08
+factorial factorial 3628800 10
+fibonacci fibonacci 88 10
+pi pi 3.141595
+while While 10 1
+void Void
+cosine cosine -1.000000 3.14159
+unary unary 4.000000 2 3.0
+recurse recursion_driver 210 20
+rfact rfact 3628800 10
+palindrome palindrome true 12321
+shortcircuit shortcircuit 23609 6 2
+END
+if [ "$("$COMP" --run Void void/void.c 2>&1 >/dev/null | grep -cx '[0-9]*')" != 11 ] ||
+  "$COMP" --run nothing addition/addition.c > /dev/null 2>&1 ||
+  "$COMP" --run addition addition/addition.c 1 x > /dev/null 2>&1; then
+  echo "void.c, addition.c: --run is wrong"; echo "TEST FAILED *****"; exit 1
+fi
+
+echo "Lazy JIT (--lazy) *****"
+# --lazy must compile only the functions called, and those they call on the
+# speculation threads, so that an error in a function never called goes
+# unreported, while calling it reports the error as without --lazy
+LAZY=$(mktemp -d /tmp/mccomp_lazy.XXXXXX)
+cat > "$LAZY/lazy.c" << 'END'
+extern int print_int(int x);
+int total;
+int add(int k) { total = total + k; return total; }
+int broken(int k) { return k + undeclared; }
+int pick(int k) { if (k > 100) { return broken(k); } return add(k); }
+int cold(int k) { return k * 2; }
+int sum(int n) { int i; i = 0; while (i < n) { pick(i); i = i + 1; } print_int(total); return total; }
+END
+cd "$LAZY"
+for mode in --jobs=2 --speculate=false; do
+  result=$("$COMP" --lazy $mode --time-phases --run sum lazy.c 10 2> lazy.err)
+  if [ "$result" != 45 ] || ! grep -qx 45 lazy.err || grep -q Error lazy.err ||
+    ! grep -q '^lazy: 3 of 5 functions compiled' lazy.err; then
+    cd "$DIR"; rm -rf "$LAZY"
+    echo "lazy.c: --lazy $mode is wrong"; echo "TEST FAILED *****"; exit 1
+  fi
+done
+"$COMP" --lazy --run pick lazy.c 200 > /dev/null 2> lazy.err && rc=0 || rc=$?
+"$COMP" --run sum lazy.c 10 > /dev/null 2> eager.err || true
+if [ $rc = 0 ] || [ "$(grep Error lazy.err)" != "$(grep Error eager.err)" ]; then
+  cd "$DIR"; rm -rf "$LAZY"
+  echo "lazy.c: --lazy did not report the error of broken"; echo "TEST FAILED *****"; exit 1
+fi
+cd "$DIR/tests"
+rm -rf "$LAZY"
+
+echo "Compilation cache *****"
+# a second compilation of a program to any output must come from the cache,
+# without parsing, and be the same, and so must a --run, with any arguments;
+# a change to the source or the options must miss; compilations racing on one
+# cache must all succeed; --cache-size must evict the least recently used
+# entries; and --lazy, which compiles a function at a time, must neither look
+# up nor store anything, also when it falls back to compiling the whole module
+CACHE=$(mktemp -d /tmp/mccomp_cache.XXXXXX)
+function cache_failed {
+  rm -rf "$CACHE"
+  echo "$1"; echo "TEST FAILED *****"; exit 1
+}
+for test in addition factorial pi palindrome; do
+  cd $test
+  for emit in obj asm bc ll; do
+    "$COMP" --cache-dir="$CACHE" --emit=$emit -o cold ./$test.c > /dev/null 2>&1
+    "$COMP" --cache-dir="$CACHE" --cache-stats --emit=$emit -o warm ./$test.c > /dev/null 2> warm.err
+    if ! cmp -s cold warm || ! grep -q '^cache: hit' warm.err || grep -q PARSING warm.err; then
+      cache_failed "$test: --emit=$emit did not come from the cache"
+    fi
+  done
+  rm -f cold warm warm.err
+  cd ..
+done
+cp addition/addition.c "$CACHE/addition.c"
+for args in "6 3" "6 3" "-- -4 1"; do
+  "$COMP" --cache-dir="$CACHE" --cache-stats --run addition "$CACHE/addition.c" $args > "$CACHE/run.out" 2> "$CACHE/run.err"
+done
+if [ "$(cat "$CACHE/run.out")" != -3 ] || ! grep -q '^cache: hit' "$CACHE/run.err"; then
+  cache_failed "addition.c: --run did not come from the cache"
+fi
+"$COMP" --cache-dir="$CACHE" --cache-stats -O2 --run addition "$CACHE/addition.c" 6 3 > /dev/null 2> "$CACHE/run.err"
+echo "// changed" >> "$CACHE/addition.c"
+"$COMP" --cache-dir="$CACHE" --cache-stats --run addition "$CACHE/addition.c" 6 3 >> "$CACHE/run.err" 2>&1
+if [ "$(grep -c '^cache: miss' "$CACHE/run.err")" != 2 ]; then
+  cache_failed "addition.c: -O2 or a changed source did not miss the cache"
+fi
+rm -rf "$CACHE"/*
+for i in 1 2 3 4 5 6 7 8; do
+  "$COMP" --cache-dir="$CACHE" --emit=obj -o "$CACHE/race$i.o" factorial/factorial.c > /dev/null 2>&1 &
+done
+wait
+if [ "$(md5sum "$CACHE"/race*.o | cut -d' ' -f1 | sort -u | wc -l)" != 1 ] ||
+  [ "$(awk '{ print $1 + $2 }' "$CACHE/stats")" != 8 ]; then
+  cache_failed "factorial.c: racing compilations went wrong"
+fi
+"$COMP" --cache-dir="$CACHE" --emit=obj -o "$CACHE/a.o" addition/addition.c > /dev/null 2>&1
+"$COMP" --cache-dir="$CACHE" --cache-size=0 --emit=obj -o "$CACHE/p.o" pi/pi.c > /dev/null 2>&1
+"$COMP" --cache-dir="$CACHE" --cache-stats --emit=obj -o "$CACHE/a.o" addition/addition.c 2>&1 >/dev/null |
+  grep '^cache:' > "$CACHE/evict.err"
+if ! grep -q '^cache: miss.*[1-9][0-9]* evictions$' "$CACHE/evict.err"; then
+  cache_failed "--cache-size=0 did not evict the older entries"
+fi
+rm -rf "$CACHE"/*
+cat > "$CACHE/twice.c" << 'END'
+extern int twice(int x);
+int twice(int x) { return x + x; }
+int main2(int x) { return twice(x) + 1; }
+END
+for run in 1 2; do
+  "$COMP" --cache-dir="$CACHE/lazy" --cache-stats --lazy --run addition addition/addition.c 6 3 2>&1 >/dev/null |
+    grep '^cache:' >> "$CACHE/lazy.err"
+  "$COMP" --cache-dir="$CACHE/lazy" --cache-stats --lazy --run main2 "$CACHE/twice.c" 5 2>&1 >/dev/null |
+    grep '^cache:' >> "$CACHE/lazy.err"
+done
+if [ "$(grep -c '^cache: not used; 0 entries.* 0 hits, 0 misses' "$CACHE/lazy.err")" != 4 ] ||
+  ls "$CACHE/lazy" | grep -q '\.\(o\|sig\)$'; then
+  cache_failed "--lazy used the cache"
+fi
+rm -rf "$CACHE"
+
+echo "Direct SSA construction *****"
+# with --ssa the programs must pass their drivers without a single alloca, and
+# a function with returns inside if and while must still verify
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll ssa
+  "$COMP" --ssa ./$test.c > /dev/null
+  if grep -q alloca output.ll; then
+    echo "$test: --ssa left an alloca"; echo "TEST FAILED *****"; exit 1
+  fi
+  $CLANG driver.cpp output.ll -o ssa
+  validate "./ssa"
+  rm -f ssa
+  cd ..
+done
+EARLY=$(mktemp -d /tmp/mccomp_early.XXXXXX)
+cat > "$EARLY/early.c" <<'EOF'
+int early(int n) {
+  int m;
+  m = n;
+  while (n > 10) {
+    if (n == 42) { return m; }
+    n = n - 1;
+  }
+  if (n < 2) { m = 0; } else { return early(n - 1) + m; }
+  return m + n;
+}
+EOF
+if ! (cd "$EARLY" && "$COMP" --ssa -O1 early.c > /dev/null); then
+  rm -rf "$EARLY"
+  echo "early.c: --ssa failed"; echo "TEST FAILED *****"; exit 1
+fi
+rm -rf "$EARLY"
+
+echo "Constant folding *****"
+# --fold=false must still pass the drivers, and literal arithmetic and identity
+# operations must not reach the generated code
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll nofold
+  "$COMP" --fold=false ./$test.c > /dev/null
+  $CLANG driver.cpp output.ll -o nofold
+  validate "./nofold"
+  rm -f nofold
+  cd ..
+done
+FOLD=$(mktemp -d /tmp/mccomp_fold.XXXXXX)
+cat > "$FOLD/fold.c" <<'EOF'
+int lit() { return (2 * 3 + 4) * 1 + 0 - 2147483647 - 3; }
+float flit() { return 4.0 / (1 * (1 + 1) * (1 + 2)) * 1.0; }
+bool blit(bool b) { return !!(true && (b || false)) && 1 < 2; }
+int ident(int x) { return -(-(x * 1 + 0)) - 0; }
+EOF
+if ! (cd "$FOLD" && "$COMP" fold.c > /dev/null) ||
+  ! grep -q 'ret i32 -2147483640' "$FOLD/output.ll" ||
+  ! grep -q 'ret float 0x3FE5555560000000' "$FOLD/output.ll" ||
+  grep -q ' = \(add\|sub\|mul\|fdiv\|fmul\|xor\|and\|or\|icmp\|select\|phi\) ' "$FOLD/output.ll"; then
+  rm -rf "$FOLD"
+  echo "fold.c: literals or identities were not folded"; echo "TEST FAILED *****"; exit 1
+fi
+rm -rf "$FOLD"
+
+echo "Dead code elimination *****"
+# --dce=false must still pass the drivers; unreachable statements, untaken
+# branches, empty pure loops and unused locals must not reach the generated
+# code, both layouts must remove the same nodes, and dead code must still be
+# checked for errors
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll nodce
+  "$COMP" --dce=false ./$test.c > /dev/null
+  $CLANG driver.cpp output.ll -o nodce
+  validate "./nodce"
+  rm -f nodce
+  cd ..
+done
+DCE=$(mktemp -d /tmp/mccomp_dce.XXXXXX)
+cat > "$DCE/dce.c" <<'EOF'
+extern int dead(int x);
+int after(int n) { int unused; n = n + 1; return n; dead(n); return 0; }
+int branch(int n) { if (1 > 2) { dead(1); } else { n = n * 2; } while (false) { dead(2); } return n; }
+int loop(int n) { int i; i = 0; while (i > n + 100) { } while (i < n) { i = i + 1; } return i; }
+EOF
+sed 's/dead(n); return 0;/return undeclared;/' "$DCE/dce.c" > "$DCE/error.c"
+if ! (cd "$DCE" && "$COMP" --ast-stats dce.c 2>&1 >/dev/null | grep '^dead code' > tree.txt && mv output.ll tree.ll) ||
+  ! (cd "$DCE" && "$COMP" --ast-stats --ast-layout=flat dce.c 2>&1 >/dev/null | grep '^dead code' > flat.txt) ||
+  ! cmp -s "$DCE/tree.txt" "$DCE/flat.txt" || ! cmp -s "$DCE/tree.ll" "$DCE/output.ll" ||
+  [ "$(grep -c 'call i32 @dead' "$DCE/output.ll")" != 0 ] || grep -q '%unused' "$DCE/output.ll" ||
+  [ "$(grep -c 'br i1' "$DCE/output.ll")" != 1 ] ||
+  (cd "$DCE" && "$COMP" error.c > /dev/null 2>&1); then
+  rm -rf "$DCE"
+  echo "dce.c: dead code was not removed"; echo "TEST FAILED *****"; exit 1
+fi
+rm -rf "$DCE"
+
+echo "Tail recursion elimination *****"
+# --tre=false must still pass the drivers, and calls a function makes to itself
+# in tail position, directly or under an int + or *, must become loops, also
+# when the result goes through a local that is returned, as in rfact
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  rm -rf output.ll notre
+  "$COMP" --tre=false ./$test.c > /dev/null
+  $CLANG driver.cpp output.ll -o notre
+  validate "./notre"
+  rm -f notre
+  cd ..
+done
+TRE=$(mktemp -d /tmp/mccomp_tre.XXXXXX)
+cat > "$TRE/tre.c" <<'EOF'
+int sum(int n, int acc) { if (n == 0) { return acc; } return sum(n - 1, acc + n); }
+int fact(int n) { if (n <= 1) { return 1; } return n * fact(n - 1); }
+int tri(int n) { if (n == 0) { return 0; } return tri(n - 1) + n; }
+EOF
+for mode in "" --ssa; do
+  if ! (cd "$TRE" && "$COMP" $mode tre.c > /dev/null) ||
+    grep -q 'call i32 @\(sum\|fact\|tri\)' "$TRE/output.ll" ||
+    [ "$(grep -c '^tailrecurse:' "$TRE/output.ll")" != 3 ]; then
+    rm -rf "$TRE"
+    echo "tre.c: $mode tail recursion was not eliminated"; echo "TEST FAILED *****"; exit 1
+  fi
+  if ! (cd "$TRE" && "$COMP" $mode "$DIR/tests/rfact/rfact.c" > /dev/null) ||
+    sed -n '/^define i32 @multiplyNumbers/,/^}/p' "$TRE/output.ll" | grep -q 'call i32 @multiplyNumbers'; then
+    rm -rf "$TRE"
+    echo "rfact.c: $mode tail recursion was not eliminated"; echo "TEST FAILED *****"; exit 1
+  fi
+done
+rm -rf "$TRE"
+
+echo "AST dump *****"
+# the AST is only printed with --dump-ast; --dump-ast=json must write one
+# well-formed JSON event per line
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  "$COMP" ./$test.c > plain.out
+  "$COMP" --dump-ast=json ./$test.c > json.out
+  if [ "$(cat plain.out)" != "" ] || ! grep -q '^{"event":"begin","kind":"Program"}$' json.out ||
+    grep -v '^$' json.out | grep -qv '^{"event":"\(begin\|end\|leaf\)","kind":"[A-Za-z]*".*}$'; then
+    echo "$test: --dump-ast output is wrong"; echo "TEST FAILED *****"; exit 1
+  fi
+  rm -f plain.out json.out
+  cd ..
+done
+
+echo "Flat AST layout *****"
+# --ast-layout=flat must print the same AST and generate the same IR
+for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+  cd $test
+  for dump in --dump-ast --dump-ast=json; do
+    "$COMP" $dump ./$test.c > tree.out
+    mv output.ll tree.ll
+    "$COMP" $dump --ast-layout=flat ./$test.c > flat.out
+    if ! cmp -s tree.out flat.out || ! cmp -s tree.ll output.ll; then
+      echo "$test: --ast-layout=flat $dump differs"; echo "TEST FAILED *****"; exit 1
+    fi
+  done
+  rm -f tree.out flat.out tree.ll
+  cd ..
+done
+
+echo "Pipelined, streaming and parallel front ends *****"
+# --pipeline, --stream and --parallel-parse must print the same AST and
+# generate the same IR
+for mode in --pipeline --stream --parallel-parse; do
+  for test in addition factorial fibonacci pi while void cosine unary recurse rfact palindrome shortcircuit; do
+    cd $test
+    for dump in --dump-ast --dump-ast=json; do
+      "$COMP" $dump ./$test.c > seq.out
+      mv output.ll seq.ll
+      "$COMP" $dump $mode ./$test.c > mode.out
+      if ! cmp -s seq.out mode.out || ! cmp -s seq.ll output.ll; then
+        echo "$test: $mode $dump differs"; echo "TEST FAILED *****"; exit 1
+      fi
+    done
+    rm -f seq.out mode.out seq.ll
+    cd ..
+  done
+done
+
+echo "Parallel parsing of a large program *****"
+# a generated program big enough to be cut into several batches must compile
+# the same on any number of threads; so must copies of it with a syntax error,
+# a semantic error, and a warning and code after a return, and the errors must
+# be reported as the sequential compiler reports them
+PARSE=$(mktemp -d /tmp/mccomp_parse.XXXXXX)
+"$DIR/tests/bench/program.sh" 1000 > "$PARSE/good.c"
+sed '3997s/)/) )/' "$PARSE/good.c" > "$PARSE/syntax.c"
+sed '4001s/first_argument +/undeclared_name +/' "$PARSE/good.c" > "$PARSE/semantic.c"
+sed -e '3997s/^int/float/' -e '4011s/.*/  return 0;/' "$PARSE/good.c" > "$PARSE/warning.c"
+for input in good.c syntax.c semantic.c warning.c; do
+  (cd "$PARSE" && "$COMP" --dump-ast $input > seq.out 2> seq.err; mv output.ll seq.ll 2>/dev/null) || true
+  for jobs in 1 4; do
+    (cd "$PARSE" && "$COMP" --dump-ast --parallel-parse --jobs=$jobs $input > par.out 2> par.err) || true
+    if ! cmp -s "$PARSE/seq.out" "$PARSE/par.out" || ! cmp -s "$PARSE/seq.err" "$PARSE/par.err" ||
+      { [ -f "$PARSE/seq.ll" ] && ! cmp -s "$PARSE/seq.ll" "$PARSE/output.ll"; }; then
+      rm -rf "$PARSE"
+      echo "$input: --parallel-parse --jobs=$jobs differs"; echo "TEST FAILED *****"; exit 1
+    fi
+  done
+  rm -f "$PARSE"/seq.* "$PARSE"/output.ll
+done
+rm -rf "$PARSE"
+
+echo "Streaming peak memory *****"
+# --stream frees each declaration once it is written out, so the peak RSS for
+# a generated 1M-line program must stay close to that for a 250k-line one
+STREAM=$(mktemp -d /tmp/mccomp_stream.XXXXXX)
+"$DIR/tests/bench/program.sh" 58823 > "$STREAM/large.c"
+"$DIR/tests/bench/program.sh" 14705 > "$STREAM/small.c"
+function peak_rss {
+  (cd "$STREAM" && "$COMP" --stream --ast-stats $1 2>&1 >/dev/null | sed -n 's/^peak RSS: \([0-9]*\) KB$/\1/p')
+}
+SMALL=$(peak_rss small.c)
+LARGE=$(peak_rss large.c)
+rm -rf "$STREAM"
+echo "peak RSS: $SMALL KB for 250k lines, $LARGE KB for 1M lines"
+if (( LARGE * 10 > SMALL * 13 )); then
+  echo "--stream peak RSS grows with the program"; echo "TEST FAILED *****"; exit 1
+fi
+
 echo "***** ALL TESTS PASSED *****"